@@ -0,0 +1,154 @@
+"""Reader for the binary columnar waveform files written by the simulator with
+the .outputFormat directive. See "Waveform Format.md" for the layout.
+
+Only the standard library is needed. Columns are returned as array.array,
+which numpy.asarray converts without copying.
+
+    wf = Waveform("datadump.wfm")
+    times, v = wf.read("n3", 10e-9, 20e-9)
+    wf.to_text("datadump.txt")
+
+Run as a script it converts to the text format, or prints one column:
+
+    python waveform.py <waveform file> <text file>
+    python waveform.py <waveform file> -column <name> [<start> <end>]
+"""
+import bisect
+import struct
+import sys
+from array import array
+
+MAGIC = b"CSWFORM1"
+INDEX_MAGIC = b"CSWFINDX"
+TRAILER = struct.Struct("<QQ8s")
+CHUNK = struct.Struct("<QQQdd")
+
+
+class Chunk:
+    """An entry of the chunk index"""
+
+    def __init__(self, offset, first_row, rows, first_time, last_time):
+        self.offset = offset
+        self.first_row = first_row
+        self.rows = rows
+        self.first_time = first_time
+        self.last_time = last_time
+
+
+class Waveform:
+    """A waveform file. Opening it reads only the header and the chunk index;
+    read then seeks to the chunks it needs."""
+
+    def __init__(self, path):
+        self.file = open(path, "rb")
+        if self.file.read(8) != MAGIC:
+            raise ValueError("Not a waveform file: " + path)
+        self.value_size, num_columns, self.rows_per_chunk, self.timestep = (
+            struct.unpack("<IIQd", self.file.read(24)))
+        if self.value_size not in (4, 8):
+            raise ValueError("Bad waveform header: " + path)
+        self._read_string()
+        self._read_string()
+        self.columns = []
+        self.units = []
+        for _ in range(num_columns):
+            self.columns.append(self._read_string())
+            self.units.append(self._read_string())
+
+        self.file.seek(-TRAILER.size, 2)
+        index_offset, num_chunks, end = TRAILER.unpack(
+            self.file.read(TRAILER.size))
+        if end != INDEX_MAGIC:
+            raise ValueError("Waveform file has no index, was it finished? "
+                             + path)
+        self.file.seek(index_offset)
+        self.chunks = [Chunk(*CHUNK.unpack(self.file.read(CHUNK.size)))
+                       for _ in range(num_chunks)]
+
+    def close(self):
+        self.file.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    @property
+    def rows(self):
+        """The number of rows, i.e. steps"""
+        if not self.chunks:
+            return 0
+        return self.chunks[-1].first_row + self.chunks[-1].rows
+
+    def read(self, column, start=float("-inf"), end=float("inf")):
+        """The times in [start, end], and a column's value at each of them.
+        column is a name, e.g. "n3", or an index into columns."""
+        if isinstance(column, str):
+            column = self.columns.index(column)
+        times = array("d")
+        values = array("d")
+        # the first chunk that ends in the window
+        first = bisect.bisect_left([c.last_time for c in self.chunks], start)
+        for chunk in self.chunks[first:]:
+            if chunk.first_time > end:
+                break
+            chunk_times, chunk_values = self._read_chunk(chunk, column)
+            for t, v in zip(chunk_times, chunk_values):
+                if start <= t <= end:
+                    times.append(t)
+                    values.append(v)
+        return times, values
+
+    def to_text(self, path):
+        """Writes the whole file in the tab separated text format the
+        simulator writes by default"""
+        with open(path, "w", newline="") as out:
+            out.write("\t".join(["time"] + self.columns))
+            for chunk in self.chunks:
+                columns = [self._read_chunk(chunk, k)[1]
+                           for k in range(len(self.columns))]
+                times = self._read_chunk(chunk, 0)[0]
+                for r in range(chunk.rows):
+                    out.write("\n" + "\t".join(
+                        "%.9g" % v
+                        for v in [times[r]] + [c[r] for c in columns]))
+
+    def _read_string(self):
+        (length,) = struct.unpack("<I", self.file.read(4))
+        return self.file.read(length).decode()
+
+    def _read_chunk(self, chunk, column):
+        self.file.seek(chunk.offset)
+        times = array("d", self.file.read(chunk.rows * 8))
+        self.file.seek(chunk.offset + chunk.rows * (8 + column * self.value_size))
+        values = array("d" if self.value_size == 8 else "f",
+                       self.file.read(chunk.rows * self.value_size))
+        if sys.byteorder != "little":
+            times.byteswap()
+            values.byteswap()
+        return times, values
+
+
+def main(argv):
+    column_mode = len(argv) > 3 and argv[2] == "-column"
+    if len(argv) < 3 or (argv[2] == "-column" and not column_mode):
+        print("Usage: python waveform.py <waveform file> <text file>\n"
+              "       python waveform.py <waveform file> -column <name> "
+              "[<start> <end>]")
+        return 1
+    with Waveform(argv[1]) as wf:
+        if not column_mode:
+            wf.to_text(argv[2])
+            return 0
+        window = [float(t) for t in argv[4:6]]
+        times, values = wf.read(argv[3], *window)
+        unit = wf.units[wf.columns.index(argv[3])]
+        print("time\t%s (%s)" % (argv[3], unit))
+        for t, v in zip(times, values):
+            print("%.9g\t%.9g" % (t, v))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,64 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <string>
+#include "CircuitSimulator/Waveform.hpp"
+
+/// @brief Converts a waveform file written with .outputFormat to the tab
+///        separated text format, or prints one column over a time window.
+///
+/// Usage:
+///     WaveformToText <waveform file> <text file>
+///     WaveformToText <waveform file> -column <name> [<start time> <end time>]
+///
+/// @param argc
+/// @param argv[]
+///
+/// @return statuscode
+int
+main(int argc, char * argv[]) {
+    const bool columnMode = argc > 3 && std::string(argv[2]) == "-column";
+    if (argc < 3 || (std::string(argv[2]) == "-column" && !columnMode)) {
+        std::cout << "Usage: " << argv[0] << " <waveform file> <text file>\n"
+                  << "       " << argv[0]
+                  << " <waveform file> -column <name> [<start time> <end time>]"
+                  << std::endl;
+        return 1;
+    }
+
+    try {
+        Waveform::Reader reader(argv[1]);
+        if (!columnMode) {
+            std::ofstream text(argv[2]);
+            reader.writeText(text);
+            return 0;
+        }
+
+        const std::string name = argv[3];
+        const size_t column = reader.columnIndex(name);
+        if (column == reader.columns.size()) {
+            std::cout << "No column " << name << std::endl;
+            return 1;
+        }
+        double startTime = -std::numeric_limits<double>::infinity();
+        double endTime = std::numeric_limits<double>::infinity();
+        if (argc > 5) {
+            startTime = std::stod(argv[4]);
+            endTime = std::stod(argv[5]);
+        }
+        std::vector<double> times;
+        std::vector<double> values;
+        reader.read(column, startTime, endTime, times, values);
+        std::cout << std::setprecision(9) << "time\t" << name << " ("
+                  << reader.units[column] << ")";
+        for (size_t n = 0; n < times.size(); n++) {
+            std::cout << "\n" << times[n] << "\t" << values[n];
+        }
+        std::cout << std::endl;
+    } catch (const std::exception & e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
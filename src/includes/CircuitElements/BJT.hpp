@@ -2,6 +2,7 @@
 #define _BJT_HPP_INC_
 #include "CircuitElements/Component.hpp"
 #include "Maths/DynamicMatrix.hpp"
+#include "Maths/VectorMath.hpp"
 
 /// @brief A simple NPN BJT model
 ///
@@ -13,104 +14,117 @@ public:
     size_t b = 0;
     size_t e = 0;
 
+    using NonLinearMap = StampMap<T, 9, 3>;
+    /// @brief Where addNonLinearStampTo writes in the stamp last written to
+    mutable NonLinearMap nonLinearMap;
+
     T alpha_f = 0.99;
     T alpha_r = 0.02;
 
-    const T I_es = 2e-14;
-    const T V_Te = 26e-3;
-    const T I_cs = 99e-14;
-    const T V_Tc = 26e-3;
+    static constexpr T I_es = 2e-14;
+    static constexpr T V_Te = 26e-3;
+    static constexpr T I_cs = 99e-14;
+    static constexpr T V_Tc = 26e-3;
+
+    static inline const T V_bc_crit =
+        V_Tc * std::log(V_Tc / (I_cs * std::sqrt(2)));
+    static inline const T V_be_crit =
+        V_Te * std::log(V_Te / (I_es * std::sqrt(2)));
 
-    T V_bc_crit = V_Tc * std::log(V_Tc / (I_cs * std::sqrt(2)));
-    T V_be_crit = V_Te * std::log(V_Te / (I_es * std::sqrt(2)));
 
+    bool hasTimeInvariantDynamicG() const {
+        return true;
+    }
 
     void
-    addNonLinearStampTo(Stamp<T> & stamp, const Matrix<T> & solutionMatrix,
+    addNonLinearStampTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
                         const size_t currentSolutionIndex, T timestep = 0) const {
-        const size_t bp = b - 1;
-        const size_t cp = c - 1;
-        const size_t ep = e - 1;
-
-        T v_be = 0;
-        T v_bc = 0;
-
-        if (b > 0) {
-            v_be = solutionMatrix(bp, currentSolutionIndex);
-            v_bc = solutionMatrix(bp, currentSolutionIndex);
-        }
-
-        if (e > 0) {
-            v_be -= solutionMatrix(ep, currentSolutionIndex);
-        }
-
-        if (c > 0) {
-            v_bc -= solutionMatrix(cp, currentSolutionIndex);
+        T v_be = nodeVoltage(solutionMatrix, b, e, currentSolutionIndex);
+        T v_bc = nodeVoltage(solutionMatrix, b, c, currentSolutionIndex);
+        limit(v_be, v_bc);
+
+        std::array<T, 9> gValues;
+        std::array<T, 3> sValues;
+        companion(v_be, v_bc, std::exp(emitterExponent(v_be)),
+                  std::exp(collectorExponent(v_bc)), alpha_f, alpha_r, gValues,
+                  sValues);
+
+        if (!nonLinearMap.isResolvedFor(stamp)) {
+            const size_t en = NonLinearMap::node(e);
+            const size_t cn = NonLinearMap::node(c);
+            const size_t bn = NonLinearMap::node(b);
+            nonLinearMap.resolve(stamp,
+                                 {{en, en}, {en, cn}, {en, bn},
+                                  {cn, cn}, {cn, en}, {cn, bn},
+                                  {bn, bn}, {bn, en}, {bn, cn}},
+                                 {en, cn, bn});
         }
+        nonLinearMap.scatter(gValues, sValues);
+    }
 
+    /// @brief Limits the junction voltages to their critical voltages
+    static void limit(T & v_be, T & v_bc) {
         v_be = std::min(V_be_crit, v_be);
         v_bc = std::min(V_bc_crit, v_bc);
+    }
 
-        T i_e = -I_es * (std::exp(v_be / V_Te) - 1) +
-                alpha_r * I_cs * (std::exp(v_bc / V_Tc) - 1);
-        T i_c = alpha_f * I_es * (std::exp(v_be / V_Te) - 1) -
-                I_cs * (std::exp(v_bc / V_Tc) - 1);
+    /// @brief The arguments of the exponentials of the emitter and collector
+    ///        diodes
+    static T emitterExponent(T v_be) {
+        return v_be / V_Te;
+    }
+
+    static T collectorExponent(T v_bc) {
+        return v_bc / V_Tc;
+    }
+
+    /// @brief The companion model of the transistor, linearised about v_be and
+    ///        v_bc
+    ///
+    /// @param v_be The base-emitter voltage, after limit
+    /// @param v_bc The base-collector voltage, after limit
+    /// @param expBE exp(emitterExponent(v_be))
+    /// @param expBC exp(collectorExponent(v_bc))
+    /// @param gValues The values of G, in the order addNonLinearStampTo
+    ///                resolves their entries in
+    /// @param sValues The values of s, for e, c and b
+    static void companion(T v_be, T v_bc, T expBE, T expBC, T alpha_f, T alpha_r,
+                          std::array<T, 9> & gValues, std::array<T, 3> & sValues) {
+        T i_e = -I_es * (expBE - 1) + alpha_r * I_cs * (expBC - 1);
+        T i_c = alpha_f * I_es * (expBE - 1) - I_cs * (expBC - 1);
         // T i_b = - ( i_e + i_c ); This is unused
 
-        T g_ee = (I_es / V_Te) * std::exp(v_be / V_Te);
-        T g_ec = alpha_r * (I_cs / V_Tc) * std::exp(v_bc / V_Tc);
-        T g_ce = alpha_f * (I_es / V_Te) * std::exp(v_be / V_Te);
-        T g_cc = (I_cs / V_Tc) * std::exp(v_bc / V_Tc);
+        T g_ee = (I_es / V_Te) * expBE;
+        T g_ec = alpha_r * (I_cs / V_Tc) * expBC;
+        T g_ce = alpha_f * (I_es / V_Te) * expBE;
+        T g_cc = (I_cs / V_Tc) * expBC;
 
         T I_e = i_e + g_ee * v_be - g_ec * v_bc;
         T I_c = i_c - g_ce * v_be + g_cc * v_bc;
 
-        if (e > 0) {
-            stamp.G(ep, ep) += g_ee;
-            stamp.s(ep, 0) += -I_e;
-
-            if (c > 0) {
-                stamp.G(ep, cp) += -g_ec;
-            }
-
-            if (b > 0) {
-                stamp.G(ep, bp) += (g_ec - g_ee);
-            }
-        }
-
-        if (c > 0) {
-            stamp.G(cp, cp) += g_cc;
-            stamp.s(cp, 0) += -I_c;
-
-            if (e > 0) {
-                stamp.G(cp, ep) += -g_ce;
-            }
-
-            if (b > 0) {
-                stamp.G(cp, bp) += (g_ce - g_cc);
-            }
-        }
-
-        if (b > 0) {
-            stamp.G(bp, bp) += g_cc + g_ee - g_ce - g_ec;
-            stamp.s(bp, 0) += I_e + I_c;
-
-            if (e > 0) {
-                stamp.G(bp, ep) += g_ce - g_ee;
-            }
+        gValues = {g_ee, -g_ec, g_ec - g_ee,
+                   g_cc, -g_ce, g_ce - g_cc,
+                   g_cc + g_ee - g_ce - g_ec, g_ce - g_ee, g_ec - g_cc};
+        sValues = {-I_e, -I_c, I_e + I_c};
+    }
 
-            if (c > 0) {
-                stamp.G(bp, cp) += (g_ec - g_cc);
-            }
-        }
+    /// @brief The currents of the emitter and collector diodes, and their
+    ///        derivatives with respect to v_be and v_bc, for DeviceBypass
+    static void junctions(T expBE, T expBC, T & i_be, T & g_be, T & i_bc,
+                          T & g_bc) {
+        i_be = I_es * (expBE - 1);
+        g_be = (I_es / V_Te) * expBE;
+        i_bc = I_cs * (expBC - 1);
+        g_bc = (I_cs / V_Tc) * expBC;
     }
 
-    void updateStoredState(const Matrix<T> & solutionMatrix,
+    void updateStoredState(const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex, T timestep,
                            size_t sizeG_A) {
     }
 
-    void addDCAnalysisStampTo(Stamp<T> & stamp, const Matrix<T> & solutionVector,
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector,
                               size_t numCurrents) const {
         addNonLinearStampTo(stamp, solutionVector, 0, 0);
     }
@@ -136,11 +150,7 @@ public:
         numNodes = std::max(numNodes, std::stoull(matches.str(4)));
 
 
-        elements.nonLinearElements.emplace_back(std::make_shared<BJTN<T> >(bjt));
-        elements.nodeComponentMap.insert(
-            {{bjt.b, elements.nonLinearElements.back()},
-             {bjt.c, elements.nonLinearElements.back()},
-             {bjt.e, elements.nonLinearElements.back()}});
+        elements.npnTransistors.add(bjt);
     }
 };
 
@@ -154,48 +164,78 @@ public:
     size_t b = 0;
     size_t e = 0;
 
+    using NonLinearMap = StampMap<T, 9, 3>;
+    /// @brief Where addNonLinearStampTo writes in the stamp last written to
+    mutable NonLinearMap nonLinearMap;
+
     T alpha_f = 0.99;
     T alpha_r = 0.02;
 
-    const T I_es = 2e-14;
-    const T V_Te = 26e-3;
-    const T I_cs = 99e-14;
-    const T V_Tc = 26e-3;
+    static constexpr T I_es = 2e-14;
+    static constexpr T V_Te = 26e-3;
+    static constexpr T I_cs = 99e-14;
+    static constexpr T V_Tc = 26e-3;
 
-    T V_bc_crit = V_Tc * std::log(V_Tc / (I_cs * std::sqrt(2)));
-    T V_be_crit = V_Te * std::log(V_Te / (I_es * std::sqrt(2)));
+    static inline const T V_bc_crit =
+        V_Tc * std::log(V_Tc / (I_cs * std::sqrt(2)));
+    static inline const T V_be_crit =
+        V_Te * std::log(V_Te / (I_es * std::sqrt(2)));
 
 
+    bool hasTimeInvariantDynamicG() const {
+        return true;
+    }
+
     void
-    addNonLinearStampTo(Stamp<T> & stamp, const Matrix<T> & solutionMatrix,
+    addNonLinearStampTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
                         const size_t currentSolutionIndex, T timestep = 0) const {
-        const size_t bp = b - 1;
-        const size_t cp = c - 1;
-        const size_t ep = e - 1;
-
-        T v_be = 0;
-        T v_bc = 0;
-
-        if (b > 0) {
-            v_be = solutionMatrix(bp, currentSolutionIndex);
-            v_bc = solutionMatrix(bp, currentSolutionIndex);
-        }
-
-        if (e > 0) {
-            v_be -= solutionMatrix(ep, currentSolutionIndex);
-        }
-
-        if (c > 0) {
-            v_bc -= solutionMatrix(cp, currentSolutionIndex);
+        T v_be = nodeVoltage(solutionMatrix, b, e, currentSolutionIndex);
+        T v_bc = nodeVoltage(solutionMatrix, b, c, currentSolutionIndex);
+        limit(v_be, v_bc);
+
+        std::array<T, 9> gValues;
+        std::array<T, 3> sValues;
+        companion(v_be, v_bc, std::exp(emitterExponent(v_be)),
+                  std::exp(collectorExponent(v_bc)), alpha_f, alpha_r, gValues,
+                  sValues);
+
+        if (!nonLinearMap.isResolvedFor(stamp)) {
+            const size_t en = NonLinearMap::node(e);
+            const size_t cn = NonLinearMap::node(c);
+            const size_t bn = NonLinearMap::node(b);
+            nonLinearMap.resolve(stamp,
+                                 {{en, en}, {en, cn}, {en, bn},
+                                  {cn, cn}, {cn, en}, {cn, bn},
+                                  {bn, bn}, {bn, en}, {bn, cn}},
+                                 {en, cn, bn});
         }
+        nonLinearMap.scatter(gValues, sValues);
+    }
 
+    /// @brief Limits the junction voltages to minus their critical voltages
+    static void limit(T & v_be, T & v_bc) {
         v_be = std::max(-V_be_crit, v_be);
         v_bc = std::max(-V_bc_crit, v_bc);
+    }
 
-        T i_F = I_cs * (std::exp(-v_bc / V_Tc) - 1);
-        T i_R = I_es * (std::exp(-v_be / V_Te) - 1);
-        T di_F = -(I_cs / V_Tc) * std::exp(-v_bc / V_Tc);
-        T di_R = -(I_es / V_Te) * std::exp(-v_be / V_Te);
+    /// @brief The arguments of the exponentials of the emitter and collector
+    ///        diodes
+    static T emitterExponent(T v_be) {
+        return -v_be / V_Te;
+    }
+
+    static T collectorExponent(T v_bc) {
+        return -v_bc / V_Tc;
+    }
+
+    /// @brief The companion model of the transistor, linearised about v_be and
+    ///        v_bc. See BJTN::companion.
+    static void companion(T v_be, T v_bc, T expBE, T expBC, T alpha_f, T alpha_r,
+                          std::array<T, 9> & gValues, std::array<T, 3> & sValues) {
+        T i_F = I_cs * (expBC - 1);
+        T i_R = I_es * (expBE - 1);
+        T di_F = -(I_cs / V_Tc) * expBC;
+        T di_R = -(I_es / V_Te) * expBE;
 
         T i_e = i_R - alpha_f * i_F;
         T i_b = (alpha_f - 1) * i_F + (alpha_r - 1) * i_R;
@@ -212,52 +252,28 @@ public:
         T I_c = i_c - g_ce * v_be - g_cc * v_bc;
         T I_b = i_b - g_be * v_be - g_bc * v_bc;
 
-        if (e > 0) {
-            stamp.G(ep, ep) += -g_ee;
-            stamp.s(ep, 0) += -I_e;
-
-            if (c > 0) {
-                stamp.G(ep, cp) += -g_ec;
-            }
-
-            if (b > 0) {
-                stamp.G(ep, bp) += g_ec + g_ee;
-            }
-        }
-
-        if (c > 0) {
-            stamp.G(cp, cp) += -g_cc;
-            stamp.s(cp, 0) += -I_c;
-
-            if (e > 0) {
-                stamp.G(cp, ep) += -g_ce;
-            }
-
-            if (b > 0) {
-                stamp.G(cp, bp) += g_ce + g_cc;
-            }
-        }
-
-        if (b > 0) {
-            stamp.G(bp, bp) += g_be + g_bc;
-            stamp.s(bp, 0) += -I_b;
-
-            if (e > 0) {
-                stamp.G(bp, ep) += -g_be;
-            }
+        gValues = {-g_ee, -g_ec, g_ec + g_ee,
+                   -g_cc, -g_ce, g_ce + g_cc,
+                   g_be + g_bc, -g_be, -g_bc};
+        sValues = {-I_e, -I_c, -I_b};
+    }
 
-            if (c > 0) {
-                stamp.G(bp, cp) += -g_bc;
-            }
-        }
+    /// @brief See BJTN::junctions
+    static void junctions(T expBE, T expBC, T & i_be, T & g_be, T & i_bc,
+                          T & g_bc) {
+        i_be = I_es * (expBE - 1);
+        g_be = -(I_es / V_Te) * expBE;
+        i_bc = I_cs * (expBC - 1);
+        g_bc = -(I_cs / V_Tc) * expBC;
     }
 
-    void updateStoredState(const Matrix<T> & solutionMatrix,
+    void updateStoredState(const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex, T timestep,
                            size_t sizeG_A) {
     }
 
-    void addDCAnalysisStampTo(Stamp<T> & stamp, const Matrix<T> & solutionVector,
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector,
                               size_t numCurrents) const {
         addNonLinearStampTo(stamp, solutionVector, 0, 0);
     }
@@ -283,11 +299,153 @@ public:
         numNodes = std::max(numNodes, std::stoull(matches.str(4)));
 
 
-        elements.nonLinearElements.emplace_back(std::make_shared<BJTP<T> >(bjt));
-        elements.nodeComponentMap.insert(
-            {{bjt.b, elements.nonLinearElements.back()},
-             {bjt.c, elements.nonLinearElements.back()},
-             {bjt.e, elements.nonLinearElements.back()}});
+        elements.pnpTransistors.add(bjt);
     }
 };
+
+/// @brief Every transistor of one model of a netlist, stored field by field as
+///        DiodeBank stores diodes.
+///
+/// @details The transistors are evaluated in blocks of evaluationBlock. The
+///          emitter and collector exponentials of a block are computed together
+///          by one VectorMath::exp, then each transistor's companion model is
+///          scattered into the stamp. The blocks of large banks are spread over
+///          threads, see BankStampMap::forEachColour.
+///
+/// @tparam T the value type
+/// @tparam Model BJTN or BJTP, which provides the model equations
+template<typename T, template<typename> typename Model>
+struct BJTBank {
+    std::vector<std::string> designator;
+    std::vector<size_t> c;
+    std::vector<size_t> b;
+    std::vector<size_t> e;
+    std::vector<T> alpha_f;
+    std::vector<T> alpha_r;
+
+    /// @brief Statistics for the report
+    mutable BypassCounters counters;
+
+    size_t size() const {
+        return c.size();
+    }
+
+    void add(const Model<T> & bjt) {
+        designator.push_back(bjt.designator);
+        c.push_back(bjt.c);
+        b.push_back(bjt.b);
+        e.push_back(bjt.e);
+        alpha_f.push_back(bjt.alpha_f);
+        alpha_r.push_back(bjt.alpha_r);
+        last.emplace_back();
+        nonLinearMap = {};
+    }
+
+    /// @param bypass When the transistors may reuse their last evaluation
+    void
+    addNonLinearStampTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
+                        const size_t currentSolutionIndex,
+                        const DeviceBypass<T> & bypass = {}) const {
+        if (!nonLinearMap.isResolvedFor(stamp)) {
+            std::vector<std::pair<size_t, size_t> > gEntries;
+            std::vector<size_t> sRows;
+            for (size_t i = 0; i < size(); i++) {
+                const size_t en = NonLinearMap::node(e[i]);
+                const size_t cn = NonLinearMap::node(c[i]);
+                const size_t bn = NonLinearMap::node(b[i]);
+                gEntries.insert(gEntries.end(), {{en, en}, {en, cn}, {en, bn},
+                                                 {cn, cn}, {cn, en}, {cn, bn},
+                                                 {bn, bn}, {bn, en}, {bn, cn}});
+                sRows.insert(sRows.end(), {en, cn, bn});
+            }
+            nonLinearMap.resolve(stamp, gEntries, sRows);
+        }
+
+        nonLinearMap.forEachColour([&](const size_t * devices, size_t count) {
+            evaluate(devices, count, solutionMatrix, currentSolutionIndex, bypass);
+        });
+    }
+
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector) const {
+        addNonLinearStampTo(stamp, solutionVector, 0);
+    }
+
+private:
+    static constexpr size_t evaluationBlock = 256;
+
+    using NonLinearMap = BankStampMap<T, 9, 3>;
+    mutable NonLinearMap nonLinearMap;
+
+    /// @brief The last evaluation of a transistor, for DeviceBypass
+    struct Evaluation {
+        /// @brief The junction voltages, before limiting. NaN until the first
+        ///        evaluation, so that it can't be bypassed.
+        T v_be = std::numeric_limits<T>::quiet_NaN();
+        T v_bc = std::numeric_limits<T>::quiet_NaN();
+        T i_be = 0;
+        T g_be = 0;
+        T i_bc = 0;
+        T g_bc = 0;
+        std::array<T, 9> gValues = {};
+        std::array<T, 3> sValues = {};
+    };
+    mutable std::vector<Evaluation> last;
+
+    /// @brief Evaluates, or bypasses, and scatters the listed transistors
+    void evaluate(const size_t * devices, size_t count,
+                  const SolutionHistory<T> & solutionMatrix,
+                  const size_t currentSolutionIndex,
+                  const DeviceBypass<T> & bypass) const {
+        // the transistors of the block that need evaluating
+        std::array<size_t, evaluationBlock> pending;
+        std::array<T, evaluationBlock> v_be;
+        std::array<T, evaluationBlock> v_bc;
+        // the emitter exponentials of a block, followed by the collector ones
+        std::array<T, 2 * evaluationBlock> ex;
+        size_t bypassed = 0;
+        for (size_t start = 0; start < count; start += evaluationBlock) {
+            const size_t blockSize = std::min(evaluationBlock, count - start);
+            size_t numPending = 0;
+            for (size_t k = 0; k < blockSize; k++) {
+                const size_t i = devices[start + k];
+                Evaluation & l = last[i];
+                T vbe = nodeVoltage(solutionMatrix, b[i], e[i],
+                                    currentSolutionIndex);
+                T vbc = nodeVoltage(solutionMatrix, b[i], c[i],
+                                    currentSolutionIndex);
+                if (bypass.canBypass(vbe, l.v_be, l.g_be, l.i_be) &&
+                    bypass.canBypass(vbc, l.v_bc, l.g_bc, l.i_bc)) {
+                    nonLinearMap.scatter(i, l.gValues, l.sValues);
+                    bypassed++;
+                    continue;
+                }
+                l.v_be = vbe;
+                l.v_bc = vbc;
+                pending[numPending] = i;
+                Model<T>::limit(vbe, vbc);
+                v_be[numPending] = vbe;
+                v_bc[numPending] = vbc;
+                numPending++;
+            }
+            for (size_t k = 0; k < numPending; k++) {
+                ex[k] = Model<T>::emitterExponent(v_be[k]);
+                ex[numPending + k] = Model<T>::collectorExponent(v_bc[k]);
+            }
+            VectorMath::exp(ex.data(), ex.data(), 2 * numPending);
+            for (size_t k = 0; k < numPending; k++) {
+                const size_t i = pending[k];
+                Evaluation & l = last[i];
+                const T expBE = ex[k];
+                const T expBC = ex[numPending + k];
+                Model<T>::companion(v_be[k], v_bc[k], expBE, expBC, alpha_f[i],
+                                    alpha_r[i], l.gValues, l.sValues);
+                Model<T>::junctions(expBE, expBC, l.i_be, l.g_be, l.i_bc, l.g_bc);
+                nonLinearMap.scatter(i, l.gValues, l.sValues);
+            }
+        }
+        counters.add(count - bypassed, bypassed);
+    }
+};
+
 #endif
@@ -17,72 +17,90 @@ public:
     T lastCurrent = 0;
 
     bool trapezoidalRule = true;
-    void addDynamicStampTo(Stamp<T> & stamp, const Matrix<T> & solutionMatrix,
-                           const size_t currentSolutionIndex, T timestep) const {
-        size_t n1p = n1 - 1;
-        size_t n2p = n2 - 1;
-
-        T u0 = 0;
-        if (n1) {
-            u0 = solutionMatrix(n1p, currentSolutionIndex - 1);
-        }
 
-        if (n2) {
-            u0 -= solutionMatrix(n2p, currentSolutionIndex - 1);
-        }
+    using DynamicMap = StampMap<T, 4, 0>;
+    using RHSMap = StampMap<T, 0, 2>;
+    /// @brief Where addDynamicStampTo and addDynamicRHSTo write in the stamps
+    ///        last written to
+    mutable DynamicMap dynamicMap;
+    mutable RHSMap rhsMap;
 
+    /// @brief The conductance of the companion model
+    static T companionConductance(T value, T timestep, bool trapezoidalRule) {
+        return trapezoidalRule ? 2 * value / timestep : value / timestep;
+    }
 
-        T G_eq = 0;
-        T I_eq = 0;
+    /// @brief The current source of the companion model
+    ///
+    /// @param u0 The voltage across the capacitor at the last timestep
+    static T companionCurrent(T value, T lastCurrent, T u0, T timestep,
+                              bool trapezoidalRule) {
+        T G_eq = companionConductance(value, timestep, trapezoidalRule);
+        return trapezoidalRule ? lastCurrent + G_eq * u0 : value * u0 / timestep;
+    }
 
-        if (trapezoidalRule) {
-            G_eq = 2 * value / timestep;
-            I_eq = lastCurrent + G_eq * u0;
-        } else {
-            G_eq = value / timestep;
-            I_eq = value * u0 / timestep;
+    /// @brief The current through the capacitor at the end of a timestep
+    ///
+    /// @param u0 The voltage across the capacitor at the start of the timestep
+    /// @param u1 The voltage across the capacitor at the end of the timestep
+    static T nextCurrent(T value, T lastCurrent, T u0, T u1, T timestep,
+                         bool trapezoidalRule) {
+        if (!trapezoidalRule) {
+            return lastCurrent;
         }
+        T G_eq = 2 * value / timestep;
+        return G_eq * u1 - (lastCurrent + G_eq * u0);
+    }
 
-        if (n1) {
-            stamp.G(n1p, n1p) += G_eq;
-            stamp.s(n1p, 0) += I_eq;
-        }
+    void addDynamicStampTo(Stamp<T> & stamp,
+                           const SolutionHistory<T> & solutionMatrix,
+                           const size_t currentSolutionIndex, T timestep) const {
+        T G_eq = companionConductance(value, timestep, trapezoidalRule);
 
-        if (n2) {
-            stamp.G(n2p, n2p) += G_eq;
-            stamp.s(n2p, 0) += -I_eq;
+        if (!dynamicMap.isResolvedFor(stamp)) {
+            const size_t a = DynamicMap::node(n1);
+            const size_t b = DynamicMap::node(n2);
+            dynamicMap.resolve(stamp, {{a, a}, {b, b}, {a, b}, {b, a}});
         }
+        const std::array<T, 4> gValues = {G_eq, G_eq, -G_eq, -G_eq};
+        dynamicMap.scatter(gValues);
+
+        addDynamicRHSTo(stamp, solutionMatrix, currentSolutionIndex, timestep);
+    }
 
-        if (n1 && n2) {
-            stamp.G(n1p, n2p) += -G_eq;
-            stamp.G(n2p, n1p) += -G_eq;
+    void addDynamicRHSTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
+                         const size_t currentSolutionIndex, T timestep) const {
+        T u0 = nodeVoltage(solutionMatrix, n1, n2, currentSolutionIndex - 1);
+        T I_eq = companionCurrent(value, lastCurrent, u0, timestep,
+                                  trapezoidalRule);
+
+        if (!rhsMap.isResolvedFor(stamp)) {
+            rhsMap.resolve(stamp, {}, {RHSMap::node(n1), RHSMap::node(n2)});
         }
+        const std::array<T, 2> sValues = {I_eq, -I_eq};
+        rhsMap.scatter({}, sValues);
     }
 
-    void updateStoredState(const Matrix<T> & solutionMatrix,
-                           const size_t currentSolutionIndex, T timestep,
-                           size_t sizeG_A) {
-        if (trapezoidalRule) {
-            size_t n1p = n1 - 1;
-            size_t n2p = n2 - 1;
-            T u0 = 0;
-            T u1 = 0;
-            if (n1) {
-                u0 = solutionMatrix(n1p, currentSolutionIndex - 1);
-                u1 = solutionMatrix(n1p, currentSolutionIndex);
-            }
+    bool hasTimeInvariantDynamicG() const {
+        return true;
+    }
 
-            if (n2) {
-                u0 -= solutionMatrix(n2p, currentSolutionIndex - 1);
-                u1 -= solutionMatrix(n2p, currentSolutionIndex);
-            }
+    /// @brief The companion model integrates from the step before
+    size_t historyDepth() const {
+        return 1;
+    }
 
-            T G_eq = 2 * value / timestep;
-            lastCurrent = G_eq * u1 - (lastCurrent + G_eq * u0);
-        }
+    void updateStoredState(const SolutionHistory<T> & solutionMatrix,
+                           const size_t currentSolutionIndex, T timestep,
+                           size_t sizeG_A) {
+        T u0 = nodeVoltage(solutionMatrix, n1, n2, currentSolutionIndex - 1);
+        T u1 = nodeVoltage(solutionMatrix, n1, n2, currentSolutionIndex);
+        lastCurrent = nextCurrent(value, lastCurrent, u0, u1, timestep,
+                                  trapezoidalRule);
     }
 
-    void addDCAnalysisStampTo(Stamp<T> & stamp, const Matrix<T> & solutionVector,
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector,
                               size_t numCurrents) const {
         // open circuit. Maybe add large connection to ref if unstable
         if (n1 > 0) {
@@ -119,13 +137,143 @@ public:
             static_assert("Unsupported Type");
         }
 
-        elements.dynamicElements.emplace_back(
-            std::make_shared<Capacitor<T> >(capacitor));
+        elements.capacitors.add(capacitor);
+    }
+};
+
+/// @brief Every capacitor of a netlist, stored field by field rather than
+///        capacitor by capacitor, so that stamping them is one loop over
+///        contiguous arrays instead of a virtual call each.
+///
+/// @tparam T the value type
+template<typename T>
+struct CapacitorBank {
+    std::vector<std::string> designator;
+    std::vector<size_t> n1;
+    std::vector<size_t> n2;
+    std::vector<T> value;
+    std::vector<T> lastCurrent;
+
+    /// @brief The integration rule, shared by every capacitor
+    bool trapezoidalRule = true;
+
+    size_t size() const {
+        return n1.size();
+    }
+
+    void add(const Capacitor<T> & capacitor) {
+        designator.push_back(capacitor.designator);
+        n1.push_back(capacitor.n1);
+        n2.push_back(capacitor.n2);
+        value.push_back(capacitor.value);
+        lastCurrent.push_back(capacitor.lastCurrent);
+        trapezoidalRule = capacitor.trapezoidalRule;
+        dynamicMap = {};
+        rhsMap = {};
+    }
+
+    void addDynamicStampTo(Stamp<T> & stamp,
+                           const SolutionHistory<T> & solutionMatrix,
+                           const size_t currentSolutionIndex, T timestep) const {
+        if (!dynamicMap.isResolvedFor(stamp)) {
+            std::vector<std::pair<size_t, size_t> > gEntries;
+            for (size_t i = 0; i < size(); i++) {
+                const size_t a = DynamicMap::node(n1[i]);
+                const size_t b = DynamicMap::node(n2[i]);
+                gEntries.insert(gEntries.end(), {{a, a}, {b, b}, {a, b}, {b, a}});
+            }
+            dynamicMap.resolve(stamp, gEntries, {});
+        }
+        for (size_t i = 0; i < size(); i++) {
+            T G_eq = Capacitor<T>::companionConductance(value[i], timestep,
+                                                        trapezoidalRule);
+            dynamicMap.scatter(i, {G_eq, G_eq, -G_eq, -G_eq});
+        }
+
+        addDynamicRHSTo(stamp, solutionMatrix, currentSolutionIndex, timestep);
+    }
+
+    void addDynamicRHSTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
+                         const size_t currentSolutionIndex, T timestep) const {
+        if (!rhsMap.isResolvedFor(stamp)) {
+            std::vector<size_t> sRows;
+            for (size_t i = 0; i < size(); i++) {
+                sRows.insert(sRows.end(),
+                             {RHSMap::node(n1[i]), RHSMap::node(n2[i])});
+            }
+            rhsMap.resolve(stamp, {}, sRows);
+        }
+        for (size_t i = 0; i < size(); i++) {
+            T u0 = nodeVoltage(solutionMatrix, n1[i], n2[i],
+                               currentSolutionIndex - 1);
+            T I_eq = Capacitor<T>::companionCurrent(value[i], lastCurrent[i], u0,
+                                                    timestep, trapezoidalRule);
+            rhsMap.scatter(i, {}, {I_eq, -I_eq});
+        }
+    }
+
+    /// @brief Updates the stored currents. Large banks are split between the
+    ///        threads of ThreadPool::shared(); each capacitor only writes its own.
+    void updateStoredState(const SolutionHistory<T> & solutionMatrix,
+                           const size_t currentSolutionIndex, T timestep) {
+        auto update = [&](size_t begin, size_t end, size_t) {
+            for (size_t i = begin; i < end; i++) {
+                T u0 = nodeVoltage(solutionMatrix, n1[i], n2[i],
+                                   currentSolutionIndex - 1);
+                T u1 = nodeVoltage(solutionMatrix, n1[i], n2[i],
+                                   currentSolutionIndex);
+                lastCurrent[i] = Capacitor<T>::nextCurrent(value[i], lastCurrent[i],
+                                                           u0, u1, timestep,
+                                                           trapezoidalRule);
+            }
+        };
+        ThreadPool::shared().parallelFor(size(), update, parallelUpdateGrain);
+    }
 
-        elements.nodeComponentMap.insert(
-            {{capacitor.n1, elements.dynamicElements.back()},
-             {capacitor.n2, elements.dynamicElements.back()}});
+    /// @brief The companion models read the step before, and the truncation
+    ///        error estimate the order + 1 steps before
+    size_t historyDepth() const {
+        return trapezoidalRule ? 3 : 2;
     }
+
+    /// @brief The longest timestep for which the truncation error of every
+    ///        capacitor's charge over the step just solved is within tolerance
+    T truncationErrorTimestep(const SolutionHistory<T> & solutionMatrix,
+                              const size_t currentSolutionIndex,
+                              const TruncationErrorControl<T> & control) const {
+        const size_t order = trapezoidalRule ? 2 : 1;
+        T timestep = std::numeric_limits<T>::infinity();
+        if (control.points < order + 2) {
+            return timestep;
+        }
+        std::array<T, 4> q;
+        for (size_t i = 0; i < size(); i++) {
+            for (size_t k = 0; k < order + 2; k++) {
+                q[k] = value[i] * nodeVoltage(solutionMatrix, n1[i], n2[i],
+                                              currentSolutionIndex - k);
+            }
+            timestep = std::min(timestep, control.timestep(q.data(), order));
+        }
+        return timestep;
+    }
+
+    void addDCAnalysisStampTo(Stamp<T> & stamp) const {
+        // open circuit
+        for (size_t i = 0; i < size(); i++) {
+            if (n1[i] > 0) {
+                stamp.G(n1[i] - 1, n1[i] - 1) += 1e-9;
+            }
+            if (n2[i] > 0) {
+                stamp.G(n2[i] - 1, n2[i] - 1) += 1e-9;
+            }
+        }
+    }
+
+private:
+    using DynamicMap = BankStampMap<T, 4, 0>;
+    using RHSMap = BankStampMap<T, 0, 2>;
+    mutable DynamicMap dynamicMap;
+    mutable RHSMap rhsMap;
 };
 
 
@@ -14,6 +14,7 @@
 #include "CircuitElements/SParameterBlockVF.hpp"
 #include "CircuitElements/NLNMOS.hpp"
 #include "CircuitElements/NLCurrentSource.hpp"
+#include <array>
 
 #ifdef WITH_MATLAB
 #include "MatlabEngine.hpp"
@@ -41,19 +42,31 @@ enum class ComponentType {
 
 /// @brief a glorified container for the different types of components.
 ///
+/// @details The static, dynamic and non-linear stamps are layers: each only holds
+///          the contributions of its own stage, on its own sparsity pattern, so
+///          regenerating a layer only clears and writes the entries that layer
+///          touches. The layers are summed through precomputed slot maps into
+///          linearStamp (static + dynamic) and completeStamp (everything), which
+///          share the union of the layer patterns. A Newton iteration then only
+///          rewrites the entries of completeStamp the non-linear layer touches,
+///          and the rest of G is only recombined when a linear layer changes.
+///
 /// @tparam T
 template<typename T>
 struct CircuitElements {
     /// @brief Preallocated stamp. Used for caching between loop iterations. Static
     ///        stamps will only be generated once as a result.
     Stamp<T> staticStamp;
-    /// @brief Preallocated stamp. Used for caching between loop iterations. Dynamic
+    /// @brief Preallocated stamp holding only the dynamic contributions. Dynamic
     ///        stamps need to be updated on every timestep.
     Stamp<T> dynamicStamp;
-    /// @brief Preallocated stamp. Used for caching between loop iterations.
-    /// Non-Linear
-    ///        stamps must be updated on every newton-raphson iteration.
+    /// @brief Preallocated stamp holding only the non-linear contributions.
+    ///        Non-Linear stamps must be updated on every newton-raphson iteration.
     Stamp<T> nonLinearStamp;
+    /// @brief The sum of the static and dynamic stamps
+    Stamp<T> linearStamp;
+    /// @brief The sum of all three stamps, i.e. the system to solve
+    Stamp<T> completeStamp;
     /// @brief Preallocated stamp. Used for caching between loop iterations.
     /// DC
     ///        stamps must be updated on every newton-raphson iteration.
@@ -70,6 +83,21 @@ struct CircuitElements {
     /// @brief A container to store the Non-Linear components
     std::vector<std::shared_ptr<Component<T> > > nonLinearElements;
 
+    /// @brief The capacitors, inductors, diodes and transistors, which are
+    ///        usually the bulk of a large netlist, are stored by type as
+    ///        structures of arrays and stamped in one loop per type. Every other
+    ///        type goes in the Component containers above, which remain the way
+    ///        to add new ones.
+    CapacitorBank<T> capacitors;
+    InductorBank<T> inductors;
+    DiodeBank<T> diodes;
+    BJTBank<T, BJTN> npnTransistors;
+    BJTBank<T, BJTP> pnpTransistors;
+
+    /// @brief When the banked non-linear devices may skip being evaluated
+    ///        during the Newton-Raphson iterations of the transient simulation
+    DeviceBypass<T> bypass;
+
     /// @brief A variable used to track if the cached stamp is current.
     bool staticStampIsFresh = false;
     /// @brief A variable used to track if the cached stamp is current.
@@ -77,7 +105,35 @@ struct CircuitElements {
     /// @brief A variable used to track if the cached stamp is current.
     bool nonLinearStampIsFresh = false;
 
-    /// @brief A map to pair nodes with the components connected to them.
+    /// @brief Tracks the G part of the dynamic stamp separately from s. While set,
+    ///        generateDynamicStamp only restamps the right hand side.
+    bool dynamicGIsFresh = false;
+    /// @brief The timestep the dynamic G was generated with
+    T dynamicGTimestep = 0;
+
+    /// @brief Set whenever a newly generated stamp may have a different G to the
+    ///        last one. Whoever factorises G should clear it, and can then skip
+    ///        refactorising until it is set again.
+    bool stampGHasChanged = true;
+    /// @brief As stampGHasChanged, but only set when the static or dynamic parts
+    ///        of G changed, i.e. anything other than the non-linear contributions
+    bool linearGHasChanged = true;
+
+    /// @brief Where each stored entry of the static, dynamic and non-linear
+    ///        stamps goes in the pattern of linearStamp and completeStamp
+    std::vector<size_t> staticSlot;
+    std::vector<size_t> dynamicSlot;
+    std::vector<size_t> nonLinearSlot;
+    /// @brief The layer patterns the slot maps were built from
+    std::array<std::shared_ptr<SparsityPattern>, 3> mappedPattern;
+    std::array<size_t, 3> mappedVersion{};
+    /// @brief Whether the G of linearStamp / completeStamp is the sum of the
+    ///        current layers. The right hand sides are always recombined.
+    bool linearGIsCombined = false;
+    bool completeGIsCombined = false;
+
+    /// @brief A map to pair nodes with the components connected to them. The
+    ///        banked components aren't Components, so aren't listed.
     std::multimap<size_t, std::shared_ptr<Component<T> > > nodeComponentMap;
 
     /// @brief Initialisation.
@@ -88,7 +144,8 @@ struct CircuitElements {
     CircuitElements(size_t numNodes = 0, size_t numCurrents = 0,
                     size_t numDCCurrents = 0)
         : staticStamp(numNodes, numCurrents), dynamicStamp(numNodes, numCurrents),
-          nonLinearStamp(numNodes, numCurrents),
+          nonLinearStamp(numNodes, numCurrents), linearStamp(numNodes, numCurrents),
+          completeStamp(numNodes, numCurrents),
           dcStamp(numNodes, numCurrents + numDCCurrents) {
     }
 
@@ -102,10 +159,54 @@ struct CircuitElements {
         staticStamp = Stamp<T>(numNodes, numCurrents);
         dynamicStamp = Stamp<T>(numNodes, numCurrents);
         nonLinearStamp = Stamp<T>(numNodes, numCurrents);
+        linearStamp = Stamp<T>(numNodes, numCurrents);
+        completeStamp = Stamp<T>(numNodes, numCurrents);
         dcStamp = Stamp<T>(numNodes, numCurrents + numDCCurrents);
+        for (auto & pattern : mappedPattern) {
+            pattern.reset();
+        }
         staticStampIsFresh = false;
         dynamicStampIsFresh = false;
         nonLinearStampIsFresh = false;
+        dynamicGIsFresh = false;
+        stampGHasChanged = true;
+        linearGHasChanged = true;
+    }
+
+    /// @brief Whether there is anything that needs Newton-Raphson iterations
+    bool hasNonLinearElements() const {
+        return !nonLinearElements.empty() || diodes.size() > 0 ||
+               npnTransistors.size() > 0 || pnpTransistors.size() > 0;
+    }
+
+    /// @brief A summary of how many banked device evaluations were bypassed
+    std::string bypassReport() const {
+        BypassCounters total;
+        for (const BypassCounters * counters :
+             {&diodes.counters, &npnTransistors.counters,
+              &pnpTransistors.counters}) {
+            total.evaluated += counters->evaluated;
+            total.bypassed += counters->bypassed;
+        }
+        return "Device bypass: " + std::to_string(total.bypassed) + " of " +
+               std::to_string(total.evaluated + total.bypassed) +
+               " device evaluations skipped";
+    }
+
+    /// @brief Whether every dynamic and non-linear component has declared that
+    ///        its dynamic stamp only changes the right hand side.
+    bool dynamicGIsTimeInvariant() const {
+        for (const auto & component : dynamicElements) {
+            if (!component->hasTimeInvariantDynamicG()) {
+                return false;
+            }
+        }
+        for (const auto & component : nonLinearElements) {
+            if (!component->hasTimeInvariantDynamicG()) {
+                return false;
+            }
+        }
+        return true;
     }
 
     /// @brief Forces a clear of the static stamp, and generates a new one.
@@ -127,23 +228,55 @@ struct CircuitElements {
         }
 
         staticStampIsFresh = true;
+        dynamicGIsFresh = false;
+        linearGIsCombined = false;
+        stampGHasChanged = true;
+        linearGHasChanged = true;
         return staticStamp;
     }
 
     /// @brief Obtains the static stamp, then adds dynamic components to it.
     ///
+    /// @details If the G part of the last dynamic stamp is still valid (see
+    ///          Component::hasTimeInvariantDynamicG), only s is regenerated, and
+    ///          G of the returned stamp is left as it was.
+    ///
     /// @param solutionMatrix The solution matrix to use for the dynamic and
     /// non-linear stamp.
     /// @param currentSolutionIndex The current index we are at.
     /// @param timestep The time step being used.
     ///
     /// @return A reference to the cached stamp.
-    Stamp<T> & generateDynamicStamp(const Matrix<T> & solutionMatrix,
+    Stamp<T> & generateDynamicStamp(const SolutionHistory<T> & solutionMatrix,
                                     const size_t currentSolutionIndex, T timestep) {
         if (!staticStampIsFresh) {
             generateStaticStamp();
         }
-        dynamicStamp = staticStamp;
+
+        if (dynamicGIsFresh && timestep == dynamicGTimestep) {
+            dynamicStamp.s.fill(0);
+
+            for (const auto & component : dynamicElements) {
+                dynamicStamp.addDynamicRHS(component, solutionMatrix,
+                                           currentSolutionIndex, timestep);
+            }
+
+            for (const auto & component : nonLinearElements) {
+                dynamicStamp.addDynamicRHS(component, solutionMatrix,
+                                           currentSolutionIndex, timestep);
+            }
+
+            capacitors.addDynamicRHSTo(dynamicStamp, solutionMatrix,
+                                       currentSolutionIndex, timestep);
+            inductors.addDynamicRHSTo(dynamicStamp, solutionMatrix,
+                                      currentSolutionIndex, timestep);
+
+            combineLinearStamp();
+            dynamicStampIsFresh = true;
+            return linearStamp;
+        }
+
+        dynamicStamp.clear();
 
         for (const auto & component : dynamicElements) {
             dynamicStamp.addDynamicStamp(component, solutionMatrix,
@@ -155,8 +288,20 @@ struct CircuitElements {
                                          currentSolutionIndex, timestep);
         }
 
+        capacitors.addDynamicStampTo(dynamicStamp, solutionMatrix,
+                                     currentSolutionIndex, timestep);
+        inductors.addDynamicStampTo(dynamicStamp, solutionMatrix,
+                                    currentSolutionIndex, timestep);
+
+        linearGIsCombined = false;
+        combineLinearStamp();
+
+        dynamicGIsFresh = dynamicGIsTimeInvariant();
+        dynamicGTimestep = timestep;
+        stampGHasChanged = true;
+        linearGHasChanged = true;
         dynamicStampIsFresh = true;
-        return dynamicStamp;
+        return linearStamp;
     }
 
     /// @brief Obtains the dynamic stamp, then adds dynamic components to it.
@@ -168,20 +313,163 @@ struct CircuitElements {
     ///
     /// @return A reference to the cached stamp.
     Stamp<T> &
-    generateNonLinearStamp(const Matrix<T> & solutionMatrix,
+    generateNonLinearStamp(const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex, T timestep) {
         if (!dynamicStampIsFresh) {
             generateDynamicStamp(solutionMatrix, currentSolutionIndex, timestep);
         }
-        nonLinearStamp = dynamicStamp;
+        nonLinearStamp.clear();
 
         for (const auto & component : nonLinearElements) {
             nonLinearStamp.addNonLinearStamp(component, solutionMatrix,
                                              currentSolutionIndex, timestep);
         }
+        diodes.addNonLinearStampTo(nonLinearStamp, solutionMatrix,
+                                   currentSolutionIndex, bypass);
+        npnTransistors.addNonLinearStampTo(nonLinearStamp, solutionMatrix,
+                                           currentSolutionIndex, bypass);
+        pnpTransistors.addNonLinearStampTo(nonLinearStamp, solutionMatrix,
+                                           currentSolutionIndex, bypass);
 
+        combineCompleteStamp();
+
+        if (hasNonLinearElements()) {
+            stampGHasChanged = true;
+        }
         nonLinearStampIsFresh = true;
-        return nonLinearStamp;
+        return completeStamp;
+    }
+
+    /// @brief Rebuilds the pattern of the combined stamps and the slot maps if
+    ///        any layer has gained entries since they were last built.
+    void updateCombinedPattern() {
+        std::array<const SparseMatrix<T> *, 3> layers = {
+            &staticStamp.G, &dynamicStamp.G, &nonLinearStamp.G};
+        bool current = true;
+        for (size_t l = 0; l < layers.size(); l++) {
+            current = current && layers[l]->pattern == mappedPattern[l] &&
+                      layers[l]->pattern->version == mappedVersion[l];
+        }
+        if (current) {
+            return;
+        }
+
+        size_t M = staticStamp.G.M;
+        auto combined = std::make_shared<SparsityPattern>(M, M);
+        std::vector<size_t> rowColumns;
+        for (size_t m = 0; m < M; m++) {
+            rowColumns.clear();
+            for (const auto * layer : layers) {
+                const SparsityPattern & pat = *layer->pattern;
+                rowColumns.insert(rowColumns.end(),
+                                  pat.column.begin() + pat.rowStart[m],
+                                  pat.column.begin() + pat.rowStart[m + 1]);
+            }
+            std::sort(rowColumns.begin(), rowColumns.end());
+            rowColumns.erase(std::unique(rowColumns.begin(), rowColumns.end()),
+                             rowColumns.end());
+            combined->column.insert(combined->column.end(), rowColumns.begin(),
+                                    rowColumns.end());
+            combined->rowStart[m + 1] = combined->column.size();
+        }
+
+        std::array<std::vector<size_t> *, 3> slots = {&staticSlot, &dynamicSlot,
+                                                      &nonLinearSlot};
+        for (size_t l = 0; l < layers.size(); l++) {
+            const SparsityPattern & pat = *layers[l]->pattern;
+            slots[l]->resize(pat.nnz());
+            for (size_t m = 0; m < M; m++) {
+                for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                    (*slots[l])[k] = combined->find(m, pat.column[k]);
+                }
+            }
+            mappedPattern[l] = layers[l]->pattern;
+            mappedVersion[l] = pat.version;
+        }
+
+        for (auto * stamp : {&linearStamp, &completeStamp}) {
+            stamp->G.pattern = combined;
+            stamp->G.data.assign(combined->nnz(), 0);
+        }
+        linearGIsCombined = false;
+        completeGIsCombined = false;
+    }
+
+    /// @brief Sums the static and dynamic stamps into linearStamp
+    void combineLinearStamp() {
+        updateCombinedPattern();
+        if (!linearGIsCombined) {
+            std::vector<T> & data = linearStamp.G.data;
+            std::fill(data.begin(), data.end(), T(0));
+            for (size_t k = 0; k < staticSlot.size(); k++) {
+                data[staticSlot[k]] += staticStamp.G.data[k];
+            }
+            for (size_t k = 0; k < dynamicSlot.size(); k++) {
+                data[dynamicSlot[k]] += dynamicStamp.G.data[k];
+            }
+            linearGIsCombined = true;
+            completeGIsCombined = false;
+        }
+        for (size_t m = 0; m < linearStamp.s.data.size(); m++) {
+            linearStamp.s.data[m] = staticStamp.s.data[m] + dynamicStamp.s.data[m];
+        }
+    }
+
+    /// @brief Adds the non-linear stamp to linearStamp, into completeStamp. Only
+    ///        the entries the non-linear stamp touches are rewritten, unless the
+    ///        linear part has changed.
+    void combineCompleteStamp() {
+        updateCombinedPattern();
+        if (!linearGIsCombined) {
+            combineLinearStamp();
+        }
+        std::vector<T> & data = completeStamp.G.data;
+        const std::vector<T> & linear = linearStamp.G.data;
+        if (!completeGIsCombined) {
+            std::copy(linear.begin(), linear.end(), data.begin());
+            completeGIsCombined = true;
+        }
+        for (size_t k = 0; k < nonLinearSlot.size(); k++) {
+            size_t slot = nonLinearSlot[k];
+            data[slot] = linear[slot] + nonLinearStamp.G.data[k];
+        }
+        for (size_t m = 0; m < completeStamp.s.data.size(); m++) {
+            completeStamp.s.data[m] =
+                linearStamp.s.data[m] + nonLinearStamp.s.data[m];
+        }
+    }
+
+    /// @brief Finds the unknowns that the non-linear elements stamp G entries
+    ///        into, either as a row or a column.
+    ///
+    /// @param solutionMatrix The solution matrix to use for the non-linear stamp.
+    /// @param currentSolutionIndex The current index we are at.
+    /// @param timestep The time step being used.
+    ///
+    /// @return A flag for each unknown, set if a non-linear stamp touches it.
+    std::vector<bool>
+    findNonLinearUnknowns(const SolutionHistory<T> & solutionMatrix,
+                          const size_t currentSolutionIndex, T timestep) const {
+        Stamp<T> scratch(staticStamp.sizeG_A, staticStamp.sizeG_D);
+        for (const auto & component : nonLinearElements) {
+            scratch.addNonLinearStamp(component, solutionMatrix,
+                                      currentSolutionIndex, timestep);
+        }
+        diodes.addNonLinearStampTo(scratch, solutionMatrix, currentSolutionIndex);
+        npnTransistors.addNonLinearStampTo(scratch, solutionMatrix,
+                                           currentSolutionIndex);
+        pnpTransistors.addNonLinearStampTo(scratch, solutionMatrix,
+                                           currentSolutionIndex);
+
+        const SparsityPattern & pat = *scratch.G.pattern;
+        std::vector<bool> touched(scratch.G.M, false);
+        for (size_t m = 0; m < pat.M; m++) {
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                touched[m] = true;
+                touched[pat.column[k]] = true;
+            }
+        }
+        return touched;
     }
 
     /// @brief Generates the complete stamp up to a certain point.
@@ -193,7 +481,8 @@ struct CircuitElements {
     ///
     /// @return The complete stamp.
     Stamp<T> &
-    generateCompleteStamp(SolutionStage stage, const Matrix<T> & solutionMatrix,
+    generateCompleteStamp(SolutionStage stage,
+                          const SolutionHistory<T> & solutionMatrix,
                           const size_t currentSolutionIndex, T timestep) {
         switch (stage) {
             case SolutionStage::StaticSolution:
@@ -208,7 +497,7 @@ struct CircuitElements {
                     generateDynamicStamp(solutionMatrix, currentSolutionIndex,
                                          timestep)
                 }
-                return dynamicStamp;
+                return linearStamp;
                 break;
 
             case SolutionStage::NonLinearSolution:
@@ -216,7 +505,7 @@ struct CircuitElements {
                     generateNonLinearStamp(solutionMatrix, currentSolutionIndex,
                                            timestep)
                 }
-                return nonLinearStamp;
+                return completeStamp;
                 break;
         }
     }
@@ -228,10 +517,12 @@ struct CircuitElements {
     ///
     /// @param currentSolutionIndex The current index we are at.
     /// @param timestep The time step being used.
+    /// @param sourceScale Scales the right hand side of the linear components,
+    ///                    i.e. the independent sources, for source stepping
     ///
     /// @return The complete stamp.
-    Stamp<T> &
-    generateDCStamp(const Matrix<T> & solutionVector, size_t numCurrents) {
+    Stamp<T> & generateDCStamp(const SolutionHistory<T> & solutionVector,
+                               size_t numCurrents, T sourceScale = 1) {
         dcStamp.clear();
 
         for (const auto & component : staticElements) {
@@ -242,13 +533,113 @@ struct CircuitElements {
             dcStamp.addDCAnalysisStamp(component, solutionVector, numCurrents);
         }
 
+        if (sourceScale != 1) {
+            for (size_t k = 0; k < dcStamp.s.M; k++) {
+                dcStamp.s(k, 0) *= sourceScale;
+            }
+        }
+
         for (const auto & component : nonLinearElements) {
             dcStamp.addDCAnalysisStamp(component, solutionVector, numCurrents);
         }
 
+        capacitors.addDCAnalysisStampTo(dcStamp);
+        inductors.addDCAnalysisStampTo(dcStamp, numCurrents);
+        diodes.addDCAnalysisStampTo(dcStamp, solutionVector);
+        npnTransistors.addDCAnalysisStampTo(dcStamp, solutionVector);
+        pnpTransistors.addDCAnalysisStampTo(dcStamp, solutionVector);
+
         return dcStamp;
     }
 
+    /// @brief Tells the components the time of the step about to be solved
+    void setTime(T time) {
+        for (const auto * components :
+             {&staticElements, &dynamicElements, &nonLinearElements}) {
+            for (const auto & component : *components) {
+                component->setTime(time);
+            }
+        }
+    }
+
+    /// @brief Whether any component needs every step to be the netlist's
+    ///        timestep
+    bool requiresFixedTimestep() const {
+        for (const auto * components :
+             {&staticElements, &dynamicElements, &nonLinearElements}) {
+            for (const auto & component : *components) {
+                if (component->requiresFixedTimestep()) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    /// @brief The earliest breakpoint of any component after time
+    T nextBreakpoint(T time) const {
+        T breakpoint = std::numeric_limits<T>::infinity();
+        for (const auto * components :
+             {&staticElements, &dynamicElements, &nonLinearElements}) {
+            for (const auto & component : *components) {
+                breakpoint = std::min(breakpoint, component->nextBreakpoint(time));
+            }
+        }
+        return breakpoint;
+    }
+
+    /// @brief The shortest of the components' maximum timesteps
+    T maximumTimestep() const {
+        T timestep = std::numeric_limits<T>::infinity();
+        for (const auto * components :
+             {&staticElements, &dynamicElements, &nonLinearElements}) {
+            for (const auto & component : *components) {
+                timestep = std::min(timestep, component->maximumTimestep());
+            }
+        }
+        return timestep;
+    }
+
+    /// @brief The most steps before the one being solved that any component
+    ///        reads from the solution history
+    size_t historyDepth() const {
+        size_t depth = std::max(capacitors.size() ? capacitors.historyDepth() : 0,
+                                inductors.size() ? inductors.historyDepth() : 0);
+        for (const auto * components :
+             {&staticElements, &dynamicElements, &nonLinearElements}) {
+            for (const auto & component : *components) {
+                depth = std::max(depth, component->historyDepth());
+            }
+        }
+        return depth;
+    }
+
+    /// @brief The longest timestep for which the truncation error of every
+    ///        reactive component over the step just solved is within
+    ///        tolerance. See TruncationErrorControl.
+    ///
+    /// @param solutionMatrix The solution matrix, holding the step just solved
+    /// @param currentSolutionIndex The index of the step just solved
+    /// @param control The tolerances and the times of the recent steps
+    T truncationErrorTimestep(const SolutionHistory<T> & solutionMatrix,
+                              const size_t currentSolutionIndex,
+                              const TruncationErrorControl<T> & control) const {
+        T timestep = std::min(
+            capacitors.truncationErrorTimestep(solutionMatrix,
+                                               currentSolutionIndex, control),
+            inductors.truncationErrorTimestep(solutionMatrix, currentSolutionIndex,
+                                              control));
+        for (const auto * components : {&dynamicElements, &nonLinearElements}) {
+            for (const auto & component : *components) {
+                timestep = std::min(timestep,
+                                    component->truncationErrorTimestep(
+                                        solutionMatrix, currentSolutionIndex,
+                                        control));
+            }
+        }
+        return timestep;
+    }
+
     /// @brief Updates the components at the end of each time step. Applies to
     ///        dynamic and non-linear components.
     ///
@@ -256,7 +647,7 @@ struct CircuitElements {
     /// non-linear stamp.
     /// @param currentSolutionIndex The current index we are at.
     /// @param timestep The time step being used.
-    void updateTimeStep(const Matrix<T> & solutionMatrix,
+    void updateTimeStep(const SolutionHistory<T> & solutionMatrix,
                         const size_t currentSolutionIndex, T timestep) {
         dynamicStampIsFresh = false;
         nonLinearStampIsFresh = false;
@@ -268,6 +659,9 @@ struct CircuitElements {
             component->updateStoredState(solutionMatrix, currentSolutionIndex,
                                          timestep, staticStamp.sizeG_A);
         }
+        capacitors.updateStoredState(solutionMatrix, currentSolutionIndex,
+                                     timestep);
+        inductors.updateStoredState(solutionMatrix, currentSolutionIndex, timestep);
     }
 
     /// @brief Updates the components based on their DC value. Applies to
@@ -275,7 +669,8 @@ struct CircuitElements {
     ///
     /// @param solutionVector The solution vector to use for DC value
     /// @param numCurrents The number of currents used by the transient simulation.
-    void updateDCStoredState(const Matrix<T> & solutionVector, size_t numCurrents) {
+    void updateDCStoredState(const SolutionHistory<T> & solutionVector,
+                             size_t numCurrents) {
         for (const auto & component : staticElements) {
             component->updateDCStoredState(solutionVector, dcStamp.sizeG_A,
                                            numCurrents);
@@ -288,6 +683,8 @@ struct CircuitElements {
             component->updateDCStoredState(solutionVector, dcStamp.sizeG_A,
                                            numCurrents);
         }
+        inductors.updateDCStoredState(solutionVector, dcStamp.sizeG_A,
+                                      numCurrents);
     }
 };
 
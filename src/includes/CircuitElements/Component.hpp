@@ -1,10 +1,19 @@
 #ifndef _COMPONENT_HPP_INC_
 #define _COMPONENT_HPP_INC_
 #include "Maths/DynamicMatrix.hpp"
+#include "Maths/SparseMatrix.hpp"
+#include "Maths/SolutionHistory.hpp"
 #include "CircuitElements/ElementsRegexBuilder.h"
 #include <regex>
 #include <algorithm>
 #include <map>
+#include <limits>
+#include <utility>
+#include <initializer_list>
+#include <array>
+#include <cassert>
+#include <unordered_map>
+#include <atomic>
 
 template<typename T>
 struct Component;
@@ -19,12 +28,14 @@ struct Component;
 ///   G = ------|------
 ///       | G_C | G_D |\endverbatim
 ///
+/// G is stored sparsely, with entries being created as components stamp into it.
+///
 template<typename T>
 struct Stamp {
     size_t sizeG_A;
     size_t sizeG_D;
 
-    Matrix<T> G;
+    SparseMatrix<T> G;
     Matrix<T> s;
 
     /// @brief Sets the initial size of the stamp pair.
@@ -35,11 +46,11 @@ struct Stamp {
     /// II)
     Stamp(size_t _sizeG_A, size_t _sizeG_D)
         : sizeG_A(_sizeG_A), sizeG_D(_sizeG_D),
-          G(_sizeG_A + _sizeG_D, _sizeG_A + _sizeG_D, 0),
+          G(_sizeG_A + _sizeG_D, _sizeG_A + _sizeG_D),
           s(_sizeG_A + _sizeG_D, 1, 0) {
     }
 
-    /// @brief Clears the stamps to 0s
+    /// @brief Clears the stamps to 0s. The sparsity pattern of G is kept.
     void clear() {
         G.fill(0);
         s.fill(0);
@@ -65,17 +76,27 @@ struct Stamp {
     ///
     /// @param rhs Component to be added
     void addDynamicStamp(const std::shared_ptr<Component<T> > & rhs,
-                         const Matrix<T> & solutionMatrix,
+                         const SolutionHistory<T> & solutionMatrix,
                          const size_t currentSolutionIndex, T timestep) {
         rhs->addDynamicStampTo(*this, solutionMatrix, currentSolutionIndex,
                                timestep);
     }
 
+    /// @brief A helper function to add the right hand side of a dynamic component
+    ///        to the stamp.
+    ///
+    /// @param rhs Component to be added
+    void addDynamicRHS(const std::shared_ptr<Component<T> > & rhs,
+                       const SolutionHistory<T> & solutionMatrix,
+                       const size_t currentSolutionIndex, T timestep) {
+        rhs->addDynamicRHSTo(*this, solutionMatrix, currentSolutionIndex, timestep);
+    }
+
     /// @brief A helper function to add a non-linear component to the stamp.
     ///
     /// @param rhs Component to be added
     void addNonLinearStamp(const std::shared_ptr<Component<T> > & rhs,
-                           const Matrix<T> & solutionMatrix,
+                           const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex, T timestep = 0) {
         rhs->addNonLinearStampTo(*this, solutionMatrix, currentSolutionIndex,
                                  timestep);
@@ -84,9 +105,9 @@ struct Stamp {
     /// @brief A helper function to add a DC component to the stamp.
     ///
     /// @param rhs Component to be added
-    void
-    addDCAnalysisStamp(const std::shared_ptr<Component<T> > & rhs,
-                       const Matrix<T> & solutionMatrix, const size_t numCurrents) {
+    void addDCAnalysisStamp(const std::shared_ptr<Component<T> > & rhs,
+                            const SolutionHistory<T> & solutionMatrix,
+                            const size_t numCurrents) {
         rhs->addDCAnalysisStampTo(*this, solutionMatrix, numCurrents);
     }
 
@@ -98,6 +119,404 @@ struct Stamp {
     }
 };
 
+/// @brief Identifies the stamp a set of resolved addresses points into.
+///
+/// @details The addresses are invalidated when G gains an entry, when G or s
+///          reallocates, or when a different stamp is written to (e.g. going
+///          from DC to transient).
+///
+/// @tparam T The value type
+template<typename T>
+struct StampBinding {
+    /// @brief Whether the addresses taken at the last bind are still those of
+    ///        the entries of stamp
+    bool isBoundTo(const Stamp<T> & stamp) const {
+        return &stamp == boundStamp && stamp.G.pattern == boundPattern &&
+               stamp.G.pattern->version == boundVersion &&
+               stamp.G.data.data() == boundG && stamp.s.data.data() == boundS;
+    }
+
+    /// @brief Records stamp as the one the addresses were taken from
+    void bind(const Stamp<T> & stamp) {
+        boundStamp = &stamp;
+        boundPattern = stamp.G.pattern;
+        boundVersion = stamp.G.pattern->version;
+        boundG = stamp.G.data.data();
+        boundS = stamp.s.data.data();
+    }
+
+private:
+    const Stamp<T> * boundStamp = nullptr;
+    /// @brief Held so that a new pattern can't reuse the address of this one
+    std::shared_ptr<SparsityPattern> boundPattern;
+    size_t boundVersion = 0;
+    const T * boundG = nullptr;
+    const T * boundS = nullptr;
+};
+
+/// @brief The unknown index standing for ground in a StampMap
+constexpr size_t groundUnknown = std::numeric_limits<size_t>::max();
+
+/// @brief The entries of a stamp that a component writes to, resolved once
+///        into flat arrays of addresses, so that stamping is a branch free
+///        scatter of the component's values.
+///
+/// @details A component lists its entries in a fixed order, by unknown index
+///          with node() giving the unknown of a netlist node. Entries in the row
+///          or column of ground are routed to dummy values that are never read,
+///          so the ground checks and index arithmetic are done once, here,
+///          rather than on every stamp. Each entry gets its own dummy, so the
+///          writes to ground don't form a chain of dependent additions.
+///          \n\n
+///          Only the addresses of the values are kept, so the map doesn't
+///          depend on how the stamp stores them. When they go stale (see
+///          StampBinding) isResolvedFor() returns false.
+///
+/// @tparam T The value type
+/// @tparam NG The number of values the component adds to G
+/// @tparam NS The number of values the component adds to s
+template<typename T, size_t NG, size_t NS>
+struct StampMap {
+    /// @brief The unknown index standing for ground
+    static constexpr size_t ground = groundUnknown;
+
+    /// @brief The unknown of a netlist node, or ground for node 0
+    static constexpr size_t node(size_t n) {
+        return n > 0 ? n - 1 : ground;
+    }
+
+    /// @brief Whether the addresses are those of the entries of stamp
+    bool isResolvedFor(const Stamp<T> & stamp) const {
+        return binding.isBoundTo(stamp);
+    }
+
+    /// @brief Resolves the addresses of the entries of stamp, creating those
+    ///        that G doesn't store yet.
+    ///
+    /// @param stamp The stamp the values will be scattered into
+    /// @param gEntries The (row, column) of each value of G
+    /// @param sRows The row of each value of s
+    void resolve(Stamp<T> & stamp,
+                 std::initializer_list<std::pair<size_t, size_t> > gEntries,
+                 std::initializer_list<size_t> sRows = {}) {
+        assert(gEntries.size() == NG && sRows.size() == NS);
+        insertEntries(stamp, gEntries.begin());
+        resolveEntries(stamp, gEntries.begin(), sRows.begin(), g.data(), s.data(),
+                       sink.data());
+        binding.bind(stamp);
+    }
+
+    /// @brief Adds the values, in the order the entries were resolved in
+    void scatter(const std::array<T, NG> & gValues,
+                 const std::array<T, NS> & sValues = {}) {
+        for (size_t i = 0; i < NG; i++) {
+            *g[i] += gValues[i];
+        }
+        for (size_t i = 0; i < NS; i++) {
+            *s[i] += sValues[i];
+        }
+    }
+
+    /// @brief Creates the entries of G that aren't stored yet. Inserting moves
+    ///        the values, so this is done for every entry before any address
+    ///        is taken.
+    static void insertEntries(Stamp<T> & stamp,
+                              const std::pair<size_t, size_t> * gEntries) {
+        for (size_t i = 0; i < NG; i++) {
+            const auto & [m, n] = gEntries[i];
+            if (m != ground && n != ground) {
+                stamp.G(m, n);
+            }
+        }
+    }
+
+    /// @brief Writes the addresses of the entries to g and s, with those on
+    ///        ground pointing into sink (NG + NS values)
+    static void resolveEntries(Stamp<T> & stamp,
+                               const std::pair<size_t, size_t> * gEntries,
+                               const size_t * sRows, T ** g, T ** s, T * sink) {
+        for (size_t i = 0; i < NG; i++) {
+            const auto & [m, n] = gEntries[i];
+            g[i] = m == ground || n == ground
+                       ? &sink[i]
+                       : &stamp.G.data[stamp.G.pattern->find(m, n)];
+        }
+        for (size_t i = 0; i < NS; i++) {
+            s[i] = sRows[i] == ground ? &sink[NG + i] : &stamp.s.data[sRows[i]];
+        }
+    }
+
+private:
+    std::array<T *, NG> g = {};
+    std::array<T *, NS> s = {};
+    /// @brief Absorb the values stamped onto ground
+    std::array<T, NG + NS> sink = {};
+    StampBinding<T> binding;
+};
+
+/// @brief The fewest devices of a bank worth evaluating on a thread of their own
+constexpr size_t parallelDeviceGrain = 256;
+/// @brief As parallelDeviceGrain, for the much cheaper end of step updates
+constexpr size_t parallelUpdateGrain = 4096;
+
+/// @brief A StampMap for a bank of devices of one type, stored as flat arrays
+///        with the addresses of device i at [i * NG, (i + 1) * NG) of g and
+///        [i * NS, (i + 1) * NS) of s.
+///
+/// @details resolve also colours the devices, so that no two devices of one
+///          colour write to the same entry. forEachColour can then evaluate
+///          and scatter the devices of a colour on several threads without
+///          locks. The colours are taken in turn and, within a colour, each
+///          entry gets at most one value, so every entry receives its values in
+///          the same order whatever the number of threads, and the stamp is
+///          the same to the bit.
+///
+/// @tparam T The value type
+/// @tparam NG The number of values each device adds to G
+/// @tparam NS The number of values each device adds to s
+template<typename T, size_t NG, size_t NS>
+struct BankStampMap {
+    using Single = StampMap<T, NG, NS>;
+
+    /// @brief The unknown of a netlist node, or ground for node 0
+    static constexpr size_t node(size_t n) {
+        return Single::node(n);
+    }
+
+    /// @brief Whether the addresses are those of the entries of stamp
+    bool isResolvedFor(const Stamp<T> & stamp) const {
+        return binding.isBoundTo(stamp);
+    }
+
+    /// @brief Resolves the addresses of the entries of every device
+    ///
+    /// @param stamp The stamp the values will be scattered into
+    /// @param gEntries The (row, column) of each value of G, NG per device
+    /// @param sRows The row of each value of s, NS per device
+    void resolve(Stamp<T> & stamp,
+                 const std::vector<std::pair<size_t, size_t> > & gEntries,
+                 const std::vector<size_t> & sRows) {
+        size_t count = NG ? gEntries.size() / NG : sRows.size() / NS;
+        assert(gEntries.size() == count * NG && sRows.size() == count * NS);
+        for (size_t i = 0; i < count; i++) {
+            Single::insertEntries(stamp, gEntries.data() + i * NG);
+        }
+
+        g.resize(count * NG);
+        s.resize(count * NS);
+        sink.assign(count * (NG + NS), 0);
+        for (size_t i = 0; i < count; i++) {
+            Single::resolveEntries(stamp, gEntries.data() + i * NG,
+                                   sRows.data() + i * NS, g.data() + i * NG,
+                                   s.data() + i * NS, &sink[i * (NG + NS)]);
+        }
+        colourDevices(count);
+        binding.bind(stamp);
+    }
+
+    /// @brief Calls body(devices, count) on lists of device indices, the
+    ///        devices of one colour at a time. Large colours are split between
+    ///        the threads of ThreadPool::shared(), so body must only scatter
+    ///        the devices it is given.
+    template<typename F>
+    void forEachColour(F && body) const {
+        ThreadPool & pool = ThreadPool::shared();
+        for (size_t c = 0; c + 1 < colourStart.size(); c++) {
+            const size_t * devices = &colourOrder[colourStart[c]];
+            pool.parallelFor(
+                colourStart[c + 1] - colourStart[c],
+                [&](size_t begin, size_t end, size_t) {
+                    body(devices + begin, end - begin);
+                },
+                parallelDeviceGrain);
+        }
+    }
+
+    /// @brief Adds the values of device i, in the order its entries were
+    ///        resolved in
+    void scatter(size_t i, const std::array<T, NG> & gValues,
+                 const std::array<T, NS> & sValues = {}) {
+        T * const * gi = &g[i * NG];
+        T * const * si = &s[i * NS];
+        for (size_t k = 0; k < NG; k++) {
+            *gi[k] += gValues[k];
+        }
+        for (size_t k = 0; k < NS; k++) {
+            *si[k] += sValues[k];
+        }
+    }
+
+private:
+    std::vector<T *> g;
+    std::vector<T *> s;
+    /// @brief Absorb the values stamped onto ground
+    std::vector<T> sink;
+    StampBinding<T> binding;
+    /// @brief The devices of colour c are colourOrder[colourStart[c]] to
+    ///        colourOrder[colourStart[c + 1] - 1], in increasing order
+    std::vector<size_t> colourStart;
+    std::vector<size_t> colourOrder;
+
+    /// @brief Greedily gives each device the lowest colour that none of the
+    ///        devices sharing an entry with it has. The sinks are private to a
+    ///        device, so never conflict.
+    void colourDevices(size_t count) {
+        std::unordered_map<const T *, std::vector<size_t> > coloursAt;
+        std::vector<size_t> colour(count);
+        std::vector<size_t> colourSize;
+        std::vector<bool> taken;
+        auto forEachEntry = [&](size_t i, auto && f) {
+            for (size_t k = 0; k < NG; k++) {
+                f(coloursAt[g[i * NG + k]]);
+            }
+            for (size_t k = 0; k < NS; k++) {
+                f(coloursAt[s[i * NS + k]]);
+            }
+        };
+        for (size_t i = 0; i < count; i++) {
+            taken.assign(colourSize.size() + 1, false);
+            forEachEntry(i, [&](const std::vector<size_t> & colours) {
+                for (size_t c : colours) {
+                    taken[c] = true;
+                }
+            });
+            colour[i] = std::find(taken.begin(), taken.end(), false) -
+                        taken.begin();
+            if (colour[i] == colourSize.size()) {
+                colourSize.push_back(0);
+            }
+            colourSize[colour[i]]++;
+            forEachEntry(i, [&](std::vector<size_t> & colours) {
+                colours.push_back(colour[i]);
+            });
+        }
+
+        colourStart.assign(colourSize.size() + 1, 0);
+        for (size_t c = 0; c < colourSize.size(); c++) {
+            colourStart[c + 1] = colourStart[c] + colourSize[c];
+        }
+        colourOrder.resize(count);
+        std::vector<size_t> next(colourStart.begin(), colourStart.end() - 1);
+        for (size_t i = 0; i < count; i++) {
+            colourOrder[next[colour[i]]++] = i;
+        }
+    }
+};
+
+/// @brief Lets a non-linear device reuse its last evaluation while it is close to
+///        the point it was evaluated at, as SPICE's device bypass does.
+///
+/// @details A device is bypassed when, for each of its junctions, both the
+///          voltage and the current its last linearisation predicts have
+///          moved by less than relativeTolerance of their size plus an
+///          absolute tolerance. The cached companion model is then stamped
+///          again without evaluating the model. Off unless enabled, e.g. by
+///          the .bypass directive, as it changes the results slightly.
+///
+/// @tparam T The value type
+template<typename T>
+struct DeviceBypass {
+    bool enabled = false;
+    T relativeTolerance = 1e-3;
+    /// @brief In volts
+    T voltageTolerance = 1e-6;
+    /// @brief In amps
+    T currentTolerance = 1e-12;
+
+    /// @brief Whether a junction last evaluated at vLast, where it conducted
+    ///        iLast with conductance gLast, may skip being evaluated at v
+    bool canBypass(T v, T vLast, T gLast, T iLast) const {
+        T dv = v - vLast;
+        T di = gLast * dv;
+        return enabled &&
+               std::abs(dv) <= relativeTolerance *
+                                       std::max(std::abs(v), std::abs(vLast)) +
+                                   voltageTolerance &&
+               std::abs(di) <= relativeTolerance *
+                                       std::max(std::abs(iLast + di),
+                                                std::abs(iLast)) +
+                                   currentTolerance;
+    }
+};
+
+/// @brief How many times the devices of a bank were evaluated and bypassed.
+///        Updated atomically, as a bank may be evaluated on several threads.
+struct BypassCounters {
+    size_t evaluated = 0;
+    size_t bypassed = 0;
+
+    void add(size_t newEvaluated, size_t newBypassed) {
+        std::atomic_ref<size_t>(evaluated)
+            .fetch_add(newEvaluated, std::memory_order_relaxed);
+        std::atomic_ref<size_t>(bypassed)
+            .fetch_add(newBypassed, std::memory_order_relaxed);
+    }
+};
+
+/// @brief Estimates the local truncation error of the integrated charge of a
+///        reactive component, as SPICE does, and from it the largest timestep
+///        that keeps the error within tolerance.
+///
+/// @details The error of a step of length h of an integration method of order p
+///          is C * h^(p + 1) times the (p + 1)th derivative of the charge, which
+///          is estimated by the divided difference of the charges of the last
+///          p + 2 time points. The error is allowed to be h times a current
+///          tolerance, so the timestep that meets it is found by solving for h.
+///
+/// @tparam T The value type
+template<typename T>
+struct TruncationErrorControl {
+    T relativeTolerance = 1e-3;
+    /// @brief On the current through (or, for an inductor, voltage across) a
+    ///        component
+    T absoluteTolerance = 1e-12;
+    /// @brief On the charge (or flux) of a component
+    T chargeTolerance = 1e-14;
+    /// @brief How much the estimate overestimates the error, SPICE's trtol
+    T overestimation = 7;
+
+    /// @brief The time of the step being checked, then of the accepted steps
+    ///        before it
+    std::array<T, 4> times = {};
+    /// @brief How many of times may be used. The history starts again at each
+    ///        breakpoint, as the derivatives aren't smooth across it.
+    size_t points = 0;
+
+    /// @brief The largest timestep for which the truncation error of a charge
+    ///        stays within tolerance
+    ///
+    /// @param q The charge at times[0], times[1], ..., order + 2 values
+    /// @param order 1 for backward Euler, 2 for the trapezoidal rule
+    T timestep(const T * q, size_t order) const {
+        if (points < order + 2) {
+            return std::numeric_limits<T>::infinity();
+        }
+        std::array<T, 4> difference = {};
+        std::copy(q, q + order + 2, difference.begin());
+        for (size_t k = 1; k <= order + 1; k++) {
+            for (size_t j = 0; j + k <= order + 1; j++) {
+                difference[j] = (difference[j] - difference[j + 1]) /
+                                (times[j] - times[j + k]);
+            }
+        }
+        if (difference[0] == T(0)) {
+            return std::numeric_limits<T>::infinity();
+        }
+
+        T h = times[0] - times[1];
+        T current = std::max(std::abs(q[0] - q[1]) / h,
+                             std::abs(q[1] - q[2]) / (times[1] - times[2]));
+        T charge = std::max({std::abs(q[0]), std::abs(q[1]), chargeTolerance});
+        T tolerance = overestimation *
+                      std::max(relativeTolerance * current + absoluteTolerance,
+                               relativeTolerance * charge / h);
+        // the error constant of the method times (order + 1)!
+        T factor = order == 1 ? T(1) : T(0.5);
+        return std::pow(tolerance / (factor * std::abs(difference[0])),
+                        T(1) / order);
+    }
+};
+
 template<typename T>
 struct CircuitElements;
 /// @brief A template base class to define the fundamental things a component
@@ -122,10 +541,36 @@ struct Component {
     /// @param currentSolutionIndex The current timeStep index
     /// @param timestep The length of each time step
     virtual void
-    addDynamicStampTo(Stamp<T> & destination, const Matrix<T> & solutionMatrix,
+    addDynamicStampTo(Stamp<T> & destination,
+                      const SolutionHistory<T> & solutionMatrix,
                       const size_t currentSolutionIndex, T timestep) const {
     }
 
+    /// @brief Adds only the right hand side (s) part of this component's dynamic
+    ///        stamp to the target stamp. Only used when
+    ///        hasTimeInvariantDynamicG returns true.
+    ///
+    /// @param destination The stamp to be added to.
+    /// @param solutionMatrix A vector containing all past solutions to the circuit
+    /// @param currentSolutionIndex The current timeStep index
+    /// @param timestep The length of each time step
+    virtual void
+    addDynamicRHSTo(Stamp<T> & destination,
+                    const SolutionHistory<T> & solutionMatrix,
+                    const size_t currentSolutionIndex, T timestep) const {
+    }
+
+    /// @brief Declares that, for a fixed timestep, the G part of this component's
+    ///        dynamic stamp never changes. Between time steps only the
+    ///        contribution from addDynamicRHSTo then needs restamping, and the
+    ///        factorisation of G can be reused.
+    ///
+    /// @return true if the G part of addDynamicStampTo only depends on the
+    ///         timestep
+    virtual bool hasTimeInvariantDynamicG() const {
+        return false;
+    }
+
     /// @brief adds this component's non-linear stamp to the target stamp.
     ///
     /// @param destination The stamp to be added to.
@@ -133,7 +578,8 @@ struct Component {
     /// @param currentSolutionIndex The current timeStep index
     /// @param timestep The length of each time step
     virtual void
-    addNonLinearStampTo(Stamp<T> & destination, const Matrix<T> & solutionMatrix,
+    addNonLinearStampTo(Stamp<T> & destination,
+                        const SolutionHistory<T> & solutionMatrix,
                         const size_t currentSolutionIndex, T timestep = 0) const {
         throw std::exception("not implemented");
     }
@@ -145,7 +591,7 @@ struct Component {
     /// @param timestep The length of each time step
     /// @param sizeG_A the size of the A portion of G, marks the end of the equiv
     /// currents
-    virtual void updateStoredState(const Matrix<T> & solutionMatrix,
+    virtual void updateStoredState(const SolutionHistory<T> & solutionMatrix,
                                    const size_t currentSolutionIndex, T timestep,
                                    size_t numCurrents) {
     }
@@ -156,7 +602,8 @@ struct Component {
     /// @param solutionMatrix A vector containing all past solutions to the circuit
     /// @param numCurrents The number of currents used by the transient simulation
     virtual void
-    addDCAnalysisStampTo(Stamp<T> & destination, const Matrix<T> & solutionVector,
+    addDCAnalysisStampTo(Stamp<T> & destination,
+                         const SolutionHistory<T> & solutionVector,
                          size_t numCurrents) const {
         throw std::exception("not implemented");
     }
@@ -167,7 +614,7 @@ struct Component {
     /// @param solutionVector The DC vector
     /// @param sizeG_A the number of voltages
     /// @param numCurrents the number of transient currents
-    virtual void updateDCStoredState(const Matrix<T> & solutionVector,
+    virtual void updateDCStoredState(const SolutionHistory<T> & solutionVector,
                                      size_t sizeG_A, size_t numCurrents) {
     }
 
@@ -177,6 +624,52 @@ struct Component {
     virtual void setTimestep(T timestep) {
     }
 
+    /// @brief Called before each time step is solved, for components that
+    ///        depend on the time itself rather than on the solution so far.
+    ///
+    /// @param time The time the step is being solved for
+    virtual void setTime(T time) {
+    }
+
+    /// @brief Declares that the component only works with the timestep given
+    ///        to setTimestep, e.g. because it convolves the solution on a
+    ///        uniform grid. Adaptive timestep control is then turned off.
+    virtual bool requiresFixedTimestep() const {
+        return false;
+    }
+
+    /// @brief The first time after time at which the component's waveform has
+    ///        a corner, which an adaptive timestep should land on
+    virtual T nextBreakpoint(T time) const {
+        return std::numeric_limits<T>::infinity();
+    }
+
+    /// @brief The longest timestep an adaptive simulation should take
+    virtual T maximumTimestep() const {
+        return std::numeric_limits<T>::infinity();
+    }
+
+    /// @brief The most steps before the one being solved that the component
+    ///        reads from the solution history. The simulator need keep no
+    ///        more than the largest of these.
+    virtual size_t historyDepth() const {
+        return 0;
+    }
+
+    /// @brief The longest timestep for which the truncation error of the step
+    ///        just solved would be within tolerance. See
+    ///        TruncationErrorControl.
+    ///
+    /// @param solutionMatrix A vector containing all past solutions to the circuit
+    /// @param currentSolutionIndex The index of the step just solved
+    /// @param control The tolerances and the times of the recent steps
+    virtual T
+    truncationErrorTimestep(const SolutionHistory<T> & solutionMatrix,
+                            const size_t currentSolutionIndex,
+                            const TruncationErrorControl<T> & control) const {
+        return std::numeric_limits<T>::infinity();
+    }
+
     /// @brief Called as a helper to add the component to the elements class.
     ///
     /// @param line The line to be parsed.
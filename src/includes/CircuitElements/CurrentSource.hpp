@@ -28,7 +28,8 @@ public:
         }
     }
 
-    void addDCAnalysisStampTo(Stamp<T> & stamp, const Matrix<T> & solutionVector,
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector,
                               size_t numCurrents) const {
         addStaticStampTo(stamp);
     }
@@ -2,6 +2,7 @@
 #define _DIODE_HPP_INC_
 #include "CircuitElements/Component.hpp"
 #include "Maths/DynamicMatrix.hpp"
+#include "Maths/VectorMath.hpp"
 
 
 /// @brief An ebbers moll diode model
@@ -13,56 +14,67 @@ public:
     size_t n1 = 0;
     size_t n2 = 0;
 
-    const T I_sat = 2.52e-9;
-    const T V_T = 25.8563e-3;
-    const T eta = 2;
+    static constexpr T I_sat = 2.52e-9;
+    static constexpr T V_T = 25.8563e-3;
+    static constexpr T eta = 2;
 
-    T V_crit = eta * V_T * std::log(eta * V_T / (I_sat * std::sqrt(2)));
+    static inline const T V_crit = eta * V_T *
+                                   std::log(eta * V_T / (I_sat * std::sqrt(2)));
 
+    using NonLinearMap = StampMap<T, 4, 2>;
+    /// @brief Where addNonLinearStampTo writes in the stamp last written to
+    mutable NonLinearMap nonLinearMap;
 
-    void
-    addNonLinearStampTo(Stamp<T> & stamp, const Matrix<T> & solutionMatrix,
-                        const size_t currentSolutionIndex, T timestep = 0) const {
-        const size_t n1p = n1 - 1;
-        const size_t n2p = n2 - 1;
-
-        T v = 0;
-
-        if (n1 > 0) {
-            v = solutionMatrix(n1p, currentSolutionIndex);
-        }
 
-        if (n2 > 0) {
-            v -= solutionMatrix(n2p, currentSolutionIndex);
-        }
-
-        v = std::min(V_crit, v);
+    bool hasTimeInvariantDynamicG() const {
+        return true;
+    }
 
-        T G_eq = (I_sat / (eta * V_T)) * std::exp(v / (eta * V_T));
-        T I_eq = I_sat * (std::exp(v / (eta * V_T)) - 1) - G_eq * v;
+    /// @brief Limits the voltage across the diode to V_crit
+    static T limit(T v) {
+        return std::min(V_crit, v);
+    }
 
-        if (n1 > 0) {
-            stamp.G(n1p, n1p) += G_eq;
-            stamp.s(n1p, 0) += -I_eq;
-        }
+    /// @brief The argument of the exponential in the diode equation
+    static T exponent(T v) {
+        return v / (eta * V_T);
+    }
 
-        if (n2 > 0) {
-            stamp.G(n2p, n2p) += G_eq;
-            stamp.s(n2p, 0) += +I_eq;
-        }
+    /// @brief The companion model of the diode, linearised about v
+    ///
+    /// @param v The voltage across the diode, after limit
+    /// @param ex exp(exponent(v)), which is passed in so that many diodes can
+    ///           evaluate it at once
+    static void companion(T v, T ex, T & G_eq, T & I_eq) {
+        G_eq = (I_sat / (eta * V_T)) * ex;
+        I_eq = I_sat * (ex - 1) - G_eq * v;
+    }
 
-        if (n1 > 0 && n2 > 0) {
-            stamp.G(n1p, n2p) += -G_eq;
-            stamp.G(n2p, n1p) += -G_eq;
+    void
+    addNonLinearStampTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
+                        const size_t currentSolutionIndex, T timestep = 0) const {
+        T v = limit(nodeVoltage(solutionMatrix, n1, n2, currentSolutionIndex));
+        T G_eq;
+        T I_eq;
+        companion(v, std::exp(exponent(v)), G_eq, I_eq);
+
+        if (!nonLinearMap.isResolvedFor(stamp)) {
+            const size_t a = NonLinearMap::node(n1);
+            const size_t b = NonLinearMap::node(n2);
+            nonLinearMap.resolve(stamp, {{a, a}, {b, b}, {a, b}, {b, a}}, {a, b});
         }
+        const std::array<T, 4> gValues = {G_eq, G_eq, -G_eq, -G_eq};
+        const std::array<T, 2> sValues = {-I_eq, I_eq};
+        nonLinearMap.scatter(gValues, sValues);
     }
 
-    void updateStoredState(const Matrix<T> & solutionMatrix,
+    void updateStoredState(const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex, T timestep,
                            size_t sizeG_A) {
     }
 
-    void addDCAnalysisStampTo(Stamp<T> & stamp, const Matrix<T> & solutionVector,
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector,
                               size_t numCurrents) const {
         addNonLinearStampTo(stamp, solutionVector, 0, 0);
     }
@@ -85,10 +97,128 @@ public:
         numNodes = std::max(numNodes, std::stoull(matches.str(2)));
         numNodes = std::max(numNodes, std::stoull(matches.str(3)));
 
-        elements.nonLinearElements.emplace_back(std::make_shared<Diode<T> >(diode));
-        elements.nodeComponentMap.insert(
-            {{diode.n1, elements.nonLinearElements.back()},
-             {diode.n2, elements.nonLinearElements.back()}});
+        elements.diodes.add(diode);
+    }
+};
+
+/// @brief Every diode of a netlist, stored field by field rather than diode by
+///        diode, so that stamping them is one loop over contiguous arrays
+///        instead of a virtual call each. The model constants are shared.
+///
+/// @details The diodes are evaluated in blocks of evaluationBlock, so that the
+///          exponentials of a block are computed together by VectorMath::exp.
+///          The blocks of large banks are spread over threads, see
+///          BankStampMap::forEachColour.
+///
+/// @tparam T Value type
+template<typename T>
+struct DiodeBank {
+    std::vector<std::string> designator;
+    std::vector<size_t> n1;
+    std::vector<size_t> n2;
+
+    /// @brief Statistics for the report
+    mutable BypassCounters counters;
+
+    size_t size() const {
+        return n1.size();
+    }
+
+    void add(const Diode<T> & diode) {
+        designator.push_back(diode.designator);
+        n1.push_back(diode.n1);
+        n2.push_back(diode.n2);
+        last.emplace_back();
+        nonLinearMap = {};
+    }
+
+    /// @param bypass When the diodes may reuse their last evaluation
+    void
+    addNonLinearStampTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
+                        const size_t currentSolutionIndex,
+                        const DeviceBypass<T> & bypass = {}) const {
+        if (!nonLinearMap.isResolvedFor(stamp)) {
+            std::vector<std::pair<size_t, size_t> > gEntries;
+            std::vector<size_t> sRows;
+            for (size_t i = 0; i < size(); i++) {
+                const size_t a = NonLinearMap::node(n1[i]);
+                const size_t b = NonLinearMap::node(n2[i]);
+                gEntries.insert(gEntries.end(), {{a, a}, {b, b}, {a, b}, {b, a}});
+                sRows.insert(sRows.end(), {a, b});
+            }
+            nonLinearMap.resolve(stamp, gEntries, sRows);
+        }
+        nonLinearMap.forEachColour([&](const size_t * devices, size_t count) {
+            evaluate(devices, count, solutionMatrix, currentSolutionIndex, bypass);
+        });
+    }
+
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector) const {
+        addNonLinearStampTo(stamp, solutionVector, 0);
+    }
+
+private:
+    static constexpr size_t evaluationBlock = 256;
+
+    using NonLinearMap = BankStampMap<T, 4, 2>;
+    mutable NonLinearMap nonLinearMap;
+
+    /// @brief The last evaluation of a diode, for DeviceBypass
+    struct Evaluation {
+        /// @brief The voltage across the diode, before limiting. NaN until
+        ///        the first evaluation, so that it can't be bypassed.
+        T v = std::numeric_limits<T>::quiet_NaN();
+        T G_eq = 0;
+        T I_eq = 0;
+        /// @brief The diode current
+        T i = 0;
+    };
+    mutable std::vector<Evaluation> last;
+
+    void scatter(size_t i) const {
+        const T G_eq = last[i].G_eq;
+        const T I_eq = last[i].I_eq;
+        nonLinearMap.scatter(i, {G_eq, G_eq, -G_eq, -G_eq}, {-I_eq, I_eq});
+    }
+
+    /// @brief Evaluates, or bypasses, and scatters the listed diodes
+    void evaluate(const size_t * devices, size_t count,
+                  const SolutionHistory<T> & solutionMatrix,
+                  const size_t currentSolutionIndex,
+                  const DeviceBypass<T> & bypass) const {
+        // the diodes of the block that need evaluating
+        std::array<size_t, evaluationBlock> pending;
+        std::array<T, evaluationBlock> v;
+        std::array<T, evaluationBlock> ex;
+        size_t bypassed = 0;
+        for (size_t start = 0; start < count; start += evaluationBlock) {
+            const size_t blockSize = std::min(evaluationBlock, count - start);
+            size_t numPending = 0;
+            for (size_t k = 0; k < blockSize; k++) {
+                const size_t i = devices[start + k];
+                T vi = nodeVoltage(solutionMatrix, n1[i], n2[i],
+                                   currentSolutionIndex);
+                if (bypass.canBypass(vi, last[i].v, last[i].G_eq, last[i].i)) {
+                    scatter(i);
+                    bypassed++;
+                    continue;
+                }
+                last[i].v = vi;
+                pending[numPending] = i;
+                v[numPending] = Diode<T>::limit(vi);
+                ex[numPending] = Diode<T>::exponent(v[numPending]);
+                numPending++;
+            }
+            VectorMath::exp(ex.data(), ex.data(), numPending);
+            for (size_t k = 0; k < numPending; k++) {
+                const size_t i = pending[k];
+                Diode<T>::companion(v[k], ex[k], last[i].G_eq, last[i].I_eq);
+                last[i].i = last[i].I_eq + last[i].G_eq * v[k];
+                scatter(i);
+            }
+        }
+        counters.add(count - bypassed, bypassed);
     }
 };
 
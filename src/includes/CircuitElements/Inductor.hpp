@@ -19,80 +19,97 @@ public:
     size_t dcCurrentIndex = 0;
 
     bool trapezoidalRule = true;
-    void addDynamicStampTo(Stamp<T> & stamp, const Matrix<T> & solutionMatrix,
-                           const size_t currentSolutionIndex, T timestep) const {
-        size_t n1p = n1 - 1;
-        size_t n2p = n2 - 1;
 
-        T u0 = 0;
-        if (n1) {
-            u0 = solutionMatrix(n1p, currentSolutionIndex - 1);
-        }
-
-        if (n2) {
-            u0 -= solutionMatrix(n2p, currentSolutionIndex - 1);
-        }
+    using DynamicMap = StampMap<T, 4, 0>;
+    using RHSMap = StampMap<T, 0, 2>;
+    /// @brief Where addDynamicStampTo and addDynamicRHSTo write in the stamps
+    ///        last written to
+    mutable DynamicMap dynamicMap;
+    mutable RHSMap rhsMap;
 
+    /// @brief The conductance of the companion model
+    static T companionConductance(T value, T timestep, bool trapezoidalRule) {
+        return trapezoidalRule ? timestep / (2 * value) : timestep / timestep;
+    }
 
-        T G_eq = 0;
-        T I_eq = 0;
+    /// @brief The current source of the companion model
+    ///
+    /// @param u0 The voltage across the inductor at the last timestep
+    static T companionCurrent(T value, T lastCurrent, T u0, T timestep,
+                              bool trapezoidalRule) {
+        T G_eq = companionConductance(value, timestep, trapezoidalRule);
+        return trapezoidalRule ? lastCurrent + G_eq * u0 : lastCurrent;
+    }
 
+    /// @brief The current through the inductor at the end of a timestep
+    ///
+    /// @param u0 The voltage across the inductor at the start of the timestep
+    /// @param u1 The voltage across the inductor at the end of the timestep
+    static T nextCurrent(T value, T lastCurrent, T u0, T u1, T timestep,
+                         bool trapezoidalRule) {
         if (trapezoidalRule) {
-            G_eq = timestep / (2 * value);
-            I_eq = lastCurrent + G_eq * u0;
-        } else {
-            G_eq = timestep / timestep;
-            I_eq = lastCurrent;
+            T G_eq = timestep / (2 * value);
+            return G_eq * u1 + (lastCurrent + G_eq * u0);
         }
+        T G_eq = timestep / value;
+        return G_eq * u1 + lastCurrent;
+    }
 
-        if (n1) {
-            stamp.G(n1p, n1p) += G_eq;
-            stamp.s(n1p, 0) += -I_eq;
-        }
+    void addDynamicStampTo(Stamp<T> & stamp,
+                           const SolutionHistory<T> & solutionMatrix,
+                           const size_t currentSolutionIndex, T timestep) const {
+        T G_eq = companionConductance(value, timestep, trapezoidalRule);
 
-        if (n2) {
-            stamp.G(n2p, n2p) += G_eq;
-            stamp.s(n2p, 0) += I_eq;
+        if (!dynamicMap.isResolvedFor(stamp)) {
+            const size_t a = DynamicMap::node(n1);
+            const size_t b = DynamicMap::node(n2);
+            dynamicMap.resolve(stamp, {{a, a}, {b, b}, {a, b}, {b, a}});
         }
+        const std::array<T, 4> gValues = {G_eq, G_eq, -G_eq, -G_eq};
+        dynamicMap.scatter(gValues);
 
-        if (n1 && n2) {
-            stamp.G(n1p, n2p) += -G_eq;
-            stamp.G(n2p, n1p) += -G_eq;
-        }
+        addDynamicRHSTo(stamp, solutionMatrix, currentSolutionIndex, timestep);
     }
 
-    void updateStoredState(const Matrix<T> & solutionMatrix,
-                           const size_t currentSolutionIndex, T timestep,
-                           size_t sizeG_A) {
-        size_t n1p = n1 - 1;
-        size_t n2p = n2 - 1;
-        T u0 = 0;
-        T u1 = 0;
-        if (n1) {
-            u0 = solutionMatrix(n1p, currentSolutionIndex - 1);
-            u1 = solutionMatrix(n1p, currentSolutionIndex);
-        }
+    void addDynamicRHSTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
+                         const size_t currentSolutionIndex, T timestep) const {
+        T u0 = nodeVoltage(solutionMatrix, n1, n2, currentSolutionIndex - 1);
+        T I_eq = companionCurrent(value, lastCurrent, u0, timestep,
+                                  trapezoidalRule);
 
-        if (n2) {
-            u0 -= solutionMatrix(n2p, currentSolutionIndex - 1);
-            u1 -= solutionMatrix(n2p, currentSolutionIndex);
+        if (!rhsMap.isResolvedFor(stamp)) {
+            rhsMap.resolve(stamp, {}, {RHSMap::node(n1), RHSMap::node(n2)});
         }
+        const std::array<T, 2> sValues = {-I_eq, I_eq};
+        rhsMap.scatter({}, sValues);
+    }
 
-        if (trapezoidalRule) {
-            T G_eq = timestep / (2 * value);
-            lastCurrent = G_eq * u1 + (lastCurrent + G_eq * u0);
-        } else {
-            T G_eq = timestep / value;
-            lastCurrent = G_eq * u1 + lastCurrent;
-        }
+    bool hasTimeInvariantDynamicG() const {
+        return true;
+    }
+
+    /// @brief The companion model integrates from the step before
+    size_t historyDepth() const {
+        return 1;
+    }
+
+    void updateStoredState(const SolutionHistory<T> & solutionMatrix,
+                           const size_t currentSolutionIndex, T timestep,
+                           size_t sizeG_A) {
+        T u0 = nodeVoltage(solutionMatrix, n1, n2, currentSolutionIndex - 1);
+        T u1 = nodeVoltage(solutionMatrix, n1, n2, currentSolutionIndex);
+        lastCurrent = nextCurrent(value, lastCurrent, u0, u1, timestep,
+                                  trapezoidalRule);
     }
 
-    void updateDCStoredState(const Matrix<T> & solutionVector, size_t sizeG_A,
-                             size_t numCurrents) {
-        lastCurrent = solutionVector(sizeG_A + numCurrents + dcCurrentIndex - 1, 0);
+    void updateDCStoredState(const SolutionHistory<T> & solutionVector,
+                             size_t sizeG_A, size_t numCurrents) {
+        lastCurrent = solutionVector.current(sizeG_A + numCurrents, dcCurrentIndex,
+                                             0);
     }
 
-    void addDCAnalysisStampTo(Stamp<T> & stamp, const Matrix<T> & solutionVector,
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector,
                               size_t numCurrents) const {
         // Short circuit
         size_t n1p = n1 - 1;
@@ -137,13 +154,167 @@ public:
             static_assert("Unsupported Type");
         }
 
-        elements.dynamicElements.emplace_back(
-            std::make_shared<Inductor<T> >(inductor));
+        elements.inductors.add(inductor);
+    }
+};
+
+/// @brief Every inductor of a netlist, stored field by field rather than
+///        inductor by inductor, so that stamping them is one loop over
+///        contiguous arrays instead of a virtual call each.
+///
+/// @tparam T the value type
+template<typename T>
+struct InductorBank {
+    std::vector<std::string> designator;
+    std::vector<size_t> n1;
+    std::vector<size_t> n2;
+    std::vector<T> value;
+    std::vector<T> lastCurrent;
+    /// @brief The currents at the two accepted steps before lastCurrent's, for
+    ///        truncationErrorTimestep
+    std::vector<std::array<T, 2> > earlierCurrents;
+    std::vector<size_t> dcCurrentIndex;
+
+    /// @brief The integration rule, shared by every inductor
+    bool trapezoidalRule = true;
+
+    size_t size() const {
+        return n1.size();
+    }
+
+    void add(const Inductor<T> & inductor) {
+        designator.push_back(inductor.designator);
+        n1.push_back(inductor.n1);
+        n2.push_back(inductor.n2);
+        value.push_back(inductor.value);
+        lastCurrent.push_back(inductor.lastCurrent);
+        earlierCurrents.push_back({inductor.lastCurrent, inductor.lastCurrent});
+        dcCurrentIndex.push_back(inductor.dcCurrentIndex);
+        trapezoidalRule = inductor.trapezoidalRule;
+        dynamicMap = {};
+        rhsMap = {};
+    }
+
+    void addDynamicStampTo(Stamp<T> & stamp,
+                           const SolutionHistory<T> & solutionMatrix,
+                           const size_t currentSolutionIndex, T timestep) const {
+        if (!dynamicMap.isResolvedFor(stamp)) {
+            std::vector<std::pair<size_t, size_t> > gEntries;
+            for (size_t i = 0; i < size(); i++) {
+                const size_t a = DynamicMap::node(n1[i]);
+                const size_t b = DynamicMap::node(n2[i]);
+                gEntries.insert(gEntries.end(), {{a, a}, {b, b}, {a, b}, {b, a}});
+            }
+            dynamicMap.resolve(stamp, gEntries, {});
+        }
+        for (size_t i = 0; i < size(); i++) {
+            T G_eq = Inductor<T>::companionConductance(value[i], timestep,
+                                                       trapezoidalRule);
+            dynamicMap.scatter(i, {G_eq, G_eq, -G_eq, -G_eq});
+        }
+
+        addDynamicRHSTo(stamp, solutionMatrix, currentSolutionIndex, timestep);
+    }
 
-        elements.nodeComponentMap.insert(
-            {{inductor.n1, elements.dynamicElements.back()},
-             {inductor.n2, elements.dynamicElements.back()}});
+    void addDynamicRHSTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
+                         const size_t currentSolutionIndex, T timestep) const {
+        if (!rhsMap.isResolvedFor(stamp)) {
+            std::vector<size_t> sRows;
+            for (size_t i = 0; i < size(); i++) {
+                sRows.insert(sRows.end(),
+                             {RHSMap::node(n1[i]), RHSMap::node(n2[i])});
+            }
+            rhsMap.resolve(stamp, {}, sRows);
+        }
+        for (size_t i = 0; i < size(); i++) {
+            T u0 = nodeVoltage(solutionMatrix, n1[i], n2[i],
+                               currentSolutionIndex - 1);
+            T I_eq = Inductor<T>::companionCurrent(value[i], lastCurrent[i], u0,
+                                                   timestep, trapezoidalRule);
+            rhsMap.scatter(i, {}, {-I_eq, I_eq});
+        }
     }
+
+    /// @brief Updates the stored currents. Large banks are split between the
+    ///        threads of ThreadPool::shared(); each inductor only writes its own.
+    void updateStoredState(const SolutionHistory<T> & solutionMatrix,
+                           const size_t currentSolutionIndex, T timestep) {
+        auto update = [&](size_t begin, size_t end, size_t) {
+            for (size_t i = begin; i < end; i++) {
+                T u0 = nodeVoltage(solutionMatrix, n1[i], n2[i],
+                                   currentSolutionIndex - 1);
+                T u1 = nodeVoltage(solutionMatrix, n1[i], n2[i],
+                                   currentSolutionIndex);
+                earlierCurrents[i] = {lastCurrent[i], earlierCurrents[i][0]};
+                lastCurrent[i] = Inductor<T>::nextCurrent(value[i], lastCurrent[i],
+                                                          u0, u1, timestep,
+                                                          trapezoidalRule);
+            }
+        };
+        ThreadPool::shared().parallelFor(size(), update, parallelUpdateGrain);
+    }
+
+    /// @brief The companion models read the step before. The truncation
+    ///        error estimate uses the stored currents for the steps before that.
+    size_t historyDepth() const {
+        return 1;
+    }
+
+    /// @brief The longest timestep for which the truncation error of every
+    ///        inductor's flux over the step just solved is within tolerance
+    T truncationErrorTimestep(const SolutionHistory<T> & solutionMatrix,
+                              const size_t currentSolutionIndex,
+                              const TruncationErrorControl<T> & control) const {
+        const size_t order = trapezoidalRule ? 2 : 1;
+        T timestep = std::numeric_limits<T>::infinity();
+        if (control.points < order + 2) {
+            return timestep;
+        }
+        const T h = control.times[0] - control.times[1];
+        std::array<T, 4> flux;
+        for (size_t i = 0; i < size(); i++) {
+            T u0 = nodeVoltage(solutionMatrix, n1[i], n2[i],
+                               currentSolutionIndex - 1);
+            T u1 = nodeVoltage(solutionMatrix, n1[i], n2[i], currentSolutionIndex);
+            flux[0] = value[i] * Inductor<T>::nextCurrent(value[i], lastCurrent[i],
+                                                          u0, u1, h,
+                                                          trapezoidalRule);
+            flux[1] = value[i] * lastCurrent[i];
+            flux[2] = value[i] * earlierCurrents[i][0];
+            flux[3] = value[i] * earlierCurrents[i][1];
+            timestep = std::min(timestep, control.timestep(flux.data(), order));
+        }
+        return timestep;
+    }
+
+    void updateDCStoredState(const SolutionHistory<T> & solutionVector,
+                             size_t sizeG_A, size_t numCurrents) {
+        for (size_t i = 0; i < size(); i++) {
+            lastCurrent[i] = solutionVector.current(sizeG_A + numCurrents,
+                                                    dcCurrentIndex[i], 0);
+        }
+    }
+
+    void addDCAnalysisStampTo(Stamp<T> & stamp, size_t numCurrents) const {
+        // Short circuit
+        for (size_t i = 0; i < size(); i++) {
+            size_t current = stamp.sizeG_A + numCurrents + dcCurrentIndex[i] - 1;
+            if (n1[i] > 0) {
+                stamp.G(n1[i] - 1, current) += 1;
+                stamp.G(current, n1[i] - 1) += 1;
+            }
+            if (n2[i] > 0) {
+                stamp.G(n2[i] - 1, current) += -1;
+                stamp.G(current, n2[i] - 1) += -1;
+            }
+        }
+    }
+
+private:
+    using DynamicMap = BankStampMap<T, 4, 0>;
+    using RHSMap = BankStampMap<T, 0, 2>;
+    mutable DynamicMap dynamicMap;
+    mutable RHSMap rhsMap;
 };
 
 #endif
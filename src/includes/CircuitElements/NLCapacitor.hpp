@@ -23,21 +23,52 @@ public:
 
     T C_last = C_p + C_o * (1.0 + std::tanh(P_10 + P_11 * u_last));
 
-    void
-    addNonLinearStampTo(Stamp<T> & stamp, const Matrix<T> & solutionMatrix,
-                        const size_t currentSolutionIndex, T timestep = 0) const {
-        const size_t n1p = n1 - 1;
-        const size_t n2p = n2 - 1;
+    using NonLinearMap = StampMap<T, 4, 2>;
+    /// @brief Where addNonLinearStampTo writes in the stamp last written to
+    mutable NonLinearMap nonLinearMap;
 
-        T u = 0;
+    bool hasTimeInvariantDynamicG() const {
+        return true;
+    }
 
-        if (n1 > 0) {
-            u = solutionMatrix(n1p, currentSolutionIndex);
+    /// @brief The charge on the capacitor, the integral of C from 0 to u
+    T charge(T u) const {
+        if (P_11 == 0) {
+            return (C_p + C_o * (1.0 + std::tanh(P_10))) * u;
         }
+        // log(cosh(x)), without overflowing for large x
+        auto logCosh = [](T x) {
+            x = std::abs(x);
+            return x + std::log1p(std::exp(-2 * x)) - std::log(T(2));
+        };
+        return (C_p + C_o) * u +
+               C_o / P_11 * (logCosh(P_10 + P_11 * u) - logCosh(P_10));
+    }
 
-        if (n2 > 0) {
-            u -= solutionMatrix(n2p, currentSolutionIndex);
+    /// @brief The truncation error estimate reads the three steps before
+    size_t historyDepth() const {
+        return 3;
+    }
+
+    T truncationErrorTimestep(const SolutionHistory<T> & solutionMatrix,
+                              const size_t currentSolutionIndex,
+                              const TruncationErrorControl<T> & control) const {
+        constexpr size_t order = 2;
+        if (control.points < order + 2) {
+            return std::numeric_limits<T>::infinity();
+        }
+        std::array<T, order + 2> q;
+        for (size_t k = 0; k < order + 2; k++) {
+            q[k] = charge(nodeVoltage(solutionMatrix, n1, n2,
+                                      currentSolutionIndex - k));
         }
+        return control.timestep(q.data(), order);
+    }
+
+    void
+    addNonLinearStampTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
+                        const size_t currentSolutionIndex, T timestep = 0) const {
+        T u = nodeVoltage(solutionMatrix, n1, n2, currentSolutionIndex);
 
         T C = C_p + C_o * (1.0 + std::tanh(P_10 + P_11 * u));
 
@@ -52,40 +83,20 @@ public:
 
         T I_eq = -G_eq * u + i;
 
-        if (n1 > 0) {
-            stamp.G(n1p, n1p) += G_eq;
-            stamp.s(n1p, 0) += -I_eq;
-
-            if (n2 > 0) {
-                stamp.G(n1p, n2p) += -G_eq;
-            }
-        }
-
-        if (n2 > 0) {
-            stamp.G(n2p, n2p) += G_eq;
-            stamp.s(n2p, 0) += +I_eq;
-
-            if (n1 > 0) {
-                stamp.G(n2p, n1p) += -G_eq;
-            }
+        if (!nonLinearMap.isResolvedFor(stamp)) {
+            const size_t a = NonLinearMap::node(n1);
+            const size_t b = NonLinearMap::node(n2);
+            nonLinearMap.resolve(stamp, {{a, a}, {a, b}, {b, b}, {b, a}}, {a, b});
         }
+        const std::array<T, 4> gValues = {G_eq, -G_eq, G_eq, -G_eq};
+        const std::array<T, 2> sValues = {-I_eq, I_eq};
+        nonLinearMap.scatter(gValues, sValues);
     }
 
-    void updateStoredState(const Matrix<T> & solutionMatrix,
+    void updateStoredState(const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex, T timestep,
                            size_t sizeG_A) {
-        const size_t n1p = n1 - 1;
-        const size_t n2p = n2 - 1;
-
-        T u = 0;
-
-        if (n1 > 0) {
-            u = solutionMatrix(n1p, currentSolutionIndex);
-        }
-
-        if (n2 > 0) {
-            u -= solutionMatrix(n2p, currentSolutionIndex);
-        }
+        T u = nodeVoltage(solutionMatrix, n1, n2, currentSolutionIndex);
 
         T C = C_p + C_o * (1.0 + std::tanh(P_10 + P_11 * u));
 
@@ -96,20 +107,9 @@ public:
         u_last = u;
     }
 
-    void updateDCStoredState(const Matrix<T> & solutionVector, size_t sizeG_A,
-                             size_t numCurrents) {
-        const size_t n1p = n1 - 1;
-        const size_t n2p = n2 - 1;
-
-        T u = 0;
-
-        if (n1 > 0) {
-            u = solutionVector(n1p, 0);
-        }
-
-        if (n2 > 0) {
-            u -= solutionVector(n2p, 0);
-        }
+    void updateDCStoredState(const SolutionHistory<T> & solutionVector,
+                             size_t sizeG_A, size_t numCurrents) {
+        T u = nodeVoltage(solutionVector, n1, n2, 0);
 
         T C = C_p + C_o * (1.0 + std::tanh(P_10 + P_11 * u));
 
@@ -120,7 +120,8 @@ public:
         u_last = u;
     }
 
-    void addDCAnalysisStampTo(Stamp<T> & stamp, const Matrix<T> & solutionVector,
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector,
                               size_t numCurrents) const {
         // open circuit
         if (n1 > 0) {
@@ -20,8 +20,16 @@ public:
     size_t r2_pos = 0;
     size_t r2_neg = 0;
 
+    using NonLinearMap = StampMap<T, 8, 2>;
+    /// @brief Where addNonLinearStampTo writes in the stamp last written to
+    mutable NonLinearMap nonLinearMap;
+
+    bool hasTimeInvariantDynamicG() const {
+        return true;
+    }
+
     void
-    addNonLinearStampTo(Stamp<T> & stamp, const Matrix<T> & solutionMatrix,
+    addNonLinearStampTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
                         const size_t currentSolutionIndex, T timestep = 0) const {
         constexpr T alpha = 1.3;
         constexpr T beta0 = 0.42;
@@ -33,40 +41,8 @@ public:
         constexpr T zeta = 0.18;
         constexpr T Vto = -2.4;
 
-        size_t n1p = n1 - 1;
-        size_t n2p = n2 - 1;
-        size_t r1p_pos = r1_pos - 1;
-        size_t r1p_neg = r1_neg - 1;
-        size_t r2p_pos = r2_pos - 1;
-        size_t r2p_neg = r2_neg - 1;
-
-        T u = 0;
-        T r1 = 0;
-        T r2 = 0;
-
-        if (n1 > 0) {
-            u = solutionMatrix(n1p, currentSolutionIndex);
-        }
-
-        if (n2 > 0) {
-            u -= solutionMatrix(n2p, currentSolutionIndex);
-        }
-
-        if (r1_pos > 0) {
-            r1 = solutionMatrix(r1p_pos, currentSolutionIndex);
-        }
-
-        if (r1_neg > 0) {
-            r1 -= solutionMatrix(r1p_neg, currentSolutionIndex);
-        }
-
-        if (r2_pos > 0) {
-            r2 = solutionMatrix(r2p_pos, currentSolutionIndex);
-        }
-
-        if (r2_neg > 0) {
-            r2 -= solutionMatrix(r2p_neg, currentSolutionIndex);
-        }
+        T r1 = nodeVoltage(solutionMatrix, r1_pos, r1_neg, currentSolutionIndex);
+        T r2 = nodeVoltage(solutionMatrix, r2_pos, r2_neg, currentSolutionIndex);
 
         namespace AD = AutoDifferentiation;
 
@@ -84,40 +60,27 @@ public:
         auto Idrain = Ids_lim * f1;
         auto I_ds = Idrain[0] - Idrain[1] * r1 - Idrain[2] * r2;
 
-        if (n1 > 0) {
-            stamp.s(n1p, 0) += -I_ds;
-            if (r1_pos > 0) {
-                stamp.G(n1p, r1p_pos) += Idrain[1];
-            }
-            if (r1_neg > 0) {
-                stamp.G(n1p, r1p_neg) += -Idrain[1];
-            }
-            if (r2_pos > 0) {
-                stamp.G(n1p, r2p_pos) += Idrain[2];
-            }
-            if (r2_neg > 0) {
-                stamp.G(n1p, r2p_neg) += -Idrain[2];
-            }
-        }
-
-        if (n2 > 0) {
-            stamp.s(n2p, 0) += +I_ds;
-            if (r1_pos > 0) {
-                stamp.G(n2p, r1p_pos) += -Idrain[1];
-            }
-            if (r1_neg > 0) {
-                stamp.G(n2p, r1p_neg) += Idrain[1];
-            }
-            if (r2_pos > 0) {
-                stamp.G(n2p, r2p_pos) += -Idrain[2];
-            }
-            if (r2_neg > 0) {
-                stamp.G(n2p, r2p_neg) += Idrain[2];
-            }
+        if (!nonLinearMap.isResolvedFor(stamp)) {
+            const size_t a = NonLinearMap::node(n1);
+            const size_t b = NonLinearMap::node(n2);
+            const size_t p1 = NonLinearMap::node(r1_pos);
+            const size_t m1 = NonLinearMap::node(r1_neg);
+            const size_t p2 = NonLinearMap::node(r2_pos);
+            const size_t m2 = NonLinearMap::node(r2_neg);
+            nonLinearMap.resolve(stamp,
+                                 {{a, p1}, {a, m1}, {a, p2}, {a, m2},
+                                  {b, p1}, {b, m1}, {b, p2}, {b, m2}},
+                                 {a, b});
         }
+        const std::array<T, 8> gValues = {
+            Idrain[1],  -Idrain[1], Idrain[2],  -Idrain[2],
+            -Idrain[1], Idrain[1],  -Idrain[2], Idrain[2]};
+        const std::array<T, 2> sValues = {-I_ds, I_ds};
+        nonLinearMap.scatter(gValues, sValues);
     }
 
-    void addDCAnalysisStampTo(Stamp<T> & stamp, const Matrix<T> & solutionVector,
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector,
                               size_t numCurrents) const {
         addNonLinearStampTo(stamp, solutionVector, 0, 0);
     }
@@ -13,6 +13,10 @@ public:
     size_t g = 0;
     size_t s = 0;
 
+    using NonLinearMap = StampMap<T, 9, 3>;
+    /// @brief Where addNonLinearStampTo writes in the stamp last written to
+    mutable NonLinearMap nonLinearMap;
+
     // constant params of the model
     const T C_GSp = 0.01;
     const T C_GSo = 0.5;
@@ -36,8 +40,12 @@ public:
     T C_GD_last = C_GDp + C_GDo * (1.0 + std::tanh(P_D10 + P_D11 * u_gd_last));
     T C_GS_last = C_GSp + C_GSo * (1.0 + std::tanh(P_S10 + P_S11 * u_gs_last));
 
+    bool hasTimeInvariantDynamicG() const {
+        return true;
+    }
+
     void
-    addNonLinearStampTo(Stamp<T> & stamp, const Matrix<T> & solutionMatrix,
+    addNonLinearStampTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
                         const size_t currentSolutionIndex, T timestep = 0) const {
         const size_t gp = g - 1;
         const size_t dp = d - 1;
@@ -99,47 +107,25 @@ public:
         T I_s = i_s - g_sd * u_gd - g_ss * u_gs;
         T I_g = i_g - g_gd * u_gd - g_gs * u_gs;
 
-        if (d > 0) {
-            stamp.G(dp, dp) += -g_dd;
-            stamp.s(dp, 0) += -I_d;
-
-            if (s > 0) {
-                stamp.G(dp, sp) += -g_ds;
-            }
-
-            if (g > 0) {
-                stamp.G(dp, gp) += g_dd + g_ds;
-            }
-        }
-
-        if (s > 0) {
-            stamp.G(sp, sp) += -g_ss;
-            stamp.s(sp, 0) += -I_s;
-
-            if (d > 0) {
-                stamp.G(sp, dp) += -g_sd;
-            }
-
-            if (g > 0) {
-                stamp.G(sp, gp) += g_sd + g_ss;
-            }
-        }
-
-        if (g > 0) {
-            stamp.G(gp, gp) += g_gd + g_gs;
-            stamp.s(gp, 0) += -I_g;
-
-            if (d > 0) {
-                stamp.G(gp, dp) += -g_gd;
-            }
-
-            if (s > 0) {
-                stamp.G(gp, sp) += -g_gs;
-            }
+        if (!nonLinearMap.isResolvedFor(stamp)) {
+            const size_t dn = NonLinearMap::node(d);
+            const size_t sn = NonLinearMap::node(s);
+            const size_t gn = NonLinearMap::node(g);
+            nonLinearMap.resolve(stamp,
+                                 {{dn, dn}, {dn, sn}, {dn, gn},
+                                  {sn, sn}, {sn, dn}, {sn, gn},
+                                  {gn, gn}, {gn, dn}, {gn, sn}},
+                                 {dn, sn, gn});
         }
+        const std::array<T, 9> gValues = {
+            -g_dd, -g_ds, g_dd + g_ds,
+            -g_ss, -g_sd, g_sd + g_ss,
+            g_gd + g_gs, -g_gd, -g_gs};
+        const std::array<T, 3> sValues = {-I_d, -I_s, -I_g};
+        nonLinearMap.scatter(gValues, sValues);
     }
 
-    void updateStoredState(const Matrix<T> & solutionMatrix,
+    void updateStoredState(const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex, T timestep,
                            size_t sizeG_A) {
         const size_t gp = g - 1;
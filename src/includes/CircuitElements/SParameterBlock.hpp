@@ -4,6 +4,8 @@
 #include <fstream>
 #include <sstream>
 #include <complex>
+#include <bit>
+#include <cmath>
 
 #include "CircuitElements/Component.hpp"
 #include "Maths/DynamicMatrix.hpp"
@@ -92,20 +94,31 @@ struct SParameterBlock : public Component<T> {
     T z_ref = 0;
     T fracMaxToKeep = 0;
 
+    /// @brief The a wave incident on each port at the steps the convolution
+    ///        can reach, kept contiguous per port. Each is a ring whose length
+    ///        is a power of two, so a step's slot is its index masked.
+    std::vector<std::vector<T> > incidentWave;
+    size_t incidentWaveMask = 0;
+
+    /// @brief The a wave incident on a port at a step of the solution history
+    T incidentWaveAt(size_t portIndex, const SolutionHistory<T> & solutionMatrix,
+                     const size_t n, size_t sizeG_A) const {
+        const SParameterPort<T> & p = port[portIndex];
+        return nodeVoltage(solutionMatrix, p.positive, p.negative, n) +
+               solutionMatrix.current(sizeG_A, p.current, n) * z_ref;
+    }
+
     /// @brief performs a linear interpolation and returns the a wave value for
     ///        use in the convolution.
     ///
     /// @param portIndex The port being processed
-    /// @param solutionMatrix The working solution vector
     /// @param n The current time step
     /// @param sTimePoint The time of DTIR
     /// @param simulationTimestep The timestep of the simulation
-    /// @param sizeG_A The size of the voltage dependant portion of the stamp
     ///
     /// @return the value for use in the convolution
-    T aWaveConvValue(size_t portIndex, const Matrix<T> & solutionMatrix,
-                     const size_t n, T sTimePoint, const T simulationTimestep,
-                     size_t sizeG_A) const {
+    T aWaveConvValue(size_t portIndex, const size_t n, T sTimePoint,
+                     const T simulationTimestep) const {
         T kprime = sTimePoint / simulationTimestep;
         // This check is incredibly slow because it occurs with all loops. A similar
         // check could occur in another place when S-Parameters are first formulated
@@ -128,28 +141,9 @@ struct SParameterBlock : public Component<T> {
 
         T mix = index - static_cast<T>(floor);
 
-        T toRet;
-
-        T uppArr[3] = {0};
-        T lowArr[3] = {0};
-
-        if (port[portIndex].positive != 0) {
-            uppArr[0] = solutionMatrix(port[portIndex].positive - 1, floor + 1);
-            lowArr[0] = solutionMatrix(port[portIndex].positive - 1, floor);
-        }
-
-        if (port[portIndex].negative != 0) {
-            uppArr[1] = solutionMatrix(port[portIndex].negative - 1, floor + 1);
-            lowArr[1] = solutionMatrix(port[portIndex].negative - 1, floor);
-        }
-
-        uppArr[2] = solutionMatrix(sizeG_A + port[portIndex].current - 1, floor + 1);
-        lowArr[2] = solutionMatrix(sizeG_A + port[portIndex].current - 1, floor);
-
-        toRet = (uppArr[0] - lowArr[0]) * mix + lowArr[0] -
-                (uppArr[1] - lowArr[1]) * mix - lowArr[1] +
-                ((uppArr[2] - lowArr[2]) * mix + lowArr[2]) * z_ref;
-        return toRet;
+        const std::vector<T> & a = incidentWave[portIndex];
+        const T lower = a[floor & incidentWaveMask];
+        return (a[(floor + 1) & incidentWaveMask] - lower) * mix + lower;
     }
 
 
@@ -157,14 +151,11 @@ struct SParameterBlock : public Component<T> {
     ///        (historic) a wave values with the DTIR
     ///
     /// @param p The port index
-    /// @param solutionMatrix The solution vector of the circuit
     /// @param n The current timestep
     /// @param simulationTimestep the simulations timestep
-    /// @param sizeG_A the size of the voltage dependant part of the stamp
     ///
     /// @return Equivalent port voltage source voltage
-    T V_p(size_t p, const Matrix<T> & solutionMatrix, const size_t n,
-          T simulationTimestep, size_t sizeG_A) const {
+    T V_p(size_t p, const size_t n, T simulationTimestep) const {
         // V_p = beta * sum of ports ( history of port )
         T toRet = 0;
         // TODO: This may finally be a good place for multithreading
@@ -175,8 +166,7 @@ struct SParameterBlock : public Component<T> {
             // TODO: Optimise the convolution here
             // size_t len = std::min( n, s.sParamLength );
             for (size_t k = 1; k < s.length(p, c); k++) {
-                toRet += aWaveConvValue(c, solutionMatrix, n, s.time(p, c, k),
-                                        simulationTimestep, sizeG_A) *
+                toRet += aWaveConvValue(c, n, s.time(p, c, k), simulationTimestep) *
                          s.data(p, c, k);
             }
         }
@@ -225,19 +215,37 @@ struct SParameterBlock : public Component<T> {
         }
     }
 
-    void addDynamicStampTo(Stamp<T> & stamp, const Matrix<T> & solutionMatrix,
+    void addDynamicStampTo(Stamp<T> & stamp,
+                           const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex,
                            T simulationTimestep) const {
+        addDynamicRHSTo(stamp, solutionMatrix, currentSolutionIndex,
+                        simulationTimestep);
+    }
+
+    void addDynamicRHSTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
+                         const size_t currentSolutionIndex,
+                         T simulationTimestep) const {
         for (size_t p = 0; p < port.size(); p++) {
             size_t curr = port[p].current - 1;
             // V_p
             stamp.s(stamp.sizeG_A + curr,
-                    0) += V_p(p, solutionMatrix, currentSolutionIndex,
-                              simulationTimestep, stamp.sizeG_A);
+                    0) += V_p(p, currentSolutionIndex, simulationTimestep);
         }
     }
 
-    void addDCAnalysisStampTo(Stamp<T> & stamp, const Matrix<T> & solutionVector,
+    bool hasTimeInvariantDynamicG() const {
+        return true;
+    }
+
+    /// @brief The impulse responses are sampled at the netlist's timestep, so
+    ///        the convolution needs every step to be that long
+    bool requiresFixedTimestep() const {
+        return true;
+    }
+
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector,
                               size_t numCurrents) const {
         for (size_t p = 0; p < port.size(); p++) {
             size_t np = port[p].positive - 1;
@@ -296,9 +304,27 @@ struct SParameterBlock : public Component<T> {
         }
     }
 
-    void updateStoredState(const Matrix<T> & solutionMatrix,
+    void updateStoredState(const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex, T timestep,
                            size_t sizeG_A) {
+        for (size_t p = 0; p < port.size(); p++) {
+            incidentWave[p][currentSolutionIndex & incidentWaveMask] =
+                incidentWaveAt(p, solutionMatrix, currentSolutionIndex, sizeG_A);
+        }
+    }
+
+    /// @brief Sizes the incident wave rings to reach back past the longest
+    ///        retained tap, plus the step interpolated against
+    void setTimestep(T timestep) {
+        T longestTap = 0;
+        for (T time : s._time) {
+            longestTap = std::max(longestTap, time);
+        }
+        const size_t depth = static_cast<size_t>(std::ceil(longestTap / timestep)) +
+                             2;
+        const size_t length = std::bit_ceil(depth + 1);
+        incidentWave.assign(port.size(), std::vector<T>(length, T(0)));
+        incidentWaveMask = length - 1;
     }
 
 
@@ -82,7 +82,8 @@ struct SParameterBlockVF : public Component<T> {
 
     T z_ref = 0;
 
-    std::complex<T> history_p(const size_t p, const Matrix<T> & solutionMatrix,
+    std::complex<T> history_p(const size_t p,
+                              const SolutionHistory<T> & solutionMatrix,
                               const size_t currentSolutionIndex, T timestep,
                               const size_t sizeG_A) const {
         std::complex<T> toRet = 0;
@@ -103,14 +104,14 @@ struct SParameterBlockVF : public Component<T> {
     }
 
     T
-    V_p(const size_t p, const Matrix<T> & solutionMatrix,
+    V_p(const size_t p, const SolutionHistory<T> & solutionMatrix,
         const size_t currentSolutionIndex, T timestep, const size_t sizeG_A) const {
         return std::real(
             history_p(p, solutionMatrix, currentSolutionIndex, timestep, sizeG_A) *
             port[p].beta);
     }
 
-    T awave_p(const size_t p, const Matrix<T> & solutionMatrix,
+    T awave_p(const size_t p, const SolutionHistory<T> & solutionMatrix,
               const size_t currentSolutionIndex, const size_t sizeG_A) const {
         size_t np = port[p].positive - 1;
         size_t nn = port[p].negative - 1;
@@ -130,7 +131,7 @@ struct SParameterBlockVF : public Component<T> {
                (2 * std::sqrt(z_ref));
     }
 
-    T bwave_p(const size_t p, const Matrix<T> & solutionMatrix,
+    T bwave_p(const size_t p, const SolutionHistory<T> & solutionMatrix,
               const size_t currentSolutionIndex, const size_t sizeG_A) const {
         size_t np = port[p].positive - 1;
         size_t nn = port[p].negative - 1;
@@ -189,9 +190,17 @@ struct SParameterBlockVF : public Component<T> {
         }
     }
 
-    void addDynamicStampTo(Stamp<T> & stamp, const Matrix<T> & solutionMatrix,
+    void addDynamicStampTo(Stamp<T> & stamp,
+                           const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex,
                            T simulationTimestep) const {
+        addDynamicRHSTo(stamp, solutionMatrix, currentSolutionIndex,
+                        simulationTimestep);
+    }
+
+    void addDynamicRHSTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
+                         const size_t currentSolutionIndex,
+                         T simulationTimestep) const {
         for (size_t p = 0; p < port.size(); p++) {
             size_t curr = port[p].current - 1;
             // V_p
@@ -201,7 +210,23 @@ struct SParameterBlockVF : public Component<T> {
         }
     }
 
-    void updateStoredState(const Matrix<T> & solutionMatrix,
+    bool hasTimeInvariantDynamicG() const {
+        return true;
+    }
+
+    /// @brief The recursive convolution is discretised once, in setTimestep, so
+    ///        every step has to be that long
+    bool requiresFixedTimestep() const {
+        return true;
+    }
+
+    /// @brief The recursive convolution reads the a waves of the two steps
+    ///        before
+    size_t historyDepth() const {
+        return 2;
+    }
+
+    void updateStoredState(const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex, T timestep,
                            size_t sizeG_A) {
         for (size_t p = 0; p < numPorts; p++) {
@@ -441,7 +466,8 @@ struct SParameterBlockVF : public Component<T> {
         }
     }
 
-    void addDCAnalysisStampTo(Stamp<T> & stamp, const Matrix<T> & solutionVector,
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector,
                               size_t numCurrents) const {
         size_t numPorts = port.size();
         std::vector<std::complex<T> > xSum(port.size() * port.size());
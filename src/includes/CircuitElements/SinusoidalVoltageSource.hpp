@@ -18,8 +18,11 @@ struct SinusoidalVoltageSource : public Component<T> {
     T frequency = 1;
     T offset = 0;
     bool degrees = true;
+    /// @brief The time being solved for, see setTime
+    T time = 0;
 
-    void addDynamicStampTo(Stamp<T> & stamp, const Matrix<T> & solutionMatrix,
+    void addDynamicStampTo(Stamp<T> & stamp,
+                           const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex, T timestep) const {
         size_t n1p = n1 - 1;
         size_t n2p = n2 - 1;
@@ -35,25 +38,47 @@ struct SinusoidalVoltageSource : public Component<T> {
             stamp.G(stamp.sizeG_A + currentIndexp, n2p) += -1;
         }
 
+        addDynamicRHSTo(stamp, solutionMatrix, currentSolutionIndex, timestep);
+    }
+
+    void addDynamicRHSTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
+                         const size_t currentSolutionIndex, T timestep) const {
+        size_t currentIndexp = currentIndex - 1;
+
         if (degrees) {
             stamp.s(stamp.sizeG_A + currentIndexp,
                     0) += offset + V * std::sin(2 * std::numbers::pi * frequency *
-                                                    currentSolutionIndex * timestep +
+                                                    time +
                                                 std::numbers::pi * phase / 180);
         } else {
             stamp.s(stamp.sizeG_A + currentIndexp,
                     0) += offset + V * std::sin(2 * std::numbers::pi * frequency *
-                                                    currentSolutionIndex * timestep +
+                                                    time +
                                                 phase);
         }
     }
 
-    void updateStoredState(const Matrix<T> & solutionMatrix,
+    bool hasTimeInvariantDynamicG() const {
+        return true;
+    }
+
+    void setTime(T time) {
+        this->time = time;
+    }
+
+    /// @brief Fifty steps a period, so that an adaptive timestep still resolves
+    ///        the sinusoid where the circuit is otherwise quiet
+    T maximumTimestep() const {
+        return 1 / (50 * frequency);
+    }
+
+    void updateStoredState(const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex, T timestep,
                            size_t sizeG_A) {
     }
 
-    void addDCAnalysisStampTo(Stamp<T> & stamp, const Matrix<T> & solutionVector,
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector,
                               size_t numCurrents) const {
         addDynamicStampTo(stamp, solutionVector, 0, 0);
     }
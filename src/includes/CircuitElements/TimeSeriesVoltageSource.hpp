@@ -16,6 +16,8 @@ struct TimeSeriesVoltageSource : public Component<T> {
 
     std::vector<T> timeSeries;
     std::vector<T> dataSeries;
+    /// @brief The time being solved for, see setTime
+    T time = 0;
 
     T lerp(size_t lowIndex, T timeVal) const {
         T diffTS = timeSeries[(lowIndex + 1) % timeSeries.size()] -
@@ -26,18 +28,12 @@ struct TimeSeriesVoltageSource : public Component<T> {
         return dataSeries[lowIndex] + diffDS * diffTV / diffTS;
     }
 
-    void addDynamicStampTo(Stamp<T> & stamp, const Matrix<T> & solutionMatrix,
+    void addDynamicStampTo(Stamp<T> & stamp,
+                           const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex, T timestep) const {
         size_t n1p = n1 - 1;
         size_t n2p = n2 - 1;
         size_t currentIndexp = currentIndex - 1;
-        size_t timeSeriesIndex = lastTimeSeriesIndex;
-        T timeMod = std::fmod(currentSolutionIndex * timestep, timeSeries.back());
-        while (timeMod > timeSeries[(timeSeriesIndex + 1) % timeSeries.size()] ||
-               (timeSeriesIndex != 0 &&
-                timeMod < timeSeries[(timeSeriesIndex - 1) % timeSeries.size()])) {
-            timeSeriesIndex = (timeSeriesIndex + 1) % timeSeries.size();
-        }
 
         if (n1) {
             stamp.G(n1p, stamp.sizeG_A + currentIndexp) += 1;
@@ -49,22 +45,55 @@ struct TimeSeriesVoltageSource : public Component<T> {
             stamp.G(stamp.sizeG_A + currentIndexp, n2p) += -1;
         }
 
+        addDynamicRHSTo(stamp, solutionMatrix, currentSolutionIndex, timestep);
+    }
+
+    void addDynamicRHSTo(Stamp<T> & stamp, const SolutionHistory<T> & solutionMatrix,
+                         const size_t currentSolutionIndex, T timestep) const {
+        size_t currentIndexp = currentIndex - 1;
+        size_t timeSeriesIndex = lastTimeSeriesIndex;
+        T timeMod = std::fmod(time, timeSeries.back());
+        while (timeMod > timeSeries[(timeSeriesIndex + 1) % timeSeries.size()] ||
+               (timeSeriesIndex != 0 &&
+                timeMod < timeSeries[(timeSeriesIndex - 1) % timeSeries.size()])) {
+            timeSeriesIndex = (timeSeriesIndex + 1) % timeSeries.size();
+        }
+
         stamp.s(stamp.sizeG_A + currentIndexp, 0) += lerp(timeSeriesIndex, timeMod);
     }
 
-    void updateStoredState(const Matrix<T> & solutionMatrix,
+    bool hasTimeInvariantDynamicG() const {
+        return true;
+    }
+
+    void setTime(T time) {
+        this->time = time;
+    }
+
+    /// @brief The next sample of the series, where the interpolated waveform
+    ///        changes slope. The series repeats with period timeSeries.back().
+    T nextBreakpoint(T time) const {
+        const T period = timeSeries.back();
+        const T start = std::floor(time / period) * period;
+        auto next = std::upper_bound(timeSeries.begin(), timeSeries.end(),
+                                     time - start);
+        return next == timeSeries.end() ? start + period : start + *next;
+    }
+
+    void updateStoredState(const SolutionHistory<T> & solutionMatrix,
                            const size_t currentSolutionIndex, T timestep,
                            size_t sizeG_A) {
-        while (std::fmod(currentSolutionIndex * timestep, timeSeries.back()) >
+        while (std::fmod(time, timeSeries.back()) >
                    timeSeries[(lastTimeSeriesIndex + 1) % timeSeries.size()] ||
                (lastTimeSeriesIndex != 0 &&
-                std::fmod(currentSolutionIndex * timestep, timeSeries.back()) <
+                std::fmod(time, timeSeries.back()) <
                     timeSeries[(lastTimeSeriesIndex - 1) % timeSeries.size()])) {
             lastTimeSeriesIndex = (lastTimeSeriesIndex + 1) % timeSeries.size();
         }
     }
 
-    void addDCAnalysisStampTo(Stamp<T> & stamp, const Matrix<T> & solutionVector,
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector,
                               size_t numCurrents) const {
         addDynamicStampTo(stamp, solutionVector, 0, 0);
     }
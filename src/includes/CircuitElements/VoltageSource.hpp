@@ -33,7 +33,8 @@ public:
         stamp.s(stamp.sizeG_A + currentIndexp, 0) += value;
     }
 
-    void addDCAnalysisStampTo(Stamp<T> & stamp, const Matrix<T> & solutionVector,
+    void addDCAnalysisStampTo(Stamp<T> & stamp,
+                              const SolutionHistory<T> & solutionVector,
                               size_t numCurrents) const {
         addStaticStampTo(stamp);
     }
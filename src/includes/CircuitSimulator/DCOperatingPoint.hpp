@@ -0,0 +1,322 @@
+#ifndef _DCOPERATINGPOINT_HPP_INC_
+#define _DCOPERATINGPOINT_HPP_INC_
+#include "CircuitElements/CircuitElements.hpp"
+#include "Maths/DynamicMatrix.hpp"
+#include "Maths/LinearSolver.hpp"
+#include "Maths/SolutionHistory.hpp"
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <string>
+
+/// @brief The ways DCOperatingPoint tries to find the operating point, in the
+///        order they are tried
+enum class DCStrategy {
+    /// @brief Damped Newton-Raphson from zero
+    Newton,
+    /// @brief Solves with a conductance from every node to ground, reducing it
+    ///        to nothing
+    GminStepping,
+    /// @brief Ramps the independent sources up from zero
+    SourceStepping,
+    /// @brief Puts a capacitance from every node to ground, and steps through
+    ///        pseudo-time with a growing timestep until the circuit settles
+    PseudoTransient,
+};
+
+/// @brief Finds the DC operating point of a circuit by damped Newton-Raphson,
+///        falling back to gmin stepping, source stepping and pseudo-transient
+///        continuation if it doesn't converge.
+///
+/// @details Each strategy runs the same Newton-Raphson iteration, on the DC
+///          stamp with the sources scaled and a shunt conductance from each
+///          node to an anchor voltage added. Once the steps stop shrinking,
+///          each is scaled down so that no node voltage moves by more than
+///          maxVoltageStep, which keeps the non-linear devices near where their
+///          last linearisation holds. An iteration converges when no unknown
+///          moves by more than SPICE's tolerances.
+///
+/// @tparam T The value type
+template<typename T>
+class DCOperatingPoint {
+public:
+    /// @brief The most a node voltage may move in one iteration
+    static constexpr T maxVoltageStep = 10;
+    /// @brief The tolerances of the convergence test
+    static constexpr T relativeTolerance = 1e-3;
+    static constexpr T voltageTolerance = 1e-6;
+    static constexpr T currentTolerance = 1e-12;
+    /// @brief Iteration stops early once no unknown moves by more than this
+    static constexpr T convergedThreshold = 1e-12;
+    /// @brief The iterations allowed for the final solve of each strategy, and
+    ///        for each of the intermediate solves of the homotopies
+    static constexpr size_t maxIterations = 100;
+    static constexpr size_t maxStepIterations = 30;
+
+    /// @param elements The circuit
+    /// @param solver Solves the DC stamp. It must be sized for the DC unknowns.
+    /// @param numCurrents The number of transient currents, which the DC
+    ///                    currents come after
+    DCOperatingPoint(CircuitElements<T> & elements, LinearSolver<T> & solver,
+                     size_t numCurrents)
+        : elements(elements), solver(solver), numCurrents(numCurrents),
+          iterate(solver.M, 1), zero(solver.M, 1, 0) {
+    }
+
+    /// @brief Finds the operating point
+    ///
+    /// @param solution Where the operating point is written. If no strategy
+    ///                 converges, it is left with the result of the Newton
+    ///                 strategy.
+    ///
+    /// @return Whether any strategy converged
+    bool solve(SolutionHistory<T> & solution) {
+        solution.fill(0);
+        if (run(DCStrategy::Newton, solution) ||
+            !elements.hasNonLinearElements()) {
+            return true;
+        }
+        SolutionHistory<T> newtonSolution = solution;
+        for (DCStrategy strategy :
+             {DCStrategy::GminStepping, DCStrategy::SourceStepping,
+              DCStrategy::PseudoTransient}) {
+            solution.fill(0);
+            if (run(strategy, solution)) {
+                return true;
+            }
+        }
+        solution = newtonSolution;
+        return false;
+    }
+
+    /// @brief Describes the iterations and time taken by each strategy tried
+    std::string report() const {
+        std::stringstream ss;
+        ss << "DC OP strategies:";
+        bool first = true;
+        for (size_t s = 0; s < statistics.size(); s++) {
+            if (!statistics[s].attempted) {
+                continue;
+            }
+            ss << (first ? " " : ", ") << names[s] << " "
+               << (statistics[s].converged ? "converged" : "failed") << " in "
+               << statistics[s].iterations << " iterations ("
+               << statistics[s].nanoseconds * 1e-6 << " ms)";
+            first = false;
+        }
+        return ss.str();
+    }
+
+private:
+    CircuitElements<T> & elements;
+    LinearSolver<T> & solver;
+    size_t numCurrents;
+
+    /// @brief The solution of the current iteration
+    Matrix<T> iterate;
+    /// @brief An anchor at ground, for gmin stepping
+    SolutionHistory<T> zero;
+
+    /// @brief What each strategy took
+    struct Statistics {
+        bool attempted = false;
+        bool converged = false;
+        size_t iterations = 0;
+        long long nanoseconds = 0;
+    };
+    std::array<Statistics, 4> statistics;
+    static constexpr std::array<const char *, 4> names = {
+        "newton", "gmin stepping", "source stepping", "pseudo-transient"};
+
+    /// @brief Runs one strategy from the point in solution, and records its
+    ///        statistics
+    bool run(DCStrategy strategy, SolutionHistory<T> & solution) {
+        Statistics & stats = statistics[static_cast<size_t>(strategy)];
+        auto startTime = std::chrono::high_resolution_clock::now();
+        stats.attempted = true;
+        switch (strategy) {
+            case DCStrategy::Newton:
+                stats.converged = newtonRaphson(solution, 1, 0, zero,
+                                                maxIterations, stats.iterations);
+                break;
+            case DCStrategy::GminStepping:
+                stats.converged = gminStepping(solution, stats.iterations);
+                break;
+            case DCStrategy::SourceStepping:
+                stats.converged = sourceStepping(solution, stats.iterations);
+                break;
+            case DCStrategy::PseudoTransient:
+                stats.converged = pseudoTransient(solution, stats.iterations);
+                break;
+        }
+        auto endTime = std::chrono::high_resolution_clock::now();
+        stats.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                endTime - startTime)
+                                .count();
+        return stats.converged;
+    }
+
+    /// @brief Damped Newton-Raphson on the DC stamp
+    ///
+    /// @param solution The starting point, overwritten with the result
+    /// @param sourceScale Scales the independent sources
+    /// @param shunt The conductance added from each node to its anchor voltage
+    /// @param anchor The voltages the shunt conductances pull the nodes to
+    /// @param limit The most iterations to take
+    /// @param iterations Incremented for each iteration taken
+    ///
+    /// @return Whether the iteration converged
+    bool newtonRaphson(SolutionHistory<T> & solution, T sourceScale, T shunt,
+                       const SolutionHistory<T> & anchor, size_t limit,
+                       size_t & iterations) {
+        const bool nonLinear = elements.hasNonLinearElements();
+        bool withinTolerance = false;
+        T lastVoltageStep = std::numeric_limits<T>::infinity();
+        for (size_t nr = 0; nr < limit; nr++) {
+            iterations++;
+            auto & stamp = elements.generateDCStamp(solution, numCurrents,
+                                                    sourceScale);
+            if (shunt > 0) {
+                for (size_t k = 0; k < stamp.sizeG_A; k++) {
+                    stamp.G(k, k) += shunt;
+                    stamp.s(k, 0) += shunt * anchor(k, 0);
+                }
+            }
+            solver.factorise(stamp.G);
+            solution.getStep(0, iterate);
+            solver.solve(stamp.s, iterate);
+
+            T largestVoltageStep = 0;
+            for (size_t k = 0; k < stamp.sizeG_A; k++) {
+                largestVoltageStep = std::max(largestVoltageStep,
+                                              std::abs(iterate(k, 0) -
+                                                       solution(k, 0)));
+            }
+            // a linear circuit is solved exactly, so is never damped, and
+            // neither is an iteration whose steps are still shrinking
+            const T damping = nonLinear &&
+                                      largestVoltageStep > maxVoltageStep &&
+                                      largestVoltageStep > lastVoltageStep
+                                  ? maxVoltageStep / largestVoltageStep
+                                  : T(1);
+            lastVoltageStep = damping * largestVoltageStep;
+
+            T maxDiff = 0;
+            withinTolerance = damping == 1;
+            for (size_t k = 0; k < solution.M; k++) {
+                const T step = damping * (iterate(k, 0) - solution(k, 0));
+                if (!std::isfinite(step)) {
+                    return false;
+                }
+                const T magnitude = std::max(std::abs(solution(k, 0)),
+                                             std::abs(solution(k, 0) + step));
+                const T tolerance = relativeTolerance * magnitude +
+                                    (k < stamp.sizeG_A ? voltageTolerance
+                                                       : currentTolerance);
+                maxDiff = std::max(maxDiff, std::abs(step));
+                withinTolerance = withinTolerance && std::abs(step) <= tolerance;
+                solution(k, 0) += step;
+            }
+            if (!nonLinear) {
+                return true;
+            }
+            if (maxDiff < convergedThreshold) {
+                break;
+            }
+        }
+        return withinTolerance;
+    }
+
+    /// @brief Solves with a conductance from every node to ground, starting
+    ///        large and divided down after each success, and more gently after
+    ///        each failure, as SPICE's dynamic gmin stepping does
+    bool gminStepping(SolutionHistory<T> & solution, size_t & iterations) {
+        constexpr T startGmin = 1e-2;
+        constexpr T finalGmin = 1e-12;
+        constexpr T minFactor = 1.00005;
+        T gmin = startGmin;
+        T factor = 10;
+        T lastGmin = 0;
+        SolutionHistory<T> lastSolution = solution;
+        while (true) {
+            if (newtonRaphson(solution, 1, gmin, zero, maxStepIterations,
+                              iterations)) {
+                if (gmin <= finalGmin) {
+                    break;
+                }
+                lastSolution = solution;
+                lastGmin = gmin;
+                factor = std::min(factor * std::sqrt(factor), T(10));
+                gmin = std::max(gmin / factor, finalGmin);
+            } else {
+                if (lastGmin == 0) {
+                    return false;
+                }
+                factor = std::sqrt(factor);
+                if (factor < minFactor) {
+                    return false;
+                }
+                solution = lastSolution;
+                gmin = lastGmin / factor;
+            }
+        }
+        return newtonRaphson(solution, 1, 0, zero, maxIterations, iterations);
+    }
+
+    /// @brief Ramps the sources up from zero, where every unknown is zero,
+    ///        lengthening the ramp's steps after each success and shortening
+    ///        them after each failure
+    bool sourceStepping(SolutionHistory<T> & solution, size_t & iterations) {
+        constexpr T minStep = 1e-4;
+        T scale = 0;
+        T step = 0.1;
+        SolutionHistory<T> lastSolution = solution;
+        while (scale < 1) {
+            const T nextScale = std::min(scale + step, T(1));
+            if (newtonRaphson(solution, nextScale, 0, zero, maxStepIterations,
+                              iterations)) {
+                lastSolution = solution;
+                scale = nextScale;
+                step *= 2;
+            } else {
+                solution = lastSolution;
+                step /= 4;
+                if (step < minStep) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /// @brief Backward Euler through pseudo-time, with a unit capacitance from
+    ///        every node to ground. The timestep grows after each success until
+    ///        the capacitances no longer matter, and shrinks after each
+    ///        failure.
+    bool pseudoTransient(SolutionHistory<T> & solution, size_t & iterations) {
+        // the conductances of the capacitances' companion models, 1 / timestep
+        constexpr T startConductance = 1e2;
+        constexpr T finalConductance = 1e-9;
+        constexpr T maxConductance = 1e9;
+        T conductance = startConductance;
+        SolutionHistory<T> lastSolution = solution;
+        while (conductance > finalConductance) {
+            if (newtonRaphson(solution, 1, conductance, lastSolution,
+                              maxStepIterations, iterations)) {
+                lastSolution = solution;
+                conductance /= 4;
+            } else {
+                solution = lastSolution;
+                conductance *= 8;
+                if (conductance > maxConductance) {
+                    return false;
+                }
+            }
+        }
+        return newtonRaphson(solution, 1, 0, zero, maxIterations, iterations);
+    }
+};
+
+#endif
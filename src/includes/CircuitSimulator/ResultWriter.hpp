@@ -0,0 +1,243 @@
+#ifndef _RESULTWRITER_HPP_INC_
+#define _RESULTWRITER_HPP_INC_
+#include "CircuitSimulator/Waveform.hpp"
+#include "Maths/SPSCQueue.hpp"
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// @brief The formats of the output file
+enum class OutputFormat {
+    /// @brief Tab separated text, one row per step
+    Text,
+    /// @brief The binary columnar waveform format, with 64 or 32 bit values
+    Float64,
+    Float32,
+};
+
+/// @brief Parses the argument of the .outputFormat netlist directive
+///
+/// @param name The name of the format, e.g. "float64"
+/// @param format Set to the matching format if one is found
+///
+/// @return true if the name was recognised
+inline bool parseOutputFormat(const std::string & name, OutputFormat & format) {
+    if (name == "text") {
+        format = OutputFormat::Text;
+    } else if (name == "float64") {
+        format = OutputFormat::Float64;
+    } else if (name == "float32") {
+        format = OutputFormat::Float32;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// @brief Writes the simulation's steps to the output file on a thread of its
+///        own, as the simulation produces them.
+///
+/// @details The steps are copied into blocks of stepsPerBlock rows. A full
+///          block is handed to the writer thread through an SPSCQueue, and the
+///          simulation carries on filling the next one while the thread
+///          formats and writes it, then hands it back through a second queue.
+///          With the default of four blocks the simulation can run three
+///          blocks ahead of the writer; if the writer falls further behind
+///          than that, write waits for a block to be handed back, which is
+///          counted in stalls. finish writes the last, partly filled block and
+///          waits for the thread.
+///          \n\n
+///          As text, each value is formatted with std::to_chars to 9
+///          significant digits, the same text as iostream's
+///          std::setprecision(9). As a waveform, each block is written as a
+///          chunk, and finish writes the chunk index.
+///
+/// @tparam T The value type
+template<typename T>
+class ResultWriter {
+public:
+    /// @brief The rows in each block
+    static constexpr size_t stepsPerBlock = 1024;
+
+    /// @param path The output file, overwritten
+    /// @param columns The names of the columns after the time
+    /// @param units The unit of each of those columns, kept by the waveform
+    ///              format
+    /// @param timestep The netlist's timestep, kept by the waveform format
+    /// @param format The format of the file
+    /// @param numBlocks The blocks shared between the simulation and the
+    ///                  writer thread, at least two
+    ResultWriter(const std::string & path, const std::vector<std::string> & columns,
+                 const std::vector<std::string> & units, double timestep,
+                 OutputFormat format = OutputFormat::Text, size_t numBlocks = 4)
+        : format(format),
+          file(path, format == OutputFormat::Text ? std::ofstream::out
+                                                  : std::ofstream::binary),
+          width(columns.size()), blocks(std::max<size_t>(numBlocks, 2)),
+          filled(blocks.size() + 1), empty(blocks.size()) {
+        if (format == OutputFormat::Text) {
+            file << "time";
+            for (const auto & column : columns) {
+                file << "\t" << column;
+            }
+        } else {
+            Waveform::writeHeader(file, format == OutputFormat::Float64 ? 8 : 4,
+                                  stepsPerBlock, timestep, columns, units);
+        }
+        for (size_t b = 0; b < blocks.size(); b++) {
+            blocks[b].times.resize(stepsPerBlock);
+            blocks[b].values.resize(stepsPerBlock * width);
+            if (b > 0) {
+                empty.push(b);
+            }
+        }
+        writer = std::thread([this] { writerLoop(); });
+    }
+
+    ResultWriter(const ResultWriter &) = delete;
+    ResultWriter & operator=(const ResultWriter &) = delete;
+
+    ~ResultWriter() {
+        finish();
+    }
+
+    /// @brief Queues a step to be written
+    ///
+    /// @param time The time of the step
+    /// @param values The step's value for each column
+    void write(double time, const T * values) {
+        Block & block = blocks[current];
+        block.times[block.rows] = time;
+        std::copy(values, values + width, block.values.begin() + block.rows * width);
+        if (++block.rows == stepsPerBlock) {
+            filled.push(current);
+            if (!empty.tryPop(current)) {
+                stalls++;
+                current = empty.pop();
+            }
+        }
+    }
+
+    /// @brief Writes the steps still queued, and closes the file
+    void finish() {
+        if (!writer.joinable()) {
+            return;
+        }
+        if (blocks[current].rows > 0) {
+            filled.push(current);
+        }
+        filled.push(endOfStream);
+        writer.join();
+        if (format != OutputFormat::Text) {
+            Waveform::writeIndex(file, chunks);
+        }
+        file.close();
+    }
+
+    /// @brief The times write waited for the writer thread to hand back a block
+    size_t stalls = 0;
+
+private:
+    struct Block {
+        std::vector<double> times;
+        std::vector<T> values;
+        size_t rows = 0;
+    };
+
+    /// @brief Sent through filled after the last block
+    static constexpr size_t endOfStream = ~size_t(0);
+    /// @brief The most characters a value takes to 9 significant digits, e.g.
+    ///        -1.23456789e-308, with its separator
+    static constexpr size_t maxValueLength = 24;
+
+    OutputFormat format;
+    std::ofstream file;
+    size_t width;
+    std::vector<Block> blocks;
+    /// @brief The indices of the blocks ready to be written, and of those
+    ///        written and ready to be filled again
+    SPSCQueue<size_t> filled;
+    SPSCQueue<size_t> empty;
+    /// @brief The block being filled
+    size_t current = 0;
+    /// @brief The waveform's chunk index, and the rows written so far
+    std::vector<Waveform::Chunk> chunks;
+    size_t rowsWritten = 0;
+    std::thread writer;
+
+    void writerLoop() {
+        std::vector<char> text;
+        if (format == OutputFormat::Text) {
+            text.resize(stepsPerBlock * (width + 1) * maxValueLength);
+        }
+        while (true) {
+            const size_t b = filled.pop();
+            if (b == endOfStream) {
+                break;
+            }
+            Block & block = blocks[b];
+            switch (format) {
+                case OutputFormat::Text:
+                    writeText(block, text);
+                    break;
+                case OutputFormat::Float64:
+                    writeChunk<double>(block);
+                    break;
+                case OutputFormat::Float32:
+                    writeChunk<float>(block);
+                    break;
+            }
+            rowsWritten += block.rows;
+            block.rows = 0;
+            empty.push(b);
+        }
+    }
+
+    void writeText(const Block & block, std::vector<char> & text) {
+        char * out = text.data();
+        char * end = text.data() + text.size();
+        for (size_t row = 0; row < block.rows; row++) {
+            *out++ = '\n';
+            out = std::to_chars(out, end, block.times[row],
+                                std::chars_format::general, 9)
+                      .ptr;
+            for (size_t k = 0; k < width; k++) {
+                *out++ = '\t';
+                out = std::to_chars(out, end, block.values[row * width + k],
+                                    std::chars_format::general, 9)
+                          .ptr;
+            }
+        }
+        file.write(text.data(), out - text.data());
+    }
+
+    /// @brief Writes a block as a waveform chunk: the times, then each column
+    ///
+    /// @tparam V The type the values are stored as
+    template<typename V>
+    void writeChunk(const Block & block) {
+        Waveform::Chunk chunk;
+        chunk.offset = file.tellp();
+        chunk.firstRow = rowsWritten;
+        chunk.rows = block.rows;
+        chunk.firstTime = block.times[0];
+        chunk.lastTime = block.times[block.rows - 1];
+        chunks.push_back(chunk);
+
+        file.write(reinterpret_cast<const char *>(block.times.data()),
+                   block.rows * sizeof(double));
+        std::vector<V> column(block.rows);
+        for (size_t k = 0; k < width; k++) {
+            for (size_t row = 0; row < block.rows; row++) {
+                column[row] = static_cast<V>(block.values[row * width + k]);
+            }
+            file.write(reinterpret_cast<const char *>(column.data()),
+                       block.rows * sizeof(V));
+        }
+    }
+};
+
+#endif
@@ -6,7 +6,11 @@
 #endif
 
 #include "CircuitElements/CircuitElements.hpp"
+#include "CircuitSimulator/DCOperatingPoint.hpp"
+#include "CircuitSimulator/ResultWriter.hpp"
 #include "Maths/DynamicMatrix.hpp"
+#include "Maths/LinearSolver.hpp"
+#include "Maths/SolutionHistory.hpp"
 
 #ifdef WITH_MATLAB
 #include "MatlabEngine.hpp"
@@ -18,6 +22,7 @@
 #include <regex>
 #include <iostream>
 #include <fstream>
+#include <memory>
 
 /// @brief The first character of each line for each component type
 enum class LineType {
@@ -39,6 +44,71 @@ enum class SourceType {
     Sinusoidal = 'S',
 };
 
+/// @brief How the starting point of each step's Newton-Raphson iteration is
+///        predicted. The value is the number of earlier solutions used.
+enum class Predictor {
+    /// @brief Start from zero
+    None = 0,
+    /// @brief Start from the last solution
+    Previous = 1,
+    /// @brief Extrapolate the line through the last two solutions
+    Linear = 2,
+    /// @brief Extrapolate the parabola through the last three solutions
+    Quadratic = 3,
+};
+
+/// @brief Parses the argument of the .predictor netlist directive
+///
+/// @param name The name of the predictor, e.g. "linear"
+/// @param predictor Set to the matching predictor if one is found
+///
+/// @return true if the name was recognised
+inline bool parsePredictor(const std::string & name, Predictor & predictor) {
+    if (name == "none") {
+        predictor = Predictor::None;
+    } else if (name == "previous") {
+        predictor = Predictor::Previous;
+    } else if (name == "linear") {
+        predictor = Predictor::Linear;
+    } else if (name == "quadratic") {
+        predictor = Predictor::Quadratic;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// @brief How the Newton-Raphson iteration gets the Jacobian it solves with
+enum class JacobianPolicy {
+    /// @brief Refactorise the Jacobian on every iteration
+    Newton,
+    /// @brief Keep the last factorisation across iterations and steps
+    Chord,
+    /// @brief As Chord, correcting the kept factorisation within each step with
+    ///        Broyden's rank one updates
+    Broyden,
+};
+
+/// @brief Parses the argument of the .jacobian netlist directive
+///
+/// @param name The name of the policy, e.g. "chord"
+/// @param policy Set to the matching policy if one is found
+///
+/// @return true if the name was recognised
+inline bool parseJacobianPolicy(const std::string & name,
+                                JacobianPolicy & policy) {
+    if (name == "newton") {
+        policy = JacobianPolicy::Newton;
+    } else if (name == "chord") {
+        policy = JacobianPolicy::Chord;
+    } else if (name == "broyden") {
+        policy = JacobianPolicy::Broyden;
+    } else {
+        return false;
+    }
+    return true;
+}
+
 /// @brief The main class to hold all of the relevant simulation data
 ///
 /// @tparam VT The type used for values. e.g. double, float, etc
@@ -50,8 +120,8 @@ public:
     /// @param netlistPath Path to the netlist that is going to be used in the
     /// simulation
     SimulationEnvironment(std::string netlistPath)
-        : netlistPath(netlistPath), luPair(0), scratchSpace(0, 0),
-          solutionMat(0, 0) {
+        : netlistPath(netlistPath), iterate(0, 0), residual(0, 0),
+          broydenSteps(0, 0), solutionMat(0, 0) {
 #ifdef WITH_MATLAB
         matlabDesktop = matlab::engine::findMATLAB().size() > 0;
         matlabEngine = matlab::engine::connectMATLAB();
@@ -65,6 +135,17 @@ public:
         std::regex graphRegex(R"(^\.graph\((.+?)\)\s?$)");
         std::regex noDCRegex(R"(^\.nodc\s?$)");
         std::regex outputFileRegex(R"(^\.outputFile\(\s*['"](.+?)['"]\s*\)\s?$)");
+        std::regex solverRegex(R"(^\.solver\(\s*(\w+)\s*\)\s?$)");
+        std::regex orderingRegex(R"(^\.ordering\(\s*(\w+)\s*\)\s?$)");
+        std::regex precisionRegex(R"(^\.precision\(\s*(\w+)\s*\)\s?$)");
+        std::regex preconditionerRegex(
+            R"(^\.preconditioner\(\s*(\w+)\s*\)\s?$)");
+        std::regex bypassRegex(R"(^\.bypass(?:\((.+?),(.+?),(.+?)\))?\s?$)");
+        std::regex predictorRegex(R"(^\.predictor\(\s*(\w+)\s*\)\s?$)");
+        std::regex jacobianRegex(R"(^\.jacobian\(\s*(\w+)\s*\)\s?$)");
+        std::regex adaptiveRegex(R"(^\.adaptive(?:\((.+?),(.+?),(.+?)\))?\s?$)");
+        std::regex historyRegex(R"(^\.history\(\s*(\w+)\s*\)\s?$)");
+        std::regex outputFormatRegex(R"(^\.outputFormat\(\s*(\w+)\s*\)\s?$)");
         std::smatch matches;
 
         while (!netlist.eof()) {
@@ -196,6 +277,109 @@ public:
                         break;
                     }
 
+                    std::regex_match(line, matches, solverRegex);
+                    if (matches.size()) {
+                        if (!parseSolverType(matches.str(1), solverType)) {
+                            std::cout << "Unknown solver: " << matches.str(1)
+                                      << std::endl;
+                        }
+                        break;
+                    }
+
+                    std::regex_match(line, matches, orderingRegex);
+                    if (matches.size()) {
+                        if (!parseOrdering(matches.str(1), ordering)) {
+                            std::cout << "Unknown ordering: " << matches.str(1)
+                                      << std::endl;
+                        }
+                        break;
+                    }
+
+                    std::regex_match(line, matches, precisionRegex);
+                    if (matches.size()) {
+                        if (!parsePrecision(matches.str(1), precision)) {
+                            std::cout << "Unknown precision: " << matches.str(1)
+                                      << std::endl;
+                        }
+                        break;
+                    }
+
+                    std::regex_match(line, matches, preconditionerRegex);
+                    if (matches.size()) {
+                        if (!parsePreconditioner(matches.str(1), preconditioner)) {
+                            std::cout << "Unknown preconditioner: "
+                                      << matches.str(1) << std::endl;
+                        }
+                        break;
+                    }
+
+                    std::regex_match(line, matches, bypassRegex);
+                    if (matches.size()) {
+                        elements.bypass.enabled = true;
+                        if (matches[1].matched) {
+                            elements.bypass.relativeTolerance =
+                                std::stod(matches.str(1));
+                            elements.bypass.voltageTolerance =
+                                std::stod(matches.str(2));
+                            elements.bypass.currentTolerance =
+                                std::stod(matches.str(3));
+                        }
+                        break;
+                    }
+
+                    std::regex_match(line, matches, predictorRegex);
+                    if (matches.size()) {
+                        if (!parsePredictor(matches.str(1), predictor)) {
+                            std::cout << "Unknown predictor: " << matches.str(1)
+                                      << std::endl;
+                        }
+                        break;
+                    }
+
+                    std::regex_match(line, matches, jacobianRegex);
+                    if (matches.size()) {
+                        if (!parseJacobianPolicy(matches.str(1), jacobianPolicy)) {
+                            std::cout << "Unknown Jacobian policy: "
+                                      << matches.str(1) << std::endl;
+                        }
+                        break;
+                    }
+
+                    std::regex_match(line, matches, adaptiveRegex);
+                    if (matches.size()) {
+                        adaptiveTimestep = true;
+                        if (matches[1].matched) {
+                            truncationControl.relativeTolerance =
+                                std::stod(matches.str(1));
+                            truncationControl.absoluteTolerance =
+                                std::stod(matches.str(2));
+                            maximumTimestep = std::stod(matches.str(3));
+                        }
+                        break;
+                    }
+
+                    std::regex_match(line, matches, outputFormatRegex);
+                    if (matches.size()) {
+                        if (!parseOutputFormat(matches.str(1), outputFormat)) {
+                            std::cout << "Unknown output format: "
+                                      << matches.str(1) << std::endl;
+                        }
+                        break;
+                    }
+
+                    std::regex_match(line, matches, historyRegex);
+                    if (matches.size()) {
+                        if (matches.str(1) == "full") {
+                            keepAllSteps = true;
+                        } else if (matches.str(1) == "window") {
+                            keepAllSteps = false;
+                        } else {
+                            std::cout << "Unknown history: " << matches.str(1)
+                                      << std::endl;
+                        }
+                        break;
+                    }
+
                     std::cout << "Unsupported Directive" << std::endl;
 
                     break;
@@ -206,10 +390,18 @@ public:
 
         size_t sizeMat = elements.staticStamp.G.M;
 
-        solutionMat = Matrix<VT>(sizeMat, steps, 0);
+        times.resize(steps);
+        for (size_t n = 0; n < steps; n++) {
+            times[n] = n * timestep;
+        }
 
-        luPair = LUPair<VT>(sizeMat);
-        scratchSpace = Matrix<VT>(sizeMat, 1);
+        solver = LinearSolver<VT>(sizeMat, solverType, ordering, precision,
+                                  preconditioner);
+        iterate = Matrix<VT>(sizeMat, 1);
+        residual = Matrix<VT>(sizeMat, 1);
+        if (jacobianPolicy == JacobianPolicy::Broyden) {
+            broydenSteps = Matrix<VT>(sizeMat, maxBroydenSteps);
+        }
 
         for (auto & comp : elements.staticElements) {
             comp->setTimestep(timestep);
@@ -221,6 +413,26 @@ public:
             comp->setTimestep(timestep);
         }
 
+        if (adaptiveTimestep && elements.requiresFixedTimestep()) {
+            std::cout << "Adaptive timestep disabled: the netlist has components "
+                         "that need a fixed timestep"
+                      << std::endl;
+            adaptiveTimestep = false;
+        }
+
+        // the graphs and MATLAB are given the whole run once it's over
+        keepAllSteps = keepAllSteps || !nodesToGraph.empty();
+#ifdef WITH_MATLAB
+        keepAllSteps = keepAllSteps || matlabDesktop;
+#endif
+        if (keepAllSteps) {
+            solutionMat = SolutionHistory<VT>(sizeMat, steps);
+        } else {
+            solutionMat = SolutionHistory<VT>::window(
+                sizeMat, std::max(static_cast<size_t>(predictor),
+                                  elements.historyDepth()));
+        }
+
         if (performDCAnalysis) {
             setDCOpPoint();
         }
@@ -228,20 +440,25 @@ public:
 
     /// @brief a function to determine and set the DC operating point
     void setDCOpPoint() {
-        Matrix<VT> dcSoln = Matrix<VT>(solutionMat.M + numDCCurrents, 1);
-        Matrix<VT> scratchSpace = Matrix<VT>(solutionMat.M + numDCCurrents, 1);
-        LUPair<VT> luPair = LUPair<VT>(solutionMat.M + numDCCurrents);
+        SolutionHistory<VT> dcSoln(solutionMat.M + numDCCurrents, 1);
+        // the DC stamp is rebuilt from scratch each iteration, so there is no
+        // linear part to keep for the Schur and Woodbury solvers
+        SolverType dcSolverType = solverType;
+        if (dcSolverType == SolverType::Schur ||
+            dcSolverType == SolverType::Woodbury) {
+            dcSolverType = SolverType::Sparse;
+        }
+        LinearSolver<VT> dcSolver(solutionMat.M + numDCCurrents, dcSolverType,
+                                  ordering, precision, preconditioner);
 
         auto simStartTime = std::chrono::high_resolution_clock::now();
-        for (size_t nr = 0; nr < 35; nr++) {
-            auto & stamp = elements.generateDCStamp(dcSoln, numCurrents);
-            stamp.G.luPair(luPair);
-            stamp.G.leftDivide(stamp.s, luPair, scratchSpace, dcSoln);
+        DCOperatingPoint<VT> dcOperatingPoint(elements, dcSolver, numCurrents);
+        if (!dcOperatingPoint.solve(dcSoln)) {
+            std::cout << "DC OP did not converge" << std::endl;
         }
 
-        for (size_t k = 0; k < solutionMat.M; k++) {
-            solutionMat(k, 0) = dcSoln(k, 0);
-        }
+        std::copy(dcSoln.step(0), dcSoln.step(0) + solutionMat.M,
+                  solutionMat.step(0));
 
         elements.updateDCStoredState(dcSoln, numCurrents);
 
@@ -253,60 +470,44 @@ public:
 
         std::cout << "DC OP in: " << timeTaken * 1e-6 << " ms (" << timeTaken
                   << " ns)" << std::endl;
+        if (elements.hasNonLinearElements()) {
+            std::cout << dcOperatingPoint.report() << std::endl;
+        }
     }
 
     /// @brief Where a lot of the magic starts. This is what runs the simulation
     ///
-    /// @details This function is a simple newton-raphson solver, it still has room
-    ///          for improvement, such as early termination when the loop converges.
+    /// @details Each step is solved by newtonRaphson. By default every step is
+    ///          the netlist's timestep; the .adaptive directive instead chooses
+    ///          each step from the truncation error, see simulateAdaptive.
     ///          \n\n
-    ///          After the simulation has run to completion, the raw data is dumped,
-    ///          and any graphs that were due to be generated are created.
+    ///          Each step is written out as it's accepted, so only the window of
+    ///          steps the components and predictor read need be kept; see
+    ///          keepAllSteps. After the simulation has run to completion, any
+    ///          graphs that were due to be generated are created.
     void simulate() {
-        constexpr VT convergedThreshold = 1e-12;
-        constexpr size_t maxNR = 32;
         Matrix<VT> tempSoln = Matrix<VT>(solutionMat.M, 1);
-        VT maxDiff;
-        VT singleVarDiff;
         auto simStartTime = std::chrono::high_resolution_clock::now();
-        for (size_t n = 1; n < steps; n++) {
-            size_t nr;
-            for (nr = 0; nr < maxNR; nr++) {
-                auto & stamp = elements.generateNonLinearStamp(solutionMat, n,
-                                                               timestep);
-                stamp.G.luPair(luPair);
-                stamp.G.leftDivide(stamp.s, luPair, scratchSpace, tempSoln);
-
-                maxDiff = 0;
-                for (size_t k = 0; k < solutionMat.M; k++) {
-                    singleVarDiff = std::abs(solutionMat(k, n) - tempSoln(k, 0));
-                    maxDiff = std::max(maxDiff, singleVarDiff);
-                }
+        if (solver.type == SolverType::Schur ||
+            solver.type == SolverType::Woodbury) {
+            solver.setNonLinearUnknowns(
+                elements.findNonLinearUnknowns(solutionMat, 1, timestep));
+        }
+        startOutput();
+        writeStep(0);
+        if (adaptiveTimestep) {
+            simulateAdaptive(tempSoln);
+        } else {
+            for (size_t n = 1; n < steps; n++) {
+                elements.setTime(times[n]);
+                solveStep(n, timestep, n, tempSoln);
 
-                for (size_t k = 0; k < solutionMat.M; k++) {
-#ifdef _DEBUG
-                    if (std::isnan(tempSoln(k, 0))) {
-                        std::cout << "Simulation Error: NaN found in solution"
-                                  << std::endl;
-                    }
-#endif
-                    solutionMat(k, n) = tempSoln(k, 0);
-                }
-                if (maxDiff < convergedThreshold) {
-                    break;
+                elements.updateTimeStep(solutionMat, n, timestep);
+                writeStep(n);
+                if (n == 1) {
+                    // for VF s-param model update
+                    elements.staticStampIsFresh = false;
                 }
-                elements.nonLinearStampIsFresh = false;
-            }
-
-#ifdef _DEBUG
-            if (nr < maxNR) {
-                std::cout << "NR terminated at: " << nr << " steps" << std::endl;
-            }
-#endif
-
-            elements.updateTimeStep(solutionMat, n, timestep);
-            if (n == 1) {
-                elements.staticStampIsFresh = false; // for VF s-param model update
             }
         }
         auto simEndTime = std::chrono::high_resolution_clock::now();
@@ -315,6 +516,22 @@ public:
                              .count();
         // std::cout << "Time taken for simulation: " << timeTaken << std::endl;
         std::cout << timeTaken * 1e-6 << " ms (" << timeTaken << " ns)" << std::endl;
+        std::cout << solver.fillReport() << std::endl;
+        if (elements.bypass.enabled) {
+            std::cout << elements.bypassReport() << std::endl;
+        }
+        if (elements.hasNonLinearElements() && newtonSteps > 0) {
+            std::cout << "Newton-Raphson: "
+                      << double(newtonIterations) / newtonSteps
+                      << " iterations per step" << std::endl;
+            std::cout << "Jacobian: " << factorisations << " factorisations, "
+                      << factorisationsAvoided << " avoided" << std::endl;
+        }
+        if (adaptiveTimestep) {
+            std::cout << "Adaptive timestep: " << acceptedSteps
+                      << " steps accepted, " << rejectedSteps << " rejected"
+                      << std::endl;
+        }
         std::ofstream runtimeFile("RunTimes.txt", std::ofstream::app);
         runtimeFile << netlistPath << " " << timeTaken << std::endl;
 
@@ -338,7 +555,7 @@ public:
         std::vector<double> voltageNode(steps);
         for (size_t n = 0; n < steps; n++) {
             voltageNode[n] = solutionMat(node - 1, n);
-            timeVector[n] = n * timestep;
+            timeVector[n] = times[n];
         }
         // Set the size of output image to 1200x780 pixels
         plt::figure_size(1200, 780);
@@ -369,7 +586,7 @@ public:
             std::vector<double> voltageNode(steps);
             for (size_t n = 0; n < steps; n++) {
                 voltageNode[n] = solutionMat(node - 1, n);
-                timeVector[n] = n * timestep;
+                timeVector[n] = times[n];
             }
             // Set the size of output image to 1200x780 pixels
             // Plot line from given x and y data. Color is selected automatically.
@@ -387,78 +604,417 @@ public:
 #endif
     }
 
-    /// @brief Simple function to dump the output of the simulator in a matlab
-    ///        table readable format
+    /// @brief Starts the writer of the output file, one column per unknown
+    ///        after the time, in the format set by the .outputFormat directive.
+    ///        The text format is matlab table readable.
+    void startOutput() {
+        std::vector<std::string> columns;
+        std::vector<std::string> units;
+        for (int i = 1; i <= numNodes; i++) {
+            columns.emplace_back(std::string("n") + std::to_string(i));
+            units.emplace_back("V");
+        }
+        for (int i = 1; i <= numCurrents; i++) {
+            columns.emplace_back(std::string("i") + std::to_string(i));
+            units.emplace_back("A");
+        }
+        resultWriter = std::make_unique<ResultWriter<VT> >(outputFilePath, columns,
+                                                           units, timestep,
+                                                           outputFormat);
+    }
+
+    /// @brief Queues a step to be written to the output file. Steps are queued
+    ///        as they are accepted, before the history window moves past them.
+    void writeStep(size_t n) {
+        resultWriter->write(times[n], solutionMat.step(n));
+    }
+
+    /// @brief Finishes the output once the simulation is over: waits for the
+    ///        output file to be written, and gives the whole run to MATLAB if
+    ///        it's open
     void dataDump() {
+        resultWriter->finish();
+        if (resultWriter->stalls > 0) {
+            std::cout << "Output writer: the simulation waited for it "
+                      << resultWriter->stalls << " times" << std::endl;
+        }
+
 #ifdef WITH_MATLAB
+        if (!matlabDesktop) {
+            return;
+        }
         // Create matlab data array factory
         matlab::data::ArrayFactory factory;
 
         std::vector<std::string> varNames = {"t"};
-#endif
-
-        std::ofstream outputFile(outputFilePath);
-        outputFile << "time";
         for (int i = 1; i <= numNodes; i++) {
-            outputFile << "\t"
-                       << "n" << i;
-#ifdef WITH_MATLAB
-            if (matlabDesktop) {
-                varNames.emplace_back(std::string("n") + std::to_string(i));
-            }
-#endif
+            varNames.emplace_back(std::string("n") + std::to_string(i));
         }
-
         for (int i = 1; i <= numCurrents; i++) {
-            outputFile << "\t"
-                       << "i" << i;
-#ifdef WITH_MATLAB
-            if (matlabDesktop) {
-                varNames.emplace_back(std::string("i") + std::to_string(i));
+            varNames.emplace_back(std::string("i") + std::to_string(i));
+        }
+
+        auto sArray = factory.createStructArray({steps, 1}, varNames);
+        for (size_t n = 0; n < steps; n++) {
+            sArray[n][varNames[0]] = factory.createArray({1, 1}, {times[n]});
+            for (int i = 0; i < numNodes + numCurrents; i++) {
+                sArray[n][varNames[i + 1]] = factory
+                                                 .createArray({1, 1},
+                                                              {solutionMat(i, n)});
             }
-#endif
         }
 
-#ifdef WITH_MATLAB
-        auto sArray = factory.createStructArray({solutionMat.N, 1}, varNames);
+        matlabEngine->setVariable(u"solutionData", sArray,
+                                  matlab::engine::WorkspaceType::GLOBAL);
 #endif
-        for (size_t n = 0; n < solutionMat.N; n++) {
-            outputFile << std::endl;
-            outputFile << std::setprecision(9) << n * timestep;
+    }
+
+
+private:
 #ifdef WITH_MATLAB
-            if (matlabDesktop) {
-                sArray[n][varNames[0]] = factory.createArray({1, 1}, {n * timestep});
-            }
+    std::shared_ptr<matlab::engine::MATLABEngine> matlabEngine;
+    bool matlabDesktop = false;
 #endif
-            for (int i = 0; i < numNodes + numCurrents; i++) {
-                outputFile << "\t" << std::setprecision(9) << solutionMat(i, n);
-#ifdef WITH_MATLAB
-                if (matlabDesktop) {
-                    sArray[n][varNames[i + 1]] = factory
-                                                     .createArray({1, 1},
-                                                                  {solutionMat(i,
-                                                                               n)});
+
+
+    /// @brief Solves a time step by Newton-Raphson iteration, starting from the
+    ///        values already in its column of solutionMat.
+    ///
+    /// @details The iteration stops early once no unknown moves by more than
+    ///          convergedThreshold. The limited device models don't always get
+    ///          there, so the step counts as converged if the last iteration
+    ///          moved each unknown by less than SPICE's tolerances instead.
+    ///          \n\n
+    ///          The Chord and Broyden policies keep the last factorisation while
+    ///          each iteration moves the solution by at most maxContraction of
+    ///          the one before. Otherwise the rest of the step refactorises on
+    ///          every iteration, as does any iteration after the static or
+    ///          dynamic parts of G change.
+    ///
+    /// @param n The index of the step to solve
+    /// @param timestep The length of the step
+    /// @param tempSoln Space for the solution of each iteration
+    /// @param policy How the Jacobian is got
+    ///
+    /// @return Whether the iteration converged
+    bool newtonRaphson(size_t n, VT timestep, Matrix<VT> & tempSoln,
+                       JacobianPolicy policy) {
+        constexpr VT convergedThreshold = 1e-12;
+        constexpr VT relativeTolerance = 1e-3;
+        constexpr VT voltageTolerance = 1e-6;
+        constexpr VT currentTolerance = 1e-12;
+        constexpr size_t maxNR = 32;
+        // a linear circuit is solved exactly by a fresh factorisation
+        const bool mayReuse = policy != JacobianPolicy::Newton &&
+                              elements.hasNonLinearElements();
+        bool refactorise = false;
+        bool newtonForRestOfStep = false;
+        size_t broydenCount = 0;
+        VT lastDiff = 0;
+        VT maxDiff = 0;
+        VT singleVarDiff;
+        bool withinTolerance = false;
+        size_t nr;
+        for (nr = 0; nr < maxNR; nr++) {
+            auto & stamp = elements.generateNonLinearStamp(solutionMat, n, timestep);
+            bool reused = mayReuse && hasFactorisation && !refactorise &&
+                          !newtonForRestOfStep && !elements.linearGHasChanged;
+            if (reused) {
+                reused = reusedFactorisationStep(stamp, n, tempSoln,
+                                                 policy == JacobianPolicy::Broyden,
+                                                 broydenCount);
+            }
+            if (reused) {
+                if (elements.stampGHasChanged) {
+                    factorisationsAvoided++;
+                }
+            } else {
+                if (elements.stampGHasChanged) {
+                    solver.factorise(stamp.G, elements.linearGHasChanged);
+                    factorisations++;
+                    hasFactorisation = true;
+                    elements.stampGHasChanged = false;
+                    elements.linearGHasChanged = false;
+                }
+                solver.solve(stamp.s, tempSoln);
+                refactorise = false;
+                broydenCount = 0;
+            }
+
+            VT * solution = solutionMat.step(n);
+            maxDiff = 0;
+            withinTolerance = true;
+            for (size_t k = 0; k < solutionMat.M; k++) {
+                singleVarDiff = std::abs(solution[k] - tempSoln(k, 0));
+                maxDiff = std::max(maxDiff, singleVarDiff);
+                VT magnitude = std::max(std::abs(solution[k]),
+                                        std::abs(tempSoln(k, 0)));
+                VT tolerance = relativeTolerance * magnitude +
+                               (k < numNodes ? voltageTolerance : currentTolerance);
+                withinTolerance = withinTolerance && singleVarDiff <= tolerance;
+            }
+
+            if (policy == JacobianPolicy::Broyden && mayReuse) {
+                // the step just taken is the next Broyden update
+                VT norm = 0;
+                for (size_t k = 0; k < solutionMat.M; k++) {
+                    broydenSteps(k, broydenCount) = tempSoln(k, 0) -
+                                                    solution[k];
+                    norm += broydenSteps(k, broydenCount) *
+                            broydenSteps(k, broydenCount);
+                }
+                broydenNorms[broydenCount] = norm;
+                broydenCount++;
+                refactorise = refactorise || broydenCount == maxBroydenSteps ||
+                              norm == 0;
+            }
+            if (mayReuse) {
+                newtonForRestOfStep = newtonForRestOfStep ||
+                                      (reused && nr > 0 &&
+                                       maxDiff > maxContraction * lastDiff);
+                lastDiff = maxDiff;
+            }
+
+            for (size_t k = 0; k < solutionMat.M; k++) {
+#ifdef _DEBUG
+                if (std::isnan(tempSoln(k, 0))) {
+                    std::cout << "Simulation Error: NaN found in solution"
+                              << std::endl;
                 }
 #endif
+                solution[k] = tempSoln(k, 0);
             }
+            // a linear circuit is solved exactly by the first iteration
+            if (!elements.hasNonLinearElements()) {
+                withinTolerance = true;
+                break;
+            }
+            if (maxDiff < convergedThreshold) {
+                break;
+            }
+            elements.nonLinearStampIsFresh = false;
         }
-        outputFile.close();
+        newtonIterations += std::min(nr + 1, maxNR);
 
-#ifdef WITH_MATLAB
-        if (matlabDesktop) {
-            matlabEngine->setVariable(u"solutionData", sArray,
-                                      matlab::engine::WorkspaceType::GLOBAL);
+#ifdef _DEBUG
+        if (nr < maxNR) {
+            std::cout << "NR terminated at: " << nr << " steps" << std::endl;
         }
 #endif
+        return withinTolerance;
+    }
+
+    /// @brief Takes a Newton-Raphson iteration with the kept factorisation,
+    ///        leaving the new solution in tempSoln.
+    ///
+    /// @details The step solves J * step = s - G * x, where J is the matrix
+    ///          last factorised and x is column n of solutionMat. With broyden
+    ///          set, J is corrected by the rank one updates of the steps in
+    ///          broydenSteps, as in Kelley's brsola.
+    ///
+    /// @param stamp The stamp generated at column n
+    /// @param n The index of the step being solved
+    /// @param tempSoln Where the new solution is written
+    /// @param broyden Whether to apply the Broyden updates
+    /// @param broydenCount The number of steps in broydenSteps
+    ///
+    /// @return false if the Broyden update broke down, and nothing was written
+    bool reusedFactorisationStep(const Stamp<VT> & stamp, size_t n,
+                                 Matrix<VT> & tempSoln, bool broyden,
+                                 size_t broydenCount) {
+        const size_t M = solutionMat.M;
+        solutionMat.getStep(n, iterate);
+        stamp.G.multiply(iterate, residual);
+        for (size_t k = 0; k < M; k++) {
+            residual(k, 0) = stamp.s(k, 0) - residual(k, 0);
+        }
+        // the Krylov solvers start from dest
+        tempSoln.fill(0);
+        solver.solve(residual, tempSoln);
+
+        if (broyden && broydenCount > 0) {
+            for (size_t j = 0; j + 1 < broydenCount; j++) {
+                VT dot = 0;
+                for (size_t k = 0; k < M; k++) {
+                    dot += broydenSteps(k, j) * tempSoln(k, 0);
+                }
+                const VT scale = dot / broydenNorms[j];
+                for (size_t k = 0; k < M; k++) {
+                    tempSoln(k, 0) += scale * broydenSteps(k, j + 1);
+                }
+            }
+            const size_t last = broydenCount - 1;
+            VT dot = 0;
+            for (size_t k = 0; k < M; k++) {
+                dot += broydenSteps(k, last) * tempSoln(k, 0);
+            }
+            const VT denominator = 1 - dot / broydenNorms[last];
+            if (!(std::abs(denominator) > 1e-8)) {
+                return false;
+            }
+            for (size_t k = 0; k < M; k++) {
+                tempSoln(k, 0) /= denominator;
+            }
+        }
+
+        for (size_t k = 0; k < M; k++) {
+            tempSoln(k, 0) += iterate(k, 0);
+        }
+        return true;
     }
 
+    /// @brief Solves a time step, starting Newton-Raphson from the predicted
+    ///        solution.
+    ///
+    /// @details The device models only limit their junction voltages to a fixed
+    ///          bound, so a prediction beyond it can leave the iteration stuck.
+    ///          If it doesn't converge, the step is solved again from zero, with
+    ///          a fresh factorisation on every iteration.
+    ///
+    /// @param n The index of the step to solve. times[n] must be set.
+    /// @param timestep The length of the step
+    /// @param available See predict
+    /// @param tempSoln Space for the solution of each iteration
+    ///
+    /// @return Whether the iteration converged
+    bool solveStep(size_t n, VT timestep, size_t available,
+                   Matrix<VT> & tempSoln) {
+        newtonSteps++;
+        predict(n, available);
+        if (newtonRaphson(n, timestep, tempSoln, jacobianPolicy)) {
+            return true;
+        }
+        if (predictor == Predictor::None &&
+            jacobianPolicy == JacobianPolicy::Newton) {
+            return false;
+        }
+        std::fill(solutionMat.step(n), solutionMat.step(n) + solutionMat.M, VT(0));
+        return newtonRaphson(n, timestep, tempSoln, JacobianPolicy::Newton);
+    }
 
-private:
-#ifdef WITH_MATLAB
-    std::shared_ptr<matlab::engine::MATLABEngine> matlabEngine;
-    bool matlabDesktop = false;
-#endif
+    /// @brief Seeds column n of solutionMat, where newtonRaphson starts, by
+    ///        extrapolating the solutions before it with the Lagrange
+    ///        polynomial through them, as chosen by the .predictor directive.
+    ///
+    /// @param n The column to seed. times[n] must be set.
+    /// @param available How many of the columns just before n may be used. The
+    ///                  order of the polynomial is lowered to fit.
+    void predict(size_t n, size_t available) {
+        const double time = times[n];
+        const size_t points = std::min(static_cast<size_t>(predictor), available);
+        std::array<double, 3> weight = {};
+        for (size_t j = 0; j < points; j++) {
+            weight[j] = 1;
+            for (size_t i = 0; i < points; i++) {
+                if (i != j) {
+                    weight[j] *= (time - times[n - 1 - i]) /
+                                 (times[n - 1 - j] - times[n - 1 - i]);
+                }
+            }
+        }
+        std::array<const VT *, 3> before = {};
+        for (size_t j = 0; j < points; j++) {
+            before[j] = solutionMat.step(n - 1 - j);
+        }
+        VT * solution = solutionMat.step(n);
+        for (size_t k = 0; k < solutionMat.M; k++) {
+            VT guess = 0;
+            for (size_t j = 0; j < points; j++) {
+                guess += weight[j] * before[j][k];
+            }
+            solution[k] = guess;
+        }
+    }
+
+    /// @brief Runs the transient with the timestep chosen as it goes.
+    ///
+    /// @details Each step is first tried at the length suggested by the last
+    ///          one. It is rejected, and tried again shorter, if Newton-Raphson
+    ///          doesn't converge (an eighth of the length) or if the truncation
+    ///          error of a reactive component is over tolerance (the length
+    ///          that would meet it). An accepted step lets the next be up to
+    ///          twice as long. Steps are shortened to land on the components'
+    ///          breakpoints, after which the truncation error history starts
+    ///          again from the netlist's timestep. No step is longer than the
+    ///          .adaptive maximum, the components' maximumTimestep, or shorter
+    ///          than a millionth of the netlist's timestep.
+    ///          \n\n
+    ///          A full solutionMat grows as needed, and times records the time of
+    ///          each step.
+    ///
+    /// @param tempSoln Space for the solution of each iteration
+    void simulateAdaptive(Matrix<VT> & tempSoln) {
+        const double endTime = times[steps - 1];
+        const double minimumTimestep = timestep * 1e-6;
+        const double maxTimestep = std::min(maximumTimestep > 0 ? maximumTimestep
+                                                                : endTime / 50,
+                                            double(elements.maximumTimestep()));
+        times.assign(1, 0);
+        acceptedSteps = 0;
+        rejectedSteps = 0;
 
+        // the first accepted step of the current stretch without breakpoints
+        size_t historyStart = 0;
+        size_t n = 0;
+        double h = timestep;
+        while (times[n] < endTime - minimumTimestep) {
+            const double breakpoint = std::min<double>(
+                endTime, elements.nextBreakpoint(times[n] + minimumTimestep));
+            h = std::min(h, maxTimestep);
+            const bool reachesBreakpoint = times[n] + h >=
+                                           breakpoint - minimumTimestep;
+            if (reachesBreakpoint) {
+                h = breakpoint - times[n];
+            }
+
+            if (solutionMat.keepsAllSteps() && n + 1 >= solutionMat.N) {
+                solutionMat.resizeSteps(2 * solutionMat.N);
+            }
+            // the time of the step being tried, removed again if it's rejected
+            times.push_back(times[n] + h);
+            elements.setTime(times[n + 1]);
+            const bool converged = solveStep(n + 1, h, n - historyStart + 1,
+                                             tempSoln);
+
+            double errorTimestep = std::numeric_limits<double>::infinity();
+            if (converged) {
+                truncationControl.points = std::min<size_t>(n - historyStart + 2,
+                                                            4);
+                for (size_t k = 0; k < truncationControl.points; k++) {
+                    truncationControl.times[k] = times[n + 1 - k];
+                }
+                errorTimestep = elements.truncationErrorTimestep(solutionMat, n + 1,
+                                                                 truncationControl);
+            }
+
+            if (h > minimumTimestep &&
+                (!converged || errorTimestep < 0.9 * h)) {
+                rejectedSteps++;
+                times.pop_back();
+                h = std::max(converged ? errorTimestep : h / 8, minimumTimestep);
+                elements.dynamicStampIsFresh = false;
+                elements.nonLinearStampIsFresh = false;
+                continue;
+            }
+
+            elements.updateTimeStep(solutionMat, n + 1, h);
+            n++;
+            acceptedSteps++;
+            writeStep(n);
+
+            if (reachesBreakpoint) {
+                historyStart = n;
+                h = std::min<double>(errorTimestep, timestep);
+            } else {
+                h = std::min(2 * h, errorTimestep);
+            }
+        }
+
+        steps = n + 1;
+        if (solutionMat.keepsAllSteps()) {
+            solutionMat.resizeSteps(steps);
+        }
+    }
 
     /// @brief Helper function to pull indices from graph netlist directive
     ///
@@ -478,31 +1034,85 @@ private:
     }
 
     std::string outputFilePath = "datadump.txt";
+    /// @brief The format of the output file, set by the .outputFormat directive
+    OutputFormat outputFormat = OutputFormat::Text;
     std::string netlistPath = "";
 
     double initialTime;
     double timestep;
     double finalTime;
     size_t steps;
+    /// @brief The time of each column of solutionMat
+    std::vector<double> times;
+
+    /// @brief Whether the timestep is chosen from the truncation error, set by
+    ///        the .adaptive directive
+    bool adaptiveTimestep = false;
+    /// @brief The tolerances of the adaptive timestep
+    TruncationErrorControl<VT> truncationControl;
+    /// @brief The longest adaptive step, or 0 for a fiftieth of the simulation
+    double maximumTimestep = 0;
+    size_t acceptedSteps = 0;
+    size_t rejectedSteps = 0;
+    /// @brief How each step's Newton-Raphson iteration starts, set by the
+    ///        .predictor directive
+    Predictor predictor = Predictor::Linear;
+    /// @brief The linear solves taken by newtonRaphson, and the steps solved
+    size_t newtonIterations = 0;
+    size_t newtonSteps = 0;
+    /// @brief How newtonRaphson gets its Jacobian, set by the .jacobian directive
+    JacobianPolicy jacobianPolicy = JacobianPolicy::Newton;
+    /// @brief Whether solver holds a factorisation the policy can reuse
+    bool hasFactorisation = false;
+    /// @brief The factorisations made, and those a changed G didn't get because
+    ///        the policy kept the last one
+    size_t factorisations = 0;
+    size_t factorisationsAvoided = 0;
+    /// @brief Refactorise once an iteration with a kept factorisation moves the
+    ///        solution by more than this fraction of the one before
+    static constexpr VT maxContraction = 0.5;
+    /// @brief The most Broyden updates applied to a factorisation
+    static constexpr size_t maxBroydenSteps = 8;
+    /// @brief The iterate, and the residual of the MNA system at it
+    Matrix<VT> iterate;
+    Matrix<VT> residual;
+    /// @brief The steps of the current Broyden updates, one per column, and
+    ///        their squared norms
+    Matrix<VT> broydenSteps;
+    std::array<VT, maxBroydenSteps> broydenNorms = {};
 
     size_t numNodes = 1;
     size_t numCurrents = 0;
     size_t numDCCurrents = 0;
     bool performDCAnalysis = true;
+    /// @brief The method used to solve the MNA system, set by the .solver directive
+    SolverType solverType = SolverType::Sparse;
+    /// @brief The fill reducing ordering, set by the .ordering directive
+    Ordering ordering = Ordering::AMD;
+    /// @brief The precision of the dense factorisations, set by the .precision
+    ///        directive
+    Precision precision = Precision::Double;
+    /// @brief The preconditioner of the Krylov solvers, set by the
+    ///        .preconditioner directive
+    Preconditioner preconditioner = Preconditioner::ILUT;
     /// @brief A collection of all the circuit elements
     CircuitElements<VT> elements;
 
-    /// @brief Preallocated space to prevent repeated allocations and deallocations
-    LUPair<VT> luPair;
-    /// @brief Preallocated space to prevent repeated allocations and deallocations.
-    ///        using during the leftDivide to solve the MNA system
-    Matrix<VT> scratchSpace;
+    /// @brief Holds the factorisation of the MNA system, and the preallocated space
+    ///        used to solve it
+    LinearSolver<VT> solver;
 
     /// @brief Keeps track of the nodes to be graphed after simulation
     std::vector<std::vector<size_t> > nodesToGraph;
 
+    /// @brief Whether solutionMat keeps every step, set by the .history
+    ///        directive, the .graph directive or MATLAB, rather than the window
+    ///        the components and predictor read
+    bool keepAllSteps = false;
     /// @brief Preallocated space to store the results in
-    Matrix<VT> solutionMat;
+    SolutionHistory<VT> solutionMat;
+    /// @brief Writes the steps to the output file as they are accepted
+    std::unique_ptr<ResultWriter<VT> > resultWriter;
 };
 
 #endif
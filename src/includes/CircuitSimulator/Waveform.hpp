@@ -0,0 +1,255 @@
+#ifndef _WAVEFORM_HPP_INC_
+#define _WAVEFORM_HPP_INC_
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// @brief The binary columnar waveform format. See "Waveform Format.md" in
+///        the Datadumps folder for the layout.
+///
+/// @details Everything is little-endian, so the helpers here write and read
+///          the host's representation directly, which assumes a
+///          little-endian host.
+namespace Waveform {
+/// @brief The first bytes of a waveform file
+constexpr char magic[8] = {'C', 'S', 'W', 'F', 'O', 'R', 'M', '1'};
+/// @brief The last bytes of a complete waveform file, after the index
+constexpr char indexMagic[8] = {'C', 'S', 'W', 'F', 'I', 'N', 'D', 'X'};
+/// @brief The bytes of the trailer: the index's offset, the number of chunks
+///        and indexMagic
+constexpr size_t trailerSize = 24;
+
+/// @brief An entry of the chunk index
+struct Chunk {
+    /// @brief Where the chunk starts in the file
+    uint64_t offset = 0;
+    /// @brief The index of its first row, and its number of rows
+    uint64_t firstRow = 0;
+    uint64_t rows = 0;
+    /// @brief The time of its first and last rows
+    double firstTime = 0;
+    double lastTime = 0;
+};
+
+template<typename T>
+void writeValue(std::ostream & out, const T & value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+inline void writeString(std::ostream & out, const std::string & text) {
+    writeValue(out, static_cast<uint32_t>(text.size()));
+    out.write(text.data(), text.size());
+}
+
+template<typename T>
+T readValue(std::istream & in) {
+    T value;
+    in.read(reinterpret_cast<char *>(&value), sizeof(T));
+    return value;
+}
+
+inline std::string readString(std::istream & in) {
+    std::string text(readValue<uint32_t>(in), '\0');
+    in.read(text.data(), text.size());
+    return text;
+}
+
+/// @brief Writes the header
+///
+/// @param valueSize The bytes of each value, 8 for float64 or 4 for float32
+/// @param rowsPerChunk The rows of every chunk but the last
+/// @param timestep The netlist's timestep
+/// @param columns The names of the columns after the time
+/// @param units The unit of each of those columns
+inline void writeHeader(std::ostream & out, uint32_t valueSize,
+                        uint64_t rowsPerChunk, double timestep,
+                        const std::vector<std::string> & columns,
+                        const std::vector<std::string> & units) {
+    out.write(magic, sizeof(magic));
+    writeValue(out, valueSize);
+    writeValue(out, static_cast<uint32_t>(columns.size()));
+    writeValue(out, rowsPerChunk);
+    writeValue(out, timestep);
+    writeString(out, "time");
+    writeString(out, "s");
+    for (size_t k = 0; k < columns.size(); k++) {
+        writeString(out, columns[k]);
+        writeString(out, units[k]);
+    }
+}
+
+/// @brief Writes the chunk index and the trailer, which complete the file
+inline void writeIndex(std::ostream & out, const std::vector<Chunk> & chunks) {
+    const uint64_t indexOffset = out.tellp();
+    for (const auto & chunk : chunks) {
+        writeValue(out, chunk.offset);
+        writeValue(out, chunk.firstRow);
+        writeValue(out, chunk.rows);
+        writeValue(out, chunk.firstTime);
+        writeValue(out, chunk.lastTime);
+    }
+    writeValue(out, indexOffset);
+    writeValue(out, static_cast<uint64_t>(chunks.size()));
+    out.write(indexMagic, sizeof(indexMagic));
+}
+
+/// @brief Reads a waveform file. Only the header and the index are read when
+///        it's opened; read then seeks to the chunks it needs.
+class Reader {
+public:
+    /// @brief The names and units of the columns after the time
+    std::vector<std::string> columns;
+    std::vector<std::string> units;
+    /// @brief The netlist's timestep. The steps of an adaptive run vary.
+    double timestep = 0;
+    /// @brief The bytes of each value, 8 for float64 or 4 for float32
+    uint32_t valueSize = 8;
+    std::vector<Chunk> chunks;
+
+    /// @brief Opens a file, throwing std::runtime_error if it isn't a complete
+    ///        waveform file
+    explicit Reader(const std::string & path)
+        : file(path, std::ifstream::binary) {
+        char start[sizeof(magic)] = {};
+        file.read(start, sizeof(start));
+        if (!file || std::memcmp(start, magic, sizeof(magic)) != 0) {
+            throw std::runtime_error("Not a waveform file: " + path);
+        }
+        valueSize = readValue<uint32_t>(file);
+        const uint32_t numColumns = readValue<uint32_t>(file);
+        readValue<uint64_t>(file);
+        timestep = readValue<double>(file);
+        readString(file);
+        readString(file);
+        for (uint32_t k = 0; k < numColumns; k++) {
+            columns.emplace_back(readString(file));
+            units.emplace_back(readString(file));
+        }
+        if (!file || (valueSize != 8 && valueSize != 4)) {
+            throw std::runtime_error("Bad waveform header: " + path);
+        }
+
+        file.seekg(-static_cast<std::streamoff>(trailerSize), std::ifstream::end);
+        const uint64_t indexOffset = readValue<uint64_t>(file);
+        chunks.resize(readValue<uint64_t>(file));
+        char end[sizeof(indexMagic)] = {};
+        file.read(end, sizeof(end));
+        if (!file || std::memcmp(end, indexMagic, sizeof(indexMagic)) != 0) {
+            throw std::runtime_error("Waveform file has no index, was it "
+                                     "finished? " +
+                                     path);
+        }
+        file.seekg(indexOffset);
+        for (auto & chunk : chunks) {
+            chunk.offset = readValue<uint64_t>(file);
+            chunk.firstRow = readValue<uint64_t>(file);
+            chunk.rows = readValue<uint64_t>(file);
+            chunk.firstTime = readValue<double>(file);
+            chunk.lastTime = readValue<double>(file);
+        }
+    }
+
+    /// @brief The number of rows, i.e. steps
+    size_t rows() const {
+        return chunks.empty() ? 0 : chunks.back().firstRow + chunks.back().rows;
+    }
+
+    /// @brief The index of a column, e.g. "n3", or columns.size() if there is
+    ///        none
+    size_t columnIndex(const std::string & name) const {
+        return std::find(columns.begin(), columns.end(), name) - columns.begin();
+    }
+
+    /// @brief Reads a column over a time window, seeking to the chunks that
+    ///        overlap it
+    ///
+    /// @param column The index of the column
+    /// @param startTime The start of the window
+    /// @param endTime The end of the window
+    /// @param times Set to the time of each row in the window
+    /// @param values Set to the column's value at each of those times
+    void read(size_t column, double startTime, double endTime,
+              std::vector<double> & times, std::vector<double> & values) {
+        times.clear();
+        values.clear();
+        // the first chunk that ends in the window
+        auto chunk = std::lower_bound(chunks.begin(), chunks.end(), startTime,
+                                      [](const Chunk & c, double time) {
+                                          return c.lastTime < time;
+                                      });
+        std::vector<double> chunkTimes;
+        std::vector<double> chunkValues;
+        for (; chunk != chunks.end() && chunk->firstTime <= endTime; chunk++) {
+            readChunk(*chunk, column, chunkTimes, chunkValues);
+            for (size_t r = 0; r < chunk->rows; r++) {
+                if (startTime <= chunkTimes[r] && chunkTimes[r] <= endTime) {
+                    times.push_back(chunkTimes[r]);
+                    values.push_back(chunkValues[r]);
+                }
+            }
+        }
+    }
+
+    /// @brief Writes the whole file in the tab separated text format the
+    ///        simulator writes by default
+    void writeText(std::ostream & out) {
+        out << "time";
+        for (const auto & column : columns) {
+            out << "\t" << column;
+        }
+        std::vector<double> chunkTimes;
+        std::vector<std::vector<double> > chunkValues(columns.size());
+        char text[32];
+        auto write = [&](double value) {
+            out.write(text, std::to_chars(text, text + sizeof(text), value,
+                                          std::chars_format::general, 9)
+                                    .ptr -
+                                text);
+        };
+        for (const auto & chunk : chunks) {
+            for (size_t k = 0; k < columns.size(); k++) {
+                readChunk(chunk, k, chunkTimes, chunkValues[k]);
+            }
+            for (size_t r = 0; r < chunk.rows; r++) {
+                out << "\n";
+                write(chunkTimes[r]);
+                for (size_t k = 0; k < columns.size(); k++) {
+                    out << "\t";
+                    write(chunkValues[k][r]);
+                }
+            }
+        }
+    }
+
+private:
+    std::ifstream file;
+
+    /// @brief Reads the times of a chunk and one of its columns
+    void readChunk(const Chunk & chunk, size_t column, std::vector<double> & times,
+                   std::vector<double> & values) {
+        times.resize(chunk.rows);
+        values.resize(chunk.rows);
+        file.seekg(chunk.offset);
+        file.read(reinterpret_cast<char *>(times.data()), chunk.rows * 8);
+        file.seekg(chunk.offset + chunk.rows * (8 + column * valueSize));
+        if (valueSize == 8) {
+            file.read(reinterpret_cast<char *>(values.data()), chunk.rows * 8);
+        } else {
+            std::vector<float> single(chunk.rows);
+            file.read(reinterpret_cast<char *>(single.data()), chunk.rows * 4);
+            std::copy(single.begin(), single.end(), values.begin());
+        }
+        if (!file) {
+            throw std::runtime_error("Waveform file ends inside a chunk");
+        }
+    }
+};
+} // namespace Waveform
+
+#endif
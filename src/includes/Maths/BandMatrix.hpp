@@ -0,0 +1,194 @@
+#ifndef _BANDMATRIX_HPP_INC_
+#define _BANDMATRIX_HPP_INC_
+#include "Maths/DynamicMatrix.hpp"
+#include "Maths/SparseMatrix.hpp"
+#include "Maths/Ordering.hpp"
+
+/// @brief A banded LU factorisation with partial pivoting, for matrices whose
+///        entries (after a bandwidth reducing ordering) lie close to the
+///        diagonal, e.g. ladder and transmission line circuits.
+///
+/// @details The unknowns are first symmetrically permuted by a reverse
+///          Cuthill-McKee ordering. The band is stored by column as in LAPACK's
+///          gbtrf: entry (i, j) lives at band[(kl + ku + i - j) + j * ldab], with
+///          kl extra rows above the band to hold the fill row interchanges cause.
+///          The work is O(M * kl * (kl + ku)) rather than O(M^3).
+///
+/// @tparam T the value type
+template<typename T>
+struct BandLU {
+    using RealT = decltype(std::abs(std::declval<T>()));
+
+    size_t M = 0;
+    /// @brief The number of sub- and super-diagonals of the permuted matrix
+    size_t kl = 0;
+    size_t ku = 0;
+    /// @brief The leading dimension of the band storage, 2 * kl + ku + 1
+    size_t ldab = 1;
+    /// @brief Set if a zero pivot was encountered during the last factorisation
+    bool singular = false;
+
+    /// @brief order[k] is the original index of the k-th permuted unknown
+    std::vector<size_t> order;
+    std::vector<size_t> position;
+    std::vector<T> band;
+    /// @brief Row k was interchanged with row pivot[k]
+    std::vector<size_t> pivot;
+
+    /// @brief Factorises A, reordering it first if its pattern has changed
+    void factorise(const SparseMatrix<T> & A) {
+        assert(A.M == A.N);
+        if (A.pattern != analysedPattern || A.pattern->version != analysedVersion) {
+            analyse(A);
+        }
+
+        // scatter P * A * P^T into the band
+        std::fill(band.begin(), band.end(), 0);
+        const SparsityPattern & pat = *A.pattern;
+        size_t kv = kl + ku;
+        for (size_t m = 0; m < M; m++) {
+            size_t i = position[m];
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                size_t j = position[pat.column[k]];
+                band[kv + i - j + j * ldab] = A.data[k];
+            }
+        }
+
+        singular = false;
+        // the last column touched by row interchanges so far
+        size_t ju = 0;
+        for (size_t j = 0; j < M; j++) {
+            size_t km = std::min(kl, M - 1 - j);
+            T * col = &band[kv + j * ldab];
+
+            size_t jp = 0;
+            RealT maxV = std::abs(col[0]);
+            for (size_t i = 1; i <= km; i++) {
+                if (std::abs(col[i]) > maxV) {
+                    maxV = std::abs(col[i]);
+                    jp = i;
+                }
+            }
+            pivot[j] = j + jp;
+
+            if (col[jp] == T(0)) {
+                singular = true;
+                continue;
+            }
+
+            ju = std::max(ju, std::min(j + ku + jp, M - 1));
+            if (jp != 0) {
+                for (size_t c = j; c <= ju; c++) {
+                    std::swap(band[kv + j - c + c * ldab],
+                              band[kv + j + jp - c + c * ldab]);
+                }
+            }
+
+            if (km > 0) {
+                T inversePivot = T(1) / col[0];
+                for (size_t i = 1; i <= km; i++) {
+                    col[i] *= inversePivot;
+                }
+                for (size_t c = j + 1; c <= ju; c++) {
+                    T * target = &band[kv + j - c + c * ldab];
+                    T ujc = target[0];
+                    if (ujc == T(0)) {
+                        continue;
+                    }
+                    for (size_t i = 1; i <= km; i++) {
+                        target[i] -= col[i] * ujc;
+                    }
+                }
+            }
+        }
+    }
+
+    /// @brief Solves A * dest = rhs using the stored factorisation
+    void solve(const Matrix<T> & rhs, Matrix<T> & dest) const {
+        size_t kv = kl + ku;
+        for (size_t k = 0; k < M; k++) {
+            y[k] = rhs.data[order[k]];
+        }
+
+        // L * z = P * b
+        for (size_t j = 0; j < M; j++) {
+            if (pivot[j] != j) {
+                std::swap(y[j], y[pivot[j]]);
+            }
+            size_t km = std::min(kl, M - 1 - j);
+            const T * col = &band[kv + j * ldab];
+            T yj = y[j];
+            for (size_t i = 1; i <= km; i++) {
+                y[j + i] -= col[i] * yj;
+            }
+        }
+
+        // U * x = z, U has kl + ku super-diagonals
+        for (size_t j = M; j-- > 0;) {
+            const T * col = &band[kv + j * ldab];
+            y[j] /= col[0];
+            T yj = y[j];
+            size_t top = j > kv ? j - kv : 0;
+            for (size_t i = top; i < j; i++) {
+                y[i] -= band[kv + i - j + j * ldab] * yj;
+            }
+        }
+
+        for (size_t k = 0; k < M; k++) {
+            dest.data[order[k]] = y[k];
+        }
+    }
+
+    /// @brief The number of stored entries
+    size_t nnz() const {
+        return band.size();
+    }
+
+    /// @brief The bandwidths of the last analysed pattern in its natural order
+    size_t naturalKL = 0;
+    size_t naturalKU = 0;
+
+private:
+    std::shared_ptr<SparsityPattern> analysedPattern;
+    size_t analysedVersion = 0;
+    mutable std::vector<T> y;
+
+    void analyse(const SparseMatrix<T> & A) {
+        const SparsityPattern & pat = *A.pattern;
+        M = A.M;
+        order = reverseCuthillMcKee(M, pat.rowStart, pat.column);
+        position.resize(M);
+        for (size_t k = 0; k < M; k++) {
+            position[order[k]] = k;
+        }
+
+        kl = ku = naturalKL = naturalKU = 0;
+        for (size_t m = 0; m < M; m++) {
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                size_t n = pat.column[k];
+                size_t i = position[m];
+                size_t j = position[n];
+                if (i > j) {
+                    kl = std::max(kl, i - j);
+                } else {
+                    ku = std::max(ku, j - i);
+                }
+                if (m > n) {
+                    naturalKL = std::max(naturalKL, m - n);
+                } else {
+                    naturalKU = std::max(naturalKU, n - m);
+                }
+            }
+        }
+
+        ldab = 2 * kl + ku + 1;
+        band.assign(ldab * M, 0);
+        pivot.assign(M, 0);
+        y.assign(M, 0);
+
+        analysedPattern = A.pattern;
+        analysedVersion = pat.version;
+    }
+};
+
+#endif
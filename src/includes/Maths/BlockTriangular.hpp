@@ -0,0 +1,404 @@
+#ifndef _BLOCKTRIANGULAR_HPP_INC_
+#define _BLOCKTRIANGULAR_HPP_INC_
+#include "Maths/DynamicMatrix.hpp"
+#include "Maths/SparseMatrix.hpp"
+#include <iostream>
+
+/// @brief Finds a maximum transversal, i.e. a row for each column such that every
+///        matched entry is stored, so that permuting the rows gives a zero free
+///        diagonal. Uses depth first augmenting paths.
+///
+/// @param M The size of the (square) matrix
+/// @param colStart The column pointers of A (CSC)
+/// @param row The row indices of A (CSC)
+///
+/// @return matchRow[j], the row matched to column j, or npos for unmatched
+///         columns if A is structurally singular
+inline std::vector<size_t>
+maximumTransversal(size_t M, const std::vector<size_t> & colStart,
+                   const std::vector<size_t> & row) {
+    constexpr size_t npos = std::numeric_limits<size_t>::max();
+    std::vector<size_t> matchRow(M, npos);
+    std::vector<size_t> matchCol(M, npos);
+
+    // cheap pass, take an unmatched row where there is one
+    for (size_t j = 0; j < M; j++) {
+        for (size_t p = colStart[j]; p < colStart[j + 1]; p++) {
+            if (matchCol[row[p]] == npos) {
+                matchRow[j] = row[p];
+                matchCol[row[p]] = j;
+                break;
+            }
+        }
+    }
+
+    std::vector<size_t> visited(M, npos);
+    std::vector<size_t> stack;
+    std::vector<size_t> position(M);
+    for (size_t j0 = 0; j0 < M; j0++) {
+        if (matchRow[j0] != npos) {
+            continue;
+        }
+        // search for an augmenting path starting from column j0. The stack holds
+        // the path, each column reached through the row matched to it.
+        stack.assign(1, j0);
+        position[j0] = colStart[j0];
+        visited[j0] = j0;
+        size_t freeRow = npos;
+        while (!stack.empty() && freeRow == npos) {
+            size_t j = stack.back();
+            if (position[j] == colStart[j + 1]) {
+                stack.pop_back();
+                continue;
+            }
+            size_t i = row[position[j]++];
+            if (matchCol[i] == npos) {
+                freeRow = i;
+                break;
+            }
+            size_t next = matchCol[i];
+            if (visited[next] != j0) {
+                visited[next] = j0;
+                position[next] = colStart[next];
+                stack.emplace_back(next);
+            }
+        }
+        if (freeRow == npos) {
+            continue;
+        }
+        // flip the matching along the path
+        size_t i = freeRow;
+        for (size_t s = stack.size(); s-- > 0;) {
+            size_t j = stack[s];
+            size_t previousRow = matchRow[j];
+            matchRow[j] = i;
+            matchCol[i] = j;
+            i = previousRow;
+        }
+    }
+    return matchRow;
+}
+
+/// @brief An LU factorisation of a matrix permuted to block lower triangular
+///        form (BTF), so that only the diagonal blocks are factorised.
+///
+/// @details The rows are first permuted to put a nonzero on every diagonal
+///          entry (maximumTransversal). The strongly connected components of the
+///          resulting graph (found by Tarjan's algorithm) are then the diagonal
+///          blocks of a block triangular form, the Dulmage-Mendelsohn fine
+///          decomposition. Weakly coupled parts of a circuit, e.g. a bias network
+///          only driving the rest, end up in separate blocks.
+///          \n\n
+///          Each diagonal block has its own SparseLU (1x1 blocks are kept as
+///          scalars), and the off-diagonal blocks are only used in the block
+///          forward substitution. The blocks are independent of each other
+///          while factorising.
+///
+/// @tparam T the value type
+template<typename T>
+struct BlockTriangularLU {
+    static constexpr size_t npos = SparsityPattern::npos;
+
+    size_t M = 0;
+    /// @brief Set if any diagonal block is singular
+    bool singular = false;
+    /// @brief The ordering used within each diagonal block
+    Ordering ordering = Ordering::AMD;
+
+    /// @brief order[p] is the unknown in position p, whose equation is row
+    ///        matchRow[order[p]]. Block b covers positions
+    ///        [blockStart[b], blockStart[b + 1]).
+    std::vector<size_t> order;
+    std::vector<size_t> matchRow;
+    std::vector<size_t> blockStart;
+
+    /// @brief Factorises A, decomposing it again first if its pattern has changed
+    void factorise(const SparseMatrix<T> & A) {
+        assert(A.M == A.N);
+        if (A.pattern != analysedPattern || A.pattern->version != analysedVersion) {
+            analyse(A);
+        }
+
+        for (auto & block : blockMatrices) {
+            block.fill(0);
+        }
+        for (size_t k = 0; k < A.data.size(); k++) {
+            size_t b = slotBlock[k];
+            if (b == npos) {
+                offValues[slotTarget[k]] = A.data[k];
+            } else if (blockMatrices[b].M == 0) {
+                singletonValue[b] = A.data[k];
+            } else {
+                blockMatrices[b].data[slotTarget[k]] = A.data[k];
+            }
+        }
+
+        singular = false;
+        for (size_t b = 0; b < numBlocks(); b++) {
+            if (blockMatrices[b].M == 0) {
+                singular |= singletonValue[b] == T(0);
+            } else {
+                blockLU[b].factorise(blockMatrices[b]);
+                singular |= blockLU[b].singular;
+            }
+        }
+    }
+
+    /// @brief Solves A * dest = rhs using the stored factorisation
+    void solve(const Matrix<T> & rhs, Matrix<T> & dest) const {
+        for (size_t b = 0; b < numBlocks(); b++) {
+            // the block's right hand side, less the coupling to earlier blocks
+            for (size_t p = blockStart[b]; p < blockStart[b + 1]; p++) {
+                T val = rhs.data[matchRow[order[p]]];
+                for (size_t k = offRowStart[p]; k < offRowStart[p + 1]; k++) {
+                    val -= offValues[k] * x[offColumn[k]];
+                }
+                blockRHS.data[p - blockStart[b]] = val;
+            }
+
+            if (blockMatrices[b].M == 0) {
+                x[blockStart[b]] = blockRHS.data[0] / singletonValue[b];
+            } else {
+                blockLU[b].solve(blockRHS, x.begin() + blockStart[b]);
+            }
+        }
+
+        for (size_t p = 0; p < M; p++) {
+            dest.data[order[p]] = x[p];
+        }
+    }
+
+    size_t numBlocks() const {
+        return blockStart.empty() ? 0 : blockStart.size() - 1;
+    }
+
+    /// @brief The number of stored entries in the factors and off-diagonal blocks
+    size_t nnz() const {
+        size_t total = offValues.size();
+        for (size_t b = 0; b < numBlocks(); b++) {
+            total += blockMatrices[b].M == 0 ? 1 : blockLU[b].nnz();
+        }
+        return total;
+    }
+
+    size_t largestBlock() const {
+        size_t largest = 0;
+        for (size_t b = 0; b < numBlocks(); b++) {
+            largest = std::max(largest, blockStart[b + 1] - blockStart[b]);
+        }
+        return largest;
+    }
+
+private:
+    std::shared_ptr<SparsityPattern> analysedPattern;
+    size_t analysedVersion = 0;
+
+    /// @brief The diagonal blocks. 1x1 blocks are stored as an empty matrix and
+    ///        a value in singletonValue.
+    std::vector<SparseMatrix<T> > blockMatrices;
+    std::vector<SparseLU<T> > blockLU;
+    std::vector<T> singletonValue;
+
+    /// @brief The off-diagonal entries by row position (CSR), with their columns
+    ///        as positions
+    std::vector<size_t> offRowStart;
+    std::vector<size_t> offColumn;
+    std::vector<T> offValues;
+
+    /// @brief Where each stored entry of A goes: the block it is in (npos for
+    ///        off-diagonal entries), and its slot there
+    std::vector<size_t> slotBlock;
+    std::vector<size_t> slotTarget;
+
+    mutable std::vector<T> x;
+    mutable Matrix<T> blockRHS = Matrix<T>(0, 0);
+
+    void analyse(const SparseMatrix<T> & A) {
+        const SparsityPattern & pat = *A.pattern;
+        M = A.M;
+
+        // CSC copy of the pattern
+        std::vector<size_t> colStart(M + 1, 0);
+        std::vector<size_t> row(pat.nnz());
+        for (size_t c : pat.column) {
+            colStart[c + 1]++;
+        }
+        for (size_t n = 0; n < M; n++) {
+            colStart[n + 1] += colStart[n];
+        }
+        std::vector<size_t> next(colStart.begin(), colStart.end() - 1);
+        for (size_t m = 0; m < M; m++) {
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                row[next[pat.column[k]]++] = m;
+            }
+        }
+
+        matchRow = maximumTransversal(M, colStart, row);
+        std::vector<size_t> rowToColumn(M, npos);
+        bool structurallySingular = false;
+        for (size_t j = 0; j < M; j++) {
+            if (matchRow[j] == npos) {
+                structurallySingular = true;
+            } else {
+                rowToColumn[matchRow[j]] = j;
+            }
+        }
+
+        if (structurallySingular) {
+            // no block structure to exploit, factorise everything as one block
+            std::cout << "BTF: matrix is structurally singular, using a single block"
+                      << std::endl;
+            for (size_t j = 0; j < M; j++) {
+                matchRow[j] = j;
+            }
+            order.resize(M);
+            std::iota(order.begin(), order.end(), 0);
+            blockStart = {0, M};
+        } else {
+            findBlocks(pat, rowToColumn);
+        }
+
+        buildBlocks(pat, rowToColumn);
+
+        x.assign(M, 0);
+        blockRHS = Matrix<T>(std::max<size_t>(largestBlock(), 1), 1);
+        analysedPattern = A.pattern;
+        analysedVersion = pat.version;
+    }
+
+    /// @brief Tarjan's strongly connected components on the graph where unknown
+    ///        r depends on unknown c if the equation matched to r has an entry in
+    ///        column c. Components are emitted after everything they depend on,
+    ///        which gives the block lower triangular order directly.
+    void findBlocks(const SparsityPattern & pat,
+                    const std::vector<size_t> & rowToColumn) {
+        std::vector<size_t> index(M, npos);
+        std::vector<size_t> lowLink(M, 0);
+        std::vector<bool> onStack(M, false);
+        std::vector<size_t> componentStack;
+        std::vector<size_t> callStack;
+        std::vector<size_t> edgePosition(M);
+        size_t counter = 0;
+
+        order.clear();
+        blockStart.assign(1, 0);
+        for (size_t start = 0; start < M; start++) {
+            if (index[start] != npos) {
+                continue;
+            }
+            callStack.assign(1, start);
+            index[start] = lowLink[start] = counter++;
+            componentStack.emplace_back(start);
+            onStack[start] = true;
+            edgePosition[start] = pat.rowStart[matchRow[start]];
+
+            while (!callStack.empty()) {
+                size_t r = callStack.back();
+                size_t eqRow = matchRow[r];
+                if (edgePosition[r] < pat.rowStart[eqRow + 1]) {
+                    size_t c = pat.column[edgePosition[r]++];
+                    if (index[c] == npos) {
+                        index[c] = lowLink[c] = counter++;
+                        componentStack.emplace_back(c);
+                        onStack[c] = true;
+                        edgePosition[c] = pat.rowStart[matchRow[c]];
+                        callStack.emplace_back(c);
+                    } else if (onStack[c]) {
+                        lowLink[r] = std::min(lowLink[r], index[c]);
+                    }
+                    continue;
+                }
+
+                callStack.pop_back();
+                if (!callStack.empty()) {
+                    size_t parent = callStack.back();
+                    lowLink[parent] = std::min(lowLink[parent], lowLink[r]);
+                }
+                if (lowLink[r] == index[r]) {
+                    size_t v;
+                    size_t first = order.size();
+                    do {
+                        v = componentStack.back();
+                        componentStack.pop_back();
+                        onStack[v] = false;
+                        order.emplace_back(v);
+                    } while (v != r);
+                    std::sort(order.begin() + first, order.end());
+                    blockStart.emplace_back(order.size());
+                }
+            }
+        }
+    }
+
+    /// @brief Builds the diagonal block matrices and the off-diagonal entries, and
+    ///        maps every stored entry of A to where it goes
+    void buildBlocks(const SparsityPattern & pat,
+                     const std::vector<size_t> & rowToColumn) {
+        size_t K = numBlocks();
+        std::vector<size_t> position(M);
+        std::vector<size_t> blockOf(M);
+        for (size_t b = 0; b < K; b++) {
+            for (size_t p = blockStart[b]; p < blockStart[b + 1]; p++) {
+                position[order[p]] = p;
+                blockOf[p] = b;
+            }
+        }
+
+        blockMatrices.clear();
+        blockLU.assign(K, SparseLU<T>());
+        singletonValue.assign(K, 0);
+        for (size_t b = 0; b < K; b++) {
+            size_t size = blockStart[b + 1] - blockStart[b];
+            if (size == 1) {
+                size = 0;
+            }
+            blockMatrices.emplace_back(size, size);
+            blockLU[b].ordering = ordering;
+        }
+
+        slotBlock.assign(pat.nnz(), npos);
+        slotTarget.assign(pat.nnz(), 0);
+        offRowStart.assign(M + 1, 0);
+        std::vector<size_t> slotRow(pat.nnz());
+        for (size_t m = 0; m < M; m++) {
+            size_t pr = position[rowToColumn[m]];
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                size_t pc = position[pat.column[k]];
+                slotRow[k] = pr;
+                if (blockOf[pr] == blockOf[pc]) {
+                    size_t b = blockOf[pr];
+                    slotBlock[k] = b;
+                    if (blockMatrices[b].M != 0) {
+                        // creates the entry, slots are found once all are in
+                        blockMatrices[b](pr - blockStart[b], pc - blockStart[b]);
+                    }
+                } else {
+                    offRowStart[pr + 1]++;
+                }
+            }
+        }
+
+        for (size_t p = 0; p < M; p++) {
+            offRowStart[p + 1] += offRowStart[p];
+        }
+        offColumn.resize(offRowStart[M]);
+        offValues.assign(offRowStart[M], 0);
+        std::vector<size_t> nextOff(offRowStart.begin(), offRowStart.end() - 1);
+        for (size_t m = 0; m < M; m++) {
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                size_t pr = slotRow[k];
+                size_t pc = position[pat.column[k]];
+                size_t b = slotBlock[k];
+                if (b == npos) {
+                    slotTarget[k] = nextOff[pr]++;
+                    offColumn[slotTarget[k]] = pc;
+                } else if (blockMatrices[b].M != 0) {
+                    slotTarget[k] = blockMatrices[b].pattern->find(
+                        pr - blockStart[b], pc - blockStart[b]);
+                }
+            }
+        }
+    }
+};
+
+#endif
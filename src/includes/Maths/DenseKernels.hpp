@@ -0,0 +1,329 @@
+#ifndef _DENSEKERNELS_HPP_INC_
+#define _DENSEKERNELS_HPP_INC_
+#include <cstddef>
+#include <cmath>
+#include <complex>
+#include <algorithm>
+#include <type_traits>
+#include "Maths/ThreadPool.hpp"
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+/// @brief The inner kernels of the dense LU factorisation and triangular solves.
+///        All matrices are row major with an explicit leading dimension, so the
+///        kernels can work on sub-blocks of a packed LU buffer.
+///
+/// @details double and float get hand written AVX-512 or AVX2 + FMA kernels when
+///          the compiler targets them (e.g. -march=native). Every other type
+///          (notably std::complex) uses the plain loops, which the compiler is
+///          still free to vectorise.
+namespace DenseKernels {
+
+/// @brief Wraps the vector intrinsics for T. enabled is false when there are no
+///        hand written kernels for T on this target.
+template<typename T>
+struct Simd {
+    static constexpr bool enabled = false;
+    static constexpr size_t width = 1;
+};
+
+#if defined(__AVX512F__)
+template<>
+struct Simd<double> {
+    using Vec = __m512d;
+    static constexpr bool enabled = true;
+    static constexpr size_t width = 8;
+    static Vec load(const double * p) { return _mm512_loadu_pd(p); }
+    static void store(double * p, Vec v) { _mm512_storeu_pd(p, v); }
+    static Vec broadcast(double x) { return _mm512_set1_pd(x); }
+    static Vec zero() { return _mm512_setzero_pd(); }
+    /// @brief c - a * b
+    static Vec fnmadd(Vec a, Vec b, Vec c) { return _mm512_fnmadd_pd(a, b, c); }
+    /// @brief c + a * b
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm512_fmadd_pd(a, b, c); }
+};
+
+template<>
+struct Simd<float> {
+    using Vec = __m512;
+    static constexpr bool enabled = true;
+    static constexpr size_t width = 16;
+    static Vec load(const float * p) { return _mm512_loadu_ps(p); }
+    static void store(float * p, Vec v) { _mm512_storeu_ps(p, v); }
+    static Vec broadcast(float x) { return _mm512_set1_ps(x); }
+    static Vec zero() { return _mm512_setzero_ps(); }
+    static Vec fnmadd(Vec a, Vec b, Vec c) { return _mm512_fnmadd_ps(a, b, c); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm512_fmadd_ps(a, b, c); }
+};
+#elif defined(__AVX2__) && defined(__FMA__)
+template<>
+struct Simd<double> {
+    using Vec = __m256d;
+    static constexpr bool enabled = true;
+    static constexpr size_t width = 4;
+    static Vec load(const double * p) { return _mm256_loadu_pd(p); }
+    static void store(double * p, Vec v) { _mm256_storeu_pd(p, v); }
+    static Vec broadcast(double x) { return _mm256_set1_pd(x); }
+    static Vec zero() { return _mm256_setzero_pd(); }
+    static Vec fnmadd(Vec a, Vec b, Vec c) { return _mm256_fnmadd_pd(a, b, c); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm256_fmadd_pd(a, b, c); }
+};
+
+template<>
+struct Simd<float> {
+    using Vec = __m256;
+    static constexpr bool enabled = true;
+    static constexpr size_t width = 8;
+    static Vec load(const float * p) { return _mm256_loadu_ps(p); }
+    static void store(float * p, Vec v) { _mm256_storeu_ps(p, v); }
+    static Vec broadcast(float x) { return _mm256_set1_ps(x); }
+    static Vec zero() { return _mm256_setzero_ps(); }
+    static Vec fnmadd(Vec a, Vec b, Vec c) { return _mm256_fnmadd_ps(a, b, c); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm256_fmadd_ps(a, b, c); }
+};
+#endif
+
+/// @brief The number of columns eliminated per block of the LU factorisation
+constexpr size_t luBlockSize = 32;
+/// @brief The number of columns of the trailing matrix updated at once, so the
+///        block of U being read stays in cache
+constexpr size_t updateTileWidth = 128;
+/// @brief The smallest matrix whose factorisation is spread over several threads
+constexpr size_t parallelThreshold = 256;
+
+/// @brief y -= a * x
+template<typename T>
+inline void
+subtractScaled(T * __restrict y, const T * __restrict x, T a, size_t n) {
+    size_t i = 0;
+    if constexpr (Simd<T>::enabled) {
+        using S = Simd<T>;
+        auto va = S::broadcast(a);
+        for (; i + S::width <= n; i += S::width) {
+            S::store(y + i, S::fnmadd(va, S::load(x + i), S::load(y + i)));
+        }
+    }
+    for (; i < n; i++) {
+        y[i] -= a * x[i];
+    }
+}
+
+/// @brief The sum of a[i] * b[i]
+template<typename T>
+inline T
+dot(const T * __restrict a, const T * __restrict b, size_t n) {
+    size_t i = 0;
+    T total = T(0);
+    if constexpr (Simd<T>::enabled) {
+        using S = Simd<T>;
+        // two accumulators to hide the latency of the fma
+        auto acc0 = S::zero();
+        auto acc1 = S::zero();
+        for (; i + 2 * S::width <= n; i += 2 * S::width) {
+            acc0 = S::fmadd(S::load(a + i), S::load(b + i), acc0);
+            acc1 = S::fmadd(S::load(a + i + S::width), S::load(b + i + S::width),
+                            acc1);
+        }
+        for (; i + S::width <= n; i += S::width) {
+            acc0 = S::fmadd(S::load(a + i), S::load(b + i), acc0);
+        }
+        T lanes[2 * S::width];
+        S::store(lanes, acc0);
+        S::store(lanes + S::width, acc1);
+        for (size_t l = 0; l < 2 * S::width; l++) {
+            total += lanes[l];
+        }
+    }
+    for (; i < n; i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+/// @brief C -= A * B on a 4 row by V vector wide tile, keeping the tile of C in
+///        registers for the whole depth
+template<typename T, size_t V>
+inline void
+updateTile(T * c, size_t ldc, const T * a, size_t lda, const T * b, size_t ldb,
+           size_t depth) {
+    using S = Simd<T>;
+    typename S::Vec acc[4][V];
+    for (size_t r = 0; r < 4; r++) {
+        for (size_t v = 0; v < V; v++) {
+            acc[r][v] = S::load(c + r * ldc + v * S::width);
+        }
+    }
+    for (size_t k = 0; k < depth; k++) {
+        typename S::Vec bk[V];
+        for (size_t v = 0; v < V; v++) {
+            bk[v] = S::load(b + k * ldb + v * S::width);
+        }
+        for (size_t r = 0; r < 4; r++) {
+            auto ark = S::broadcast(a[r * lda + k]);
+            for (size_t v = 0; v < V; v++) {
+                acc[r][v] = S::fnmadd(ark, bk[v], acc[r][v]);
+            }
+        }
+    }
+    for (size_t r = 0; r < 4; r++) {
+        for (size_t v = 0; v < V; v++) {
+            S::store(c + r * ldc + v * S::width, acc[r][v]);
+        }
+    }
+}
+
+/// @brief C -= A * B, where C is rows x cols, A is rows x depth and B is depth x
+///        cols
+template<typename T>
+inline void
+subtractProduct(T * c, size_t ldc, const T * a, size_t lda, const T * b,
+                size_t ldb, size_t rows, size_t cols, size_t depth) {
+    for (size_t j0 = 0; j0 < cols; j0 += updateTileWidth) {
+        size_t width = std::min(updateTileWidth, cols - j0);
+        size_t i = 0;
+        if constexpr (Simd<T>::enabled) {
+            constexpr size_t W = Simd<T>::width;
+            for (; i + 4 <= rows; i += 4) {
+                T * ci = c + i * ldc + j0;
+                const T * ai = a + i * lda;
+                size_t j = 0;
+                for (; j + 2 * W <= width; j += 2 * W) {
+                    updateTile<T, 2>(ci + j, ldc, ai, lda, b + j0 + j, ldb, depth);
+                }
+                for (; j + W <= width; j += W) {
+                    updateTile<T, 1>(ci + j, ldc, ai, lda, b + j0 + j, ldb, depth);
+                }
+                for (; j < width; j++) {
+                    for (size_t r = 0; r < 4; r++) {
+                        T val = ci[r * ldc + j];
+                        for (size_t k = 0; k < depth; k++) {
+                            val -= ai[r * lda + k] * b[k * ldb + j0 + j];
+                        }
+                        ci[r * ldc + j] = val;
+                    }
+                }
+            }
+        }
+        for (; i < rows; i++) {
+            for (size_t k = 0; k < depth; k++) {
+                subtractScaled(c + i * ldc + j0, b + k * ldb + j0, a[i * lda + k],
+                               width);
+            }
+        }
+    }
+}
+
+/// @brief Factorises the n x n row major matrix a in place into P * A = L * U,
+///        with L unit lower triangular (stored below the diagonal) and U upper
+///        triangular (stored on and above it).
+///
+/// @details A right looking blocked factorisation with partial pivoting. Each
+///          block of luBlockSize columns is factorised on its own, then the
+///          block row of U is found by a triangular solve and the rest of the
+///          matrix is updated with one matrix product, which is where nearly all
+///          of the work goes.
+///
+///          Matrices of at least parallelThreshold unknowns share the block
+///          row and trailing updates between the threads of
+///          ThreadPool::shared(). The panels stay on one thread.
+///
+/// @param a The matrix, overwritten with the factors
+/// @param n The size of the matrix
+/// @param p Set so that row m of P * A is row p[m] of A
+template<typename T>
+inline void
+luFactorise(T * a, size_t n, size_t * p) {
+    for (size_t m = 0; m < n; m++) {
+        p[m] = m;
+    }
+
+    ThreadPool & pool = ThreadPool::shared();
+    for (size_t k0 = 0; k0 < n; k0 += luBlockSize) {
+        size_t kb = std::min(luBlockSize, n - k0);
+        size_t k1 = k0 + kb;
+
+        // factorise the panel of columns [k0, k1)
+        for (size_t k = k0; k < k1; k++) {
+            size_t pivotRow = k;
+            auto maxV = std::abs(a[k * n + k]);
+            for (size_t i = k + 1; i < n; i++) {
+                if (std::abs(a[i * n + k]) > maxV) {
+                    maxV = std::abs(a[i * n + k]);
+                    pivotRow = i;
+                }
+            }
+            if (pivotRow != k) {
+                std::swap_ranges(a + k * n, a + (k + 1) * n, a + pivotRow * n);
+                std::swap(p[k], p[pivotRow]);
+            }
+
+            T inversePivot = T(1) / a[k * n + k];
+            for (size_t i = k + 1; i < n; i++) {
+                T lik = a[i * n + k] * inversePivot;
+                a[i * n + k] = lik;
+                subtractScaled(a + i * n + k + 1, a + k * n + k + 1, lik,
+                               k1 - k - 1);
+            }
+        }
+
+        if (k1 == n) {
+            break;
+        }
+
+        // the block row of U and the trailing update split into independent
+        // column and row ranges, so they can be shared between threads
+        size_t rest = n - k1;
+        auto solveBlockRow = [&](size_t c0, size_t c1) {
+            // U12 = L11^-1 * A12
+            for (size_t k = k0; k < k1; k++) {
+                for (size_t i = k + 1; i < k1; i++) {
+                    subtractScaled(a + i * n + k1 + c0, a + k * n + k1 + c0,
+                                   a[i * n + k], c1 - c0);
+                }
+            }
+        };
+        auto updateRows = [&](size_t r0, size_t r1) {
+            // A22 -= L21 * U12
+            subtractProduct(a + (k1 + r0) * n + k1, n, a + (k1 + r0) * n + k0, n,
+                            a + k0 * n + k1, n, r1 - r0, rest, kb);
+        };
+
+        if (n < parallelThreshold || pool.size() == 1) {
+            solveBlockRow(0, rest);
+            updateRows(0, rest);
+            continue;
+        }
+        pool.parallelFor(rest, [&](size_t begin, size_t end, size_t) {
+            solveBlockRow(begin, end);
+        });
+        // whole tiles of 4 rows per thread
+        size_t tiles = (rest + 3) / 4;
+        pool.parallelFor(tiles, [&](size_t begin, size_t end, size_t) {
+            updateRows(4 * begin, std::min(4 * end, rest));
+        });
+    }
+}
+
+/// @brief Solves L * U * x = P * b in place, given the factors from luFactorise
+///
+/// @param lu The packed factors
+/// @param n The size of the system
+/// @param x On entry P * b, on exit the solution
+template<typename T>
+inline void
+luSolve(const T * lu, size_t n, T * x) {
+    // L * y = P * b, L has a unit diagonal
+    for (size_t m = 1; m < n; m++) {
+        x[m] -= dot(lu + m * n, x, m);
+    }
+    // U * x = y
+    for (size_t m = n; m-- > 0;) {
+        x[m] = (x[m] - dot(lu + m * n + m + 1, x + m + 1, n - m - 1)) /
+               lu[m * n + m];
+    }
+}
+
+} // namespace DenseKernels
+
+#endif
@@ -8,6 +8,10 @@
 #include <array>
 #include <assert.h>
 #include <complex>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include "Maths/DenseKernels.hpp"
 
 template<typename T>
 std::complex<double>
@@ -48,6 +52,9 @@ concept arithmetic = requires(T a, T b) {
 template<typename T>
 struct LUPair;
 
+template<typename T>
+struct MixedLUPair;
+
 /// @brief A matrix class with support for LU-decomposition, and left division
 ///
 /// @tparam T
@@ -182,44 +189,48 @@ requires arithmetic<T> struct Matrix {
         return toRet;
     }
 
+    /// @brief Factorises the matrix into dest. See DenseKernels::luFactorise
     void luPair(LUPair<T> & dest) const {
-        dest.u = *this;
-        dest.l.fill(0.0);
-        for (size_t n = 0; n < N; n++) {
-            dest.l.data[n * N + n] = 1.0;
-            dest.p[n] = n;
-        }
+        assert(N == M && dest.M == M);
+        dest.lu.data = data;
+        DenseKernels::luFactorise(dest.lu.data.data(), M, dest.p.data());
+    }
 
-        for (size_t r = 0; r < M - 1; r++) {
-            // find largest in column
-            size_t largestRow = r;
-            auto maxV = abs(dest.u.data[r * N + r]);
-            for (size_t r2 = r + 1; r2 < M; r2++) {
-                if (abs(dest.u.data[r2 * N + r]) > maxV) {
-                    maxV = abs(dest.u.data[r2 * N + r]);
-                    largestRow = r2;
-                }
+    /// @brief Factorises the matrix in single precision into dest.lower, falling
+    ///        back to full precision if it won't fit in single precision.
+    void luPair(MixedLUPair<T> & dest) const {
+        assert(N == M && dest.M == M);
+        using LowT = typename MixedLUPair<T>::LowT;
+        using RealT = typename MixedLUPair<T>::RealT;
+        dest.usingFull = false;
+
+        dest.normA = 0;
+        for (size_t m = 0; m < M; m++) {
+            RealT rowSum = 0;
+            for (size_t n = 0; n < N; n++) {
+                rowSum += std::abs(data[m * N + n]);
             }
+            dest.normA = std::max(dest.normA, rowSum);
+        }
 
-            // swap rows in U and indices in p
-            dest.u.swapRows(r, largestRow);
-            std::swap(dest.p[r], dest.p[largestRow]);
-            // swap subdiagonal entries in L
-            for (size_t n = 0; n < r; n++) {
-                std::swap(dest.l.data[r * N + n], dest.l.data[largestRow * N + n]);
+        if (dest.normA < std::numeric_limits<float>::max()) {
+            LowT * low = dest.lower.lu.data.data();
+            for (size_t k = 0; k < data.size(); k++) {
+                low[k] = static_cast<LowT>(data[k]);
             }
+            DenseKernels::luFactorise(low, M, dest.lower.p.data());
 
-            // Gaussian elimination
-            for (size_t m = r + 1; m < M; m++) {
-                // TODO: potential for multithreading here
-                // need to take into account how many processors there are
-                // https://en.cppreference.com/w/cpp/thread/thread/hardware_concurrency
-                T multiplier = dest.u.data[m * N + r] / dest.u.data[r * N + r];
-                dest.u.rowAddition(m, r, -multiplier);
-                dest.l.data[m * N + r] = multiplier;
+            bool usable = true;
+            for (size_t m = 0; m < M; m++) {
+                auto pivot = std::abs(low[m * M + m]);
+                usable = usable && pivot > 0 &&
+                         pivot < std::numeric_limits<float>::max();
+            }
+            if (usable) {
+                return;
             }
-            // std::cout << "After Gaussian\n " << dest.toString();
         }
+        dest.fallBack(*this);
     }
 
     Matrix<T> leftDivide(const Matrix<T> & rhs) const {
@@ -235,59 +246,132 @@ requires arithmetic<T> struct Matrix {
         leftDivide(rhs, lu, scratchSpace, dest.data.begin(), dest.data.end());
     }
 
-    template<typename Iterator>
-    void
-    leftDivide(const Matrix<T> & rhs, const LUPair<T> & lu, Matrix<T> & scratchSpace,
-               Iterator destBegin, Iterator destEnd) const {
-        assert(destEnd - destBegin == scratchSpace.M);
-        for (size_t m = 0; m < M; m++) {
-            destBegin[m] = rhs.data[lu.p[m]];
+    /// @brief Solves this * dest = rhs to full precision with a single precision
+    ///        factorisation of this, by iterative refinement: each correction is
+    ///        solved in single precision, against the residual computed in full
+    ///        precision.
+    ///
+    /// @details Each correction shrinks by about cond(A) * eps(float), until it
+    ///          reaches the rounding error of the residual, about cond(A) *
+    ///          eps(double), which is also the accuracy of a full precision
+    ///          solve. So refinement stops when the corrections stop shrinking
+    ///          after having done so. If they never shrink, or lu.maxRefinements
+    ///          is reached, the matrix is refactorised in full precision and
+    ///          that factorisation is used until the next call to luPair.
+    void leftDivide(const Matrix<T> & rhs, MixedLUPair<T> & lu,
+                    Matrix<T> & scratchSpace, Matrix<T> & dest) const {
+        using LowT = typename MixedLUPair<T>::LowT;
+        using RealT = typename MixedLUPair<T>::RealT;
+        if (lu.usingFull) {
+            leftDivide(rhs, lu.full, scratchSpace, dest);
+            return;
         }
+        lu.solves++;
 
-        // scratchSpace: solve LY = Pb for y using substitution
-        for (size_t m = 0; m < M; m++) {
-            T val = destBegin[m];
-            for (size_t n = 0; n < m; n++) {
-                val -= scratchSpace.data[n] * lu.l.data[m * N + n];
+        std::vector<LowT> & correction = lu.correction;
+        std::fill(dest.data.begin(), dest.data.begin() + M, T(0));
+        std::copy(rhs.data.begin(), rhs.data.begin() + M, scratchSpace.data.begin());
+        RealT lastNormD = std::numeric_limits<RealT>::infinity();
+
+        for (size_t iteration = 0; iteration < lu.maxRefinements; iteration++) {
+            lu.refinements++;
+            for (size_t m = 0; m < M; m++) {
+                correction[m] = static_cast<LowT>(scratchSpace.data[lu.lower.p[m]]);
             }
-            scratchSpace.data[m] = val / lu.l.data[m * N + m];
-        }
+            DenseKernels::luSolve(lu.lower.lu.data.data(), M, correction.data());
+
+            RealT normD = 0;
+            RealT normX = 0;
+            for (size_t m = 0; m < M; m++) {
+                dest.data[m] += static_cast<T>(correction[m]);
+                normD = std::max(normD, RealT(std::abs(correction[m])));
+                normX = std::max(normX, RealT(std::abs(dest.data[m])));
+            }
+            const RealT eps = std::numeric_limits<RealT>::epsilon();
+            if (normD <= eps * normX) {
+                return;
+            }
+            if (!(normD < lastNormD / 2)) {
+                // the corrections shrank until the rounding error in the
+                // residual took over, which is as far as full precision gets too
+                if (iteration > 1 && normD <= std::sqrt(eps) * normX) {
+                    return;
+                }
+                break;
+            }
+            lastNormD = normD;
 
-        // stage2: solve Ux = Y for x using substitution
-        for (size_t m = 0; m < M; m++) {
-            T val = scratchSpace.data[M - m - 1];
-            for (size_t n = 0; n < m; n++) {
-                val -= destBegin[(M - n - 1)] *
-                       lu.u.data[(M - m - 1) * N + N - n - 1];
+            // r = b - A * x
+            for (size_t m = 0; m < M; m++) {
+                T ax = DenseKernels::dot(&data[m * N], dest.data.data(), N);
+                scratchSpace.data[m] = rhs.data[m] - ax;
             }
-            destBegin[M - m - 1] = val / lu.u.data[(M - m - 1) * N + M - m - 1];
         }
+
+        lu.fallBack(*this);
+        leftDivide(rhs, lu.full, scratchSpace, dest);
+    }
+
+    template<typename Iterator>
+    void
+    leftDivide(const Matrix<T> & rhs, const LUPair<T> & lu, Matrix<T> & scratchSpace,
+               Iterator destBegin, Iterator destEnd) const {
+        assert(destEnd - destBegin == scratchSpace.M);
+        for (size_t m = 0; m < lu.M; m++) {
+            scratchSpace.data[m] = rhs.data[lu.p[m]];
+        }
+        DenseKernels::luSolve(lu.lu.data.data(), lu.M, scratchSpace.data.data());
+        std::copy(scratchSpace.data.begin(), scratchSpace.data.begin() + lu.M,
+                  destBegin);
     }
 };
 
-/// @brief A helper class to store the L U and pivot matrices. Mainly useful in
+/// @brief A helper class to store the LU factors and pivots. Mainly useful in
 ///        solving systems of equations
 ///
+/// @details L and U share one packed buffer: L is unit lower triangular and is
+///          stored below the diagonal, U is stored on and above it.
+///
 /// @tparam T the value type
 template<typename T>
 struct LUPair {
-    Matrix<T> l;
-    Matrix<T> u;
+    Matrix<T> lu;
     std::vector<size_t> p;
     size_t M;
 
-    LUPair(size_t _M) : l(_M, _M, 0), u(_M, _M), p(_M), M(_M) {
+    LUPair(size_t _M) : lu(_M, _M), p(_M), M(_M) {
+    }
+
+    LUPair(const LUPair<T> & other) : lu(other.lu), p(other.p), M(other.M) {
     }
 
-    LUPair(const LUPair<T> & other)
-        : l(other.l), u(other.u), p(other.p), M(other.M) {
+    LUPair<T> & operator=(const LUPair<T> & other) = default;
+
+    /// @brief Unpacks the unit lower triangular factor
+    Matrix<T> lower() const {
+        Matrix<T> toRet(M, M, 0);
+        for (size_t m = 0; m < M; m++) {
+            std::copy(lu.data.begin() + m * M, lu.data.begin() + m * M + m,
+                      toRet.data.begin() + m * M);
+            toRet.data[m * M + m] = 1;
+        }
+        return toRet;
     }
 
+    /// @brief Unpacks the upper triangular factor
+    Matrix<T> upper() const {
+        Matrix<T> toRet(M, M, 0);
+        for (size_t m = 0; m < M; m++) {
+            std::copy(lu.data.begin() + m * M + m, lu.data.begin() + (m + 1) * M,
+                      toRet.data.begin() + m * M + m);
+        }
+        return toRet;
+    }
 
     std::string toString() {
         std::stringstream toRet;
-        toRet << " U\n" << u.toString();
-        toRet << " L\n" << l.toString();
+        toRet << " U\n" << upper().toString();
+        toRet << " L\n" << lower().toString();
         toRet << " p\n";
         for (size_t i = 0; i < p.size(); i++) {
             toRet << std::setw(5) << p[i] << " ";
@@ -296,6 +380,67 @@ struct LUPair {
         return toRet.str();
     }
 };
+
+/// @brief The single precision type used to factorise a matrix of T
+template<typename T>
+struct LowerPrecision {
+    using type = T;
+};
+
+template<>
+struct LowerPrecision<double> {
+    using type = float;
+};
+
+template<>
+struct LowerPrecision<std::complex<double> > {
+    using type = std::complex<float>;
+};
+
+/// @brief An LU factorisation held in single precision, which Matrix::leftDivide
+///        refines to a full precision solution. Halves the memory traffic of
+///        the factorisation and doubles its SIMD width.
+///
+/// @tparam T the value type
+template<typename T>
+struct MixedLUPair {
+    using LowT = typename LowerPrecision<T>::type;
+    using RealT = decltype(std::abs(std::declval<T>()));
+
+    size_t M;
+    /// @brief The single precision factors
+    LUPair<LowT> lower;
+    /// @brief The full precision factors, only computed when refinement fails
+    LUPair<T> full;
+    /// @brief Set when full is being used in place of lower
+    bool usingFull = false;
+    /// @brief The infinity norm of the factorised matrix
+    RealT normA = 0;
+    /// @brief Give up on refinement after this many corrections
+    size_t maxRefinements = 30;
+
+    /// @brief The number of refined solves, the corrections they took, and the
+    ///        number of times full precision had to be used instead
+    size_t solves = 0;
+    size_t refinements = 0;
+    size_t fallbacks = 0;
+
+    std::vector<LowT> correction;
+
+    MixedLUPair(size_t _M) : M(_M), lower(_M), full(0), correction(_M) {
+    }
+
+    /// @brief Factorises A in full precision and uses that from now on
+    void fallBack(const Matrix<T> & A) {
+        if (full.M != M) {
+            full = LUPair<T>(M);
+        }
+        A.luPair(full);
+        usingFull = true;
+        fallbacks++;
+    }
+};
+
 // --------------------------------------------------------------------------
 //                   Implementation
 // --------------------------------------------------------------------------
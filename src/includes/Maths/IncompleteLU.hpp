@@ -0,0 +1,398 @@
+#ifndef _INCOMPLETELU_HPP_INC_
+#define _INCOMPLETELU_HPP_INC_
+#include "Maths/DynamicMatrix.hpp"
+#include "Maths/SparseMatrix.hpp"
+#include "Maths/Ordering.hpp"
+#include "Maths/BlockTriangular.hpp"
+#include <queue>
+#include <functional>
+
+/// @brief The incomplete factorisations used to precondition the Krylov solvers
+enum class Preconditioner {
+    /// @brief No fill, the factors have the pattern of the matrix
+    ILU0,
+    /// @brief Fill is kept where it is larger than a drop tolerance, up to a
+    ///        limit per row
+    ILUT,
+};
+
+/// @brief Parses the argument of the .preconditioner netlist directive
+///
+/// @param name The name of the preconditioner, e.g. "ilut"
+/// @param preconditioner Set to the matching preconditioner if one is found
+///
+/// @return true if the name was recognised
+inline bool
+parsePreconditioner(const std::string & name, Preconditioner & preconditioner) {
+    if (name == "ilu0") {
+        preconditioner = Preconditioner::ILU0;
+    } else if (name == "ilut") {
+        preconditioner = Preconditioner::ILUT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline std::string
+preconditionerName(Preconditioner preconditioner) {
+    switch (preconditioner) {
+        case Preconditioner::ILU0:
+            return "ilu0";
+        case Preconditioner::ILUT:
+            return "ilut";
+    }
+    return "";
+}
+
+/// @brief An incomplete LU factorisation, M = L * U ~= A, used as a
+///        preconditioner.
+///
+/// @details An incomplete factorisation doesn't pivot, and the rows of an MNA
+///          matrix for voltage sources have no diagonal entry, so the rows are
+///          first permuted to put a nonzero on every diagonal entry
+///          (maximumTransversal), and the result symmetrically permuted by the
+///          chosen ordering. Row k of the factorised matrix B is row rowOrder[k]
+///          of A, and column k is column order[k].
+///          \n\n
+///          Both variants are the row-wise (IKJ) elimination from Saad's
+///          "Iterative Methods for Sparse Linear Systems". ILU(0) only updates
+///          entries that are already in the pattern of B, ILUT also creates fill
+///          but drops anything smaller than dropTolerance times the norm of the
+///          row, and then keeps at most fillPerRow of the largest entries in each
+///          of the L and U parts of the row. A pivot that comes out as zero is
+///          replaced by a small multiple of the row norm, so the factorisation
+///          always completes.
+///          \n\n
+///          The factors are held in one CSR structure, row i holding the L
+///          entries (unit diagonal not stored), then the diagonal of U at
+///          diagonalSlot[i], then the rest of U.
+///
+/// @tparam T the value type
+template<typename T>
+struct IncompleteLU {
+    using RealT = decltype(std::abs(std::declval<T>()));
+    static constexpr size_t npos = SparsityPattern::npos;
+
+    size_t M = 0;
+    Preconditioner type = Preconditioner::ILU0;
+    Ordering ordering = Ordering::AMD;
+    /// @brief ILUT drops entries smaller than this, relative to the row norm
+    RealT dropTolerance = 1e-4;
+    /// @brief ILUT keeps at most this many entries in each of L and U per row
+    size_t fillPerRow = 10;
+    /// @brief The number of zero pivots replaced in the last factorisation
+    size_t perturbedPivots = 0;
+
+    std::vector<size_t> order;
+    std::vector<size_t> rowOrder;
+
+    /// @brief Factorises A, reordering it first if its pattern has changed
+    void factorise(const SparseMatrix<T> & A) {
+        assert(A.M == A.N);
+        if (A.pattern != analysedPattern || A.pattern->version != analysedVersion) {
+            analyse(A);
+        }
+        for (size_t k = 0; k < bSlot.size(); k++) {
+            bVal[k] = bSlot[k] == npos ? T(0) : A.data[bSlot[k]];
+        }
+
+        perturbedPivots = 0;
+        if (type == Preconditioner::ILU0) {
+            factoriseLevel0();
+        } else {
+            factoriseThreshold();
+        }
+    }
+
+    /// @brief Computes dest = M^-1 * rhs
+    void apply(const T * rhs, T * dest) const {
+        for (size_t k = 0; k < M; k++) {
+            y[k] = rhs[rowOrder[k]];
+        }
+        for (size_t i = 0; i < M; i++) {
+            T val = y[i];
+            for (size_t k = fRowStart[i]; k < diagonalSlot[i]; k++) {
+                val -= fVal[k] * y[fColumn[k]];
+            }
+            y[i] = val;
+        }
+        for (size_t i = M; i-- > 0;) {
+            T val = y[i];
+            for (size_t k = diagonalSlot[i] + 1; k < fRowStart[i + 1]; k++) {
+                val -= fVal[k] * y[fColumn[k]];
+            }
+            y[i] = val / fVal[diagonalSlot[i]];
+        }
+        for (size_t k = 0; k < M; k++) {
+            dest[order[k]] = y[k];
+        }
+    }
+
+    /// @brief The number of stored entries in the factors
+    size_t nnz() const {
+        return fVal.size();
+    }
+
+private:
+    std::shared_ptr<SparsityPattern> analysedPattern;
+    size_t analysedVersion = 0;
+
+    /// @brief B, the permuted A (CSR, sorted rows), and the slot of A each of its
+    ///        entries comes from. Every diagonal entry of B is stored, with a
+    ///        slot of npos if A has no entry there.
+    std::vector<size_t> bRowStart;
+    std::vector<size_t> bColumn;
+    std::vector<size_t> bSlot;
+    std::vector<T> bVal;
+
+    /// @brief The factors
+    std::vector<size_t> fRowStart;
+    std::vector<size_t> fColumn;
+    std::vector<size_t> diagonalSlot;
+    std::vector<T> fVal;
+
+    /// @brief Working space for the elimination of one row
+    std::vector<T> w;
+    std::vector<size_t> wSlot;
+    std::vector<size_t> rowEntries;
+    mutable std::vector<T> y;
+
+    void analyse(const SparseMatrix<T> & A) {
+        const SparsityPattern & pat = *A.pattern;
+        M = A.M;
+
+        // CSC copy of the pattern
+        std::vector<size_t> colStart(M + 1, 0);
+        std::vector<size_t> row(pat.nnz());
+        for (size_t c : pat.column) {
+            colStart[c + 1]++;
+        }
+        for (size_t n = 0; n < M; n++) {
+            colStart[n + 1] += colStart[n];
+        }
+        std::vector<size_t> next(colStart.begin(), colStart.end() - 1);
+        for (size_t m = 0; m < M; m++) {
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                row[next[pat.column[k]]++] = m;
+            }
+        }
+
+        // pair up the unmatched rows and columns of a structurally singular
+        // matrix, their zero pivots are perturbed like any other
+        std::vector<size_t> matchRow = maximumTransversal(M, colStart, row);
+        std::vector<bool> rowMatched(M, false);
+        for (size_t j = 0; j < M; j++) {
+            if (matchRow[j] != npos) {
+                rowMatched[matchRow[j]] = true;
+            }
+        }
+        size_t freeRow = 0;
+        for (size_t j = 0; j < M; j++) {
+            if (matchRow[j] == npos) {
+                while (rowMatched[freeRow]) {
+                    freeRow++;
+                }
+                matchRow[j] = freeRow;
+                rowMatched[freeRow] = true;
+            }
+        }
+
+        // the ordering is computed on the matched matrix, whose row j is the row
+        // matched to column j
+        std::vector<size_t> matchedRowStart(M + 1, 0);
+        std::vector<size_t> matchedColumn;
+        matchedColumn.reserve(pat.nnz());
+        for (size_t j = 0; j < M; j++) {
+            size_t m = matchRow[j];
+            matchedColumn.insert(matchedColumn.end(),
+                                 pat.column.begin() + pat.rowStart[m],
+                                 pat.column.begin() + pat.rowStart[m + 1]);
+            matchedRowStart[j + 1] = matchedColumn.size();
+        }
+        order = computeOrdering(ordering, M, matchedRowStart, matchedColumn);
+        std::vector<size_t> position(M);
+        rowOrder.resize(M);
+        for (size_t k = 0; k < M; k++) {
+            position[order[k]] = k;
+            rowOrder[k] = matchRow[order[k]];
+        }
+
+        bRowStart.assign(M + 1, 0);
+        bColumn.clear();
+        bSlot.clear();
+        std::vector<std::pair<size_t, size_t> > entries;
+        for (size_t i = 0; i < M; i++) {
+            size_t m = rowOrder[i];
+            entries.clear();
+            bool hasDiagonal = false;
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                entries.emplace_back(position[pat.column[k]], k);
+                hasDiagonal |= position[pat.column[k]] == i;
+            }
+            if (!hasDiagonal) {
+                entries.emplace_back(i, npos);
+            }
+            std::sort(entries.begin(), entries.end());
+            for (auto & [column, slot] : entries) {
+                bColumn.emplace_back(column);
+                bSlot.emplace_back(slot);
+            }
+            bRowStart[i + 1] = bColumn.size();
+        }
+        bVal.assign(bSlot.size(), 0);
+
+        if (type == Preconditioner::ILU0) {
+            fRowStart = bRowStart;
+            fColumn = bColumn;
+            diagonalSlot.resize(M);
+            for (size_t i = 0; i < M; i++) {
+                auto begin = fColumn.begin() + fRowStart[i];
+                auto end = fColumn.begin() + fRowStart[i + 1];
+                diagonalSlot[i] = std::lower_bound(begin, end, i) - fColumn.begin();
+            }
+        }
+
+        w.assign(M, 0);
+        wSlot.assign(M, npos);
+        y.assign(M, 0);
+        analysedPattern = A.pattern;
+        analysedVersion = pat.version;
+    }
+
+    /// @brief The 2-norm of row i of B, used to scale the drop tolerance and
+    ///        perturbed pivots
+    RealT rowNorm(size_t i) const {
+        RealT sum = 0;
+        for (size_t k = bRowStart[i]; k < bRowStart[i + 1]; k++) {
+            sum += std::norm(bVal[k]);
+        }
+        return std::sqrt(sum);
+    }
+
+    /// @brief Replaces a zero pivot so the factorisation can carry on
+    T checkedPivot(T pivot, size_t i) {
+        if (pivot != T(0)) {
+            return pivot;
+        }
+        perturbedPivots++;
+        RealT norm = rowNorm(i);
+        return norm > 0 ? T(std::sqrt(std::numeric_limits<RealT>::epsilon()) * norm)
+                        : T(1);
+    }
+
+    void factoriseLevel0() {
+        fVal = bVal;
+        for (size_t i = 0; i < M; i++) {
+            for (size_t k = fRowStart[i]; k < fRowStart[i + 1]; k++) {
+                wSlot[fColumn[k]] = k;
+            }
+
+            for (size_t k = fRowStart[i]; k < diagonalSlot[i]; k++) {
+                size_t r = fColumn[k];
+                T factor = fVal[k] / fVal[diagonalSlot[r]];
+                fVal[k] = factor;
+                for (size_t q = diagonalSlot[r] + 1; q < fRowStart[r + 1]; q++) {
+                    size_t target = wSlot[fColumn[q]];
+                    if (target != npos) {
+                        fVal[target] -= factor * fVal[q];
+                    }
+                }
+            }
+            fVal[diagonalSlot[i]] = checkedPivot(fVal[diagonalSlot[i]], i);
+
+            for (size_t k = fRowStart[i]; k < fRowStart[i + 1]; k++) {
+                wSlot[fColumn[k]] = npos;
+            }
+        }
+    }
+
+    void factoriseThreshold() {
+        fRowStart.assign(1, 0);
+        fColumn.clear();
+        fVal.clear();
+        diagonalSlot.resize(M);
+
+        std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t> >
+            pending;
+        std::vector<size_t> lower;
+        std::vector<size_t> upper;
+        auto byMagnitude = [&](size_t a, size_t b) {
+            return std::abs(w[a]) > std::abs(w[b]);
+        };
+
+        for (size_t i = 0; i < M; i++) {
+            RealT threshold = dropTolerance * rowNorm(i);
+            rowEntries.clear();
+            for (size_t k = bRowStart[i]; k < bRowStart[i + 1]; k++) {
+                size_t c = bColumn[k];
+                w[c] = bVal[k];
+                wSlot[c] = 0;
+                rowEntries.emplace_back(c);
+                if (c < i) {
+                    pending.push(c);
+                }
+            }
+
+            // eliminate in increasing column order, fill below the diagonal
+            // joins the queue
+            while (!pending.empty()) {
+                size_t r = pending.top();
+                pending.pop();
+                T factor = w[r] / fVal[diagonalSlot[r]];
+                w[r] = factor;
+                if (std::abs(factor) < threshold) {
+                    continue;
+                }
+                for (size_t q = diagonalSlot[r] + 1; q < fRowStart[r + 1]; q++) {
+                    size_t c = fColumn[q];
+                    if (wSlot[c] == npos) {
+                        w[c] = 0;
+                        wSlot[c] = 0;
+                        rowEntries.emplace_back(c);
+                        if (c < i) {
+                            pending.push(c);
+                        }
+                    }
+                    w[c] -= factor * fVal[q];
+                }
+            }
+
+            lower.clear();
+            upper.clear();
+            for (size_t c : rowEntries) {
+                if (c != i && std::abs(w[c]) >= threshold && w[c] != T(0)) {
+                    (c < i ? lower : upper).emplace_back(c);
+                }
+            }
+            for (auto * part : {&lower, &upper}) {
+                if (part->size() > fillPerRow) {
+                    std::nth_element(part->begin(), part->begin() + fillPerRow,
+                                     part->end(), byMagnitude);
+                    part->resize(fillPerRow);
+                }
+                std::sort(part->begin(), part->end());
+            }
+
+            for (size_t c : lower) {
+                fColumn.emplace_back(c);
+                fVal.emplace_back(w[c]);
+            }
+            diagonalSlot[i] = fColumn.size();
+            fColumn.emplace_back(i);
+            fVal.emplace_back(checkedPivot(w[i], i));
+            for (size_t c : upper) {
+                fColumn.emplace_back(c);
+                fVal.emplace_back(w[c]);
+            }
+            fRowStart.emplace_back(fColumn.size());
+
+            for (size_t c : rowEntries) {
+                w[c] = 0;
+                wSlot[c] = npos;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,330 @@
+#ifndef _KRYLOV_HPP_INC_
+#define _KRYLOV_HPP_INC_
+#include "Maths/DynamicMatrix.hpp"
+#include "Maths/SparseMatrix.hpp"
+#include "Maths/IncompleteLU.hpp"
+
+/// @brief The Krylov subspace methods KrylovSolver can use
+enum class KrylovMethod {
+    /// @brief Restarted GMRES. Robust, at the cost of storing a basis of
+    ///        restart vectors.
+    GMRES,
+    /// @brief BiCGStab. Short recurrences, but its convergence is less smooth
+    BiCGStab,
+};
+
+/// @brief Solves A * x = b with a preconditioned Krylov method, for systems too
+///        large for a direct factorisation.
+///
+/// @details Both methods are right preconditioned, A * M^-1 * u = b with
+///          x = M^-1 * u, so the residual they minimise / track is the true
+///          residual of A. M is an IncompleteLU of A.
+///          \n\n
+///          Computing M costs far more than an iteration, so it is kept while A
+///          changes (across Newton iterations and timesteps) and only rebuilt
+///          when it stops working: when a solve fails to converge, or takes
+///          more than rebuildRatio times as many iterations as the first solve
+///          after the last rebuild. A solve that fails to converge is retried
+///          once with the rebuilt preconditioner.
+///          \n\n
+///          Each solve starts from the value passed in dest, which in the
+///          simulator is the previous Newton iterate, so the iterations only
+///          have to find the update.
+///
+/// @tparam T the value type
+template<typename T>
+struct KrylovSolver {
+    using RealT = decltype(std::abs(std::declval<T>()));
+
+    size_t M = 0;
+    KrylovMethod method = KrylovMethod::GMRES;
+    IncompleteLU<T> preconditioner;
+
+    /// @brief Converged once ||b - A * x|| <= tolerance * ||b||
+    RealT tolerance = 1e-14;
+    /// @brief The number of GMRES iterations between restarts
+    size_t restart = 30;
+    size_t maxIterations = 1000;
+    /// @brief Rebuild the preconditioner once a solve takes this many times as
+    ///        many iterations as right after the last rebuild
+    size_t rebuildRatio = 3;
+
+    /// @brief Statistics for the report
+    size_t solves = 0;
+    size_t iterations = 0;
+    size_t preconditionerBuilds = 0;
+    size_t unconverged = 0;
+
+    /// @brief Takes a copy of A for the next solves. The preconditioner is only
+    ///        rebuilt if the pattern of A has changed.
+    void setMatrix(const SparseMatrix<T> & G) {
+        assert(G.M == G.N);
+        bool patternChanged = G.pattern != A.pattern ||
+                              G.pattern->version != analysedVersion;
+        A = G;
+        if (patternChanged) {
+            resize(G.M);
+            analysedVersion = G.pattern->version;
+            rebuildPreconditioner();
+        }
+    }
+
+    /// @brief Solves A * dest = rhs, starting from the value in dest
+    void solve(const Matrix<T> & rhs, Matrix<T> & dest) {
+        solves++;
+        T * x = dest.data.data();
+        for (size_t m = 0; m < M; m++) {
+            if (!std::isfinite(std::abs(x[m]))) {
+                std::fill(x, x + M, T(0));
+                break;
+            }
+        }
+
+        size_t taken = 0;
+        bool converged = iterate(rhs.data.data(), x, taken);
+        size_t baseline = std::max<size_t>(baselineIterations, 1);
+        bool degraded = baselineIterations != npos &&
+                        taken > rebuildRatio * baseline;
+        if (!converged || degraded) {
+            rebuildPreconditioner();
+            if (!converged) {
+                size_t retaken = 0;
+                converged = iterate(rhs.data.data(), x, retaken);
+                taken += retaken;
+                baselineIterations = retaken;
+            }
+        } else if (baselineIterations == npos) {
+            baselineIterations = taken;
+        }
+        iterations += taken;
+        unconverged += !converged;
+    }
+
+private:
+    static constexpr size_t npos = SparsityPattern::npos;
+
+    SparseMatrix<T> A = SparseMatrix<T>(0, 0);
+    size_t analysedVersion = 0;
+    /// @brief The iterations taken by the first solve after the last rebuild,
+    ///        npos until that solve has happened
+    size_t baselineIterations = npos;
+
+    std::vector<T> r;
+    std::vector<T> work;
+    /// @brief GMRES: the Krylov basis (restart + 1 vectors of M, one after the
+    ///        other), the Hessenberg matrix by column, its Givens rotations and
+    ///        the rotated residual
+    std::vector<T> basis;
+    std::vector<T> hessenberg;
+    std::vector<T> givensC;
+    std::vector<T> givensS;
+    std::vector<T> g;
+    /// @brief BiCGStab vectors
+    std::vector<T> shadow, p, v, s, t, pHat, sHat;
+
+    void resize(size_t newM) {
+        M = newM;
+        for (auto * vec : {&r, &work, &shadow, &p, &v, &s, &t, &pHat, &sHat}) {
+            vec->assign(M, 0);
+        }
+        basis.assign((restart + 1) * M, 0);
+        hessenberg.assign((restart + 1) * restart, 0);
+        givensC.assign(restart, 0);
+        givensS.assign(restart, 0);
+        g.assign(restart + 1, 0);
+    }
+
+    void rebuildPreconditioner() {
+        preconditioner.factorise(A);
+        preconditionerBuilds++;
+        baselineIterations = npos;
+    }
+
+    /// @brief y = A * x
+    void multiply(const T * x, T * y) const {
+        const SparsityPattern & pat = *A.pattern;
+        for (size_t m = 0; m < M; m++) {
+            T val = 0;
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                val += A.data[k] * x[pat.column[k]];
+            }
+            y[m] = val;
+        }
+    }
+
+    T dot(const T * a, const T * b) const {
+        T sum = 0;
+        for (size_t m = 0; m < M; m++) {
+            sum += a[m] * b[m];
+        }
+        return sum;
+    }
+
+    RealT norm(const T * a) const {
+        return std::sqrt(std::abs(dot(a, a)));
+    }
+
+    /// @brief r = b - A * x
+    RealT residual(const T * b, const T * x) {
+        multiply(x, r.data());
+        for (size_t m = 0; m < M; m++) {
+            r[m] = b[m] - r[m];
+        }
+        return norm(r.data());
+    }
+
+    bool iterate(const T * b, T * x, size_t & taken) {
+        RealT target = tolerance * norm(b);
+        if (target == 0) {
+            std::fill(x, x + M, T(0));
+            return true;
+        }
+        if (method == KrylovMethod::GMRES) {
+            return gmres(b, x, target, taken);
+        }
+        return bicgstab(b, x, target, taken);
+    }
+
+    bool gmres(const T * b, T * x, RealT target, size_t & taken) {
+        while (true) {
+            RealT beta = residual(b, x);
+            if (beta <= target) {
+                return true;
+            }
+            if (taken >= maxIterations) {
+                return false;
+            }
+
+            for (size_t m = 0; m < M; m++) {
+                basis[m] = r[m] / beta;
+            }
+            std::fill(g.begin(), g.end(), T(0));
+            g[0] = beta;
+
+            size_t j = 0;
+            while (j < restart && taken < maxIterations) {
+                taken++;
+                T * h = &hessenberg[j * (restart + 1)];
+                T * next = &basis[(j + 1) * M];
+                preconditioner.apply(&basis[j * M], work.data());
+                multiply(work.data(), next);
+
+                // modified Gram-Schmidt
+                for (size_t i = 0; i <= j; i++) {
+                    h[i] = dot(next, &basis[i * M]);
+                    for (size_t m = 0; m < M; m++) {
+                        next[m] -= h[i] * basis[i * M + m];
+                    }
+                }
+                h[j + 1] = norm(next);
+                if (h[j + 1] != T(0)) {
+                    for (size_t m = 0; m < M; m++) {
+                        next[m] /= h[j + 1];
+                    }
+                }
+
+                // reduce the new column to upper triangular
+                for (size_t i = 0; i < j; i++) {
+                    T rotated = givensC[i] * h[i] + givensS[i] * h[i + 1];
+                    h[i + 1] = -givensS[i] * h[i] + givensC[i] * h[i + 1];
+                    h[i] = rotated;
+                }
+                RealT length = std::hypot(h[j], h[j + 1]);
+                givensC[j] = length == 0 ? T(1) : h[j] / length;
+                givensS[j] = length == 0 ? T(0) : h[j + 1] / length;
+                h[j] = length;
+                h[j + 1] = 0;
+                g[j + 1] = -givensS[j] * g[j];
+                g[j] = givensC[j] * g[j];
+                j++;
+
+                // the breakdown case means the solution is in the basis
+                if (std::abs(g[j]) <= target || length == 0) {
+                    break;
+                }
+            }
+
+            // x += M^-1 * V * y, where H * y = g
+            for (size_t i = j; i-- > 0;) {
+                T val = g[i];
+                for (size_t k = i + 1; k < j; k++) {
+                    val -= hessenberg[k * (restart + 1) + i] * g[k];
+                }
+                T diagonal = hessenberg[i * (restart + 1) + i];
+                g[i] = diagonal == T(0) ? T(0) : val / diagonal;
+            }
+            std::fill(r.begin(), r.end(), T(0));
+            for (size_t i = 0; i < j; i++) {
+                for (size_t m = 0; m < M; m++) {
+                    r[m] += g[i] * basis[i * M + m];
+                }
+            }
+            preconditioner.apply(r.data(), work.data());
+            for (size_t m = 0; m < M; m++) {
+                x[m] += work[m];
+            }
+        }
+    }
+
+    bool bicgstab(const T * b, T * x, RealT target, size_t & taken) {
+        // restarts from the true residual whenever the recurrence claims
+        // convergence or breaks down
+        while (true) {
+            if (residual(b, x) <= target) {
+                return true;
+            }
+            if (taken >= maxIterations) {
+                return false;
+            }
+            shadow = r;
+            std::fill(p.begin(), p.end(), T(0));
+            std::fill(v.begin(), v.end(), T(0));
+            T rho = 1;
+            T alpha = 1;
+            T omega = 1;
+
+            while (taken < maxIterations) {
+                taken++;
+                T rhoNext = dot(shadow.data(), r.data());
+                if (rhoNext == T(0)) {
+                    break;
+                }
+                T beta = (rhoNext / rho) * (alpha / omega);
+                rho = rhoNext;
+                for (size_t m = 0; m < M; m++) {
+                    p[m] = r[m] + beta * (p[m] - omega * v[m]);
+                }
+                preconditioner.apply(p.data(), pHat.data());
+                multiply(pHat.data(), v.data());
+                T shadowV = dot(shadow.data(), v.data());
+                if (shadowV == T(0)) {
+                    break;
+                }
+                alpha = rho / shadowV;
+                for (size_t m = 0; m < M; m++) {
+                    s[m] = r[m] - alpha * v[m];
+                }
+                if (norm(s.data()) <= target) {
+                    for (size_t m = 0; m < M; m++) {
+                        x[m] += alpha * pHat[m];
+                    }
+                    break;
+                }
+
+                preconditioner.apply(s.data(), sHat.data());
+                multiply(sHat.data(), t.data());
+                T tt = dot(t.data(), t.data());
+                omega = tt == T(0) ? T(0) : dot(t.data(), s.data()) / tt;
+                for (size_t m = 0; m < M; m++) {
+                    x[m] += alpha * pHat[m] + omega * sHat[m];
+                    r[m] = s[m] - omega * t[m];
+                }
+                if (omega == T(0) || norm(r.data()) <= target) {
+                    break;
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,698 @@
+#ifndef _LINEARSOLVER_HPP_INC_
+#define _LINEARSOLVER_HPP_INC_
+#include "Maths/DynamicMatrix.hpp"
+#include "Maths/SparseMatrix.hpp"
+#include "Maths/BandMatrix.hpp"
+#include "Maths/BlockTriangular.hpp"
+#include "Maths/Krylov.hpp"
+#include <string>
+#include <sstream>
+#include <iostream>
+
+/// @brief The method used to solve the MNA system
+enum class SolverType {
+    /// @brief Scatter the stamp into a dense matrix and use Matrix::luPair. Can be
+    ///        faster for very small circuits.
+    Dense,
+    /// @brief Sparse LU directly on the compressed stamp
+    Sparse,
+    /// @brief Partitions the unknowns into a linear block and a trailing block
+    ///        touched by non-linear stamps, and only refactorises the dense Schur
+    ///        complement of the linear block on each Newton iteration
+    Schur,
+    /// @brief Keeps the sparse LU of the Jacobian from the last change to its
+    ///        linear part, and applies the changes in the entries touched by
+    ///        non-linear stamps as a Sherman-Morrison-Woodbury update
+    Woodbury,
+    /// @brief Reverse Cuthill-McKee ordering followed by a banded LU
+    Banded,
+    /// @brief Permutes G to block triangular form and factorises each diagonal
+    ///        block separately with a sparse LU
+    BTF,
+    /// @brief Restarted GMRES preconditioned by an incomplete LU, for circuits
+    ///        too large to factorise directly
+    GMRES,
+    /// @brief BiCGStab preconditioned by an incomplete LU
+    BiCGStab,
+};
+
+/// @brief Parses the argument of the .solver netlist directive
+///
+/// @param name The name of the solver, e.g. "dense"
+/// @param type Set to the matching solver type if one is found
+///
+/// @return true if the name was recognised
+inline bool
+parseSolverType(const std::string & name, SolverType & type) {
+    if (name == "dense") {
+        type = SolverType::Dense;
+    } else if (name == "sparse") {
+        type = SolverType::Sparse;
+    } else if (name == "schur") {
+        type = SolverType::Schur;
+    } else if (name == "woodbury") {
+        type = SolverType::Woodbury;
+    } else if (name == "banded") {
+        type = SolverType::Banded;
+    } else if (name == "btf") {
+        type = SolverType::BTF;
+    } else if (name == "gmres") {
+        type = SolverType::GMRES;
+    } else if (name == "bicgstab") {
+        type = SolverType::BiCGStab;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// @brief The precision the dense factorisations are computed in
+enum class Precision {
+    /// @brief Factorise and solve in full precision
+    Double,
+    /// @brief Factorise in single precision and refine the solution to full
+    ///        precision, see Matrix::leftDivide
+    Mixed,
+};
+
+/// @brief Parses the argument of the .precision netlist directive
+///
+/// @param name The name of the precision, e.g. "mixed"
+/// @param precision Set to the matching precision if one is found
+///
+/// @return true if the name was recognised
+inline bool
+parsePrecision(const std::string & name, Precision & precision) {
+    if (name == "double") {
+        precision = Precision::Double;
+    } else if (name == "mixed") {
+        precision = Precision::Mixed;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// @brief Factorises and solves the sparse stamp matrix using the selected method.
+///        Holds all the preallocated space needed to do so.
+///
+/// @details For the Schur solver the unknowns are reordered so that those touched
+///          by non-linear stamps (N) come after the rest (L):
+/// \verbatim
+///       | A | B |
+///   G = ----|----
+///       | C | D |\endverbatim
+///          Only D holds non-linear contributions, so A is factorised and
+///          W = A^-1 * B computed only when the linear part of G changes. Each
+///          Newton iteration then factorises the dense Schur complement
+///          S = D - C * W, whose size is the number of non-linear unknowns.
+///          \n\n
+///          The Woodbury solver factorises the whole of G whenever its linear
+///          part changes, as G0. Between those factorisations only the block of
+///          entries between non-linear unknowns, selected by E, changes:
+///          G = G0 + E * Delta * E^T. With Z = G0^-1 * E, precomputed,
+/// \verbatim
+///   y = G0^-1 * b
+///   G^-1 * b = y - Z * (I + Delta * E^T * Z)^-1 * Delta * E^T * y\endverbatim
+///          so each Newton iteration only factorises the dense capacitance
+///          matrix I + Delta * E^T * Z, of the size of the non-linear block.
+///
+/// @tparam T the value type
+template<typename T>
+struct LinearSolver {
+    SolverType type = SolverType::Sparse;
+    /// @brief Applies to the dense solver and the Schur complement. The sparse
+    ///        factorisations are always in full precision.
+    Precision precision = Precision::Double;
+    size_t M = 0;
+
+    SparseLU<T> sparseLU;
+    BandLU<T> bandLU;
+    BlockTriangularLU<T> btfLU;
+    KrylovSolver<T> krylov;
+
+    /// @brief Preallocated space for the dense fallback
+    LUPair<T> denseLU;
+    MixedLUPair<T> denseMixedLU;
+    Matrix<T> denseG;
+    Matrix<T> scratchSpace;
+
+    /// @brief The unknowns of each block, in their original numbering
+    std::vector<size_t> linearUnknowns;
+    std::vector<size_t> nonLinearUnknowns;
+
+    LinearSolver(size_t M = 0, SolverType type = SolverType::Sparse,
+                 Ordering ordering = Ordering::AMD,
+                 Precision precision = Precision::Double,
+                 Preconditioner preconditioner = Preconditioner::ILUT)
+        : type(type), precision(precision), M(M), denseLU(0), denseMixedLU(0),
+          denseG(0, 0), scratchSpace(0, 0) {
+        sparseLU.ordering = ordering;
+        btfLU.ordering = ordering;
+        krylov.preconditioner.ordering = ordering;
+        krylov.preconditioner.type = preconditioner;
+        if (type == SolverType::BiCGStab) {
+            krylov.method = KrylovMethod::BiCGStab;
+        }
+        if (type == SolverType::Dense) {
+            if (precision == Precision::Mixed) {
+                denseMixedLU = MixedLUPair<T>(M);
+            } else {
+                denseLU = LUPair<T>(M);
+            }
+            denseG = Matrix<T>(M, M);
+            scratchSpace = Matrix<T>(M, 1);
+        }
+    }
+
+    /// @brief Marks the unknowns that non-linear stamps write to. Only used by
+    ///        the Schur and Woodbury solvers.
+    ///
+    /// @param nonLinear nonLinear[i] is set if unknown i is touched by a
+    ///                  non-linear stamp
+    void setNonLinearUnknowns(const std::vector<bool> & nonLinear) {
+        requestedNonLinear = nonLinear;
+        partitionPattern.reset();
+    }
+
+    /// @brief Computes the LU factorisation of G
+    ///
+    /// @param G The matrix to factorise
+    /// @param linearPartChanged Whether anything but the non-linear contributions
+    ///                          changed since the last call. Only used by the
+    ///                          Schur and Woodbury solvers.
+    void factorise(const SparseMatrix<T> & G, bool linearPartChanged = true) {
+        assert(G.M == M);
+        switch (type) {
+            case SolverType::Dense:
+                G.toDense(denseG);
+                if (precision == Precision::Mixed) {
+                    denseG.luPair(denseMixedLU);
+                } else {
+                    denseG.luPair(denseLU);
+                }
+                break;
+            case SolverType::Sparse:
+                sparseLU.factorise(G);
+                break;
+            case SolverType::Woodbury:
+                if (G.pattern != partitionPattern ||
+                    G.pattern->version != partitionVersion) {
+                    selectUpdatedEntries(G);
+                    linearPartChanged = true;
+                }
+                if (linearPartChanged) {
+                    factoriseReference(G);
+                    if (type != SolverType::Woodbury) {
+                        // fell back to the sparse solver
+                        return;
+                    }
+                }
+                factoriseCapacitance(G);
+                break;
+            case SolverType::Banded:
+                bandLU.factorise(G);
+                break;
+            case SolverType::BTF:
+                btfLU.factorise(G);
+                break;
+            case SolverType::GMRES:
+            case SolverType::BiCGStab:
+                krylov.setMatrix(G);
+                break;
+            case SolverType::Schur:
+                if (G.pattern != partitionPattern ||
+                    G.pattern->version != partitionVersion) {
+                    partition(G);
+                    linearPartChanged = true;
+                }
+                if (linearPartChanged) {
+                    factoriseLinearBlock(G);
+                    if (type != SolverType::Schur) {
+                        // fell back to the sparse solver
+                        return;
+                    }
+                }
+                factoriseSchurComplement(G);
+                break;
+        }
+    }
+
+    /// @brief Solves G * dest = rhs using the last factorisation. The Krylov
+    ///        solvers start from the value passed in dest.
+    void solve(const Matrix<T> & rhs, Matrix<T> & dest) {
+        switch (type) {
+            case SolverType::Dense:
+                if (precision == Precision::Mixed) {
+                    denseG.leftDivide(rhs, denseMixedLU, scratchSpace, dest);
+                } else {
+                    denseG.leftDivide(rhs, denseLU, scratchSpace, dest);
+                }
+                break;
+            case SolverType::Sparse:
+                sparseLU.solve(rhs, dest);
+                break;
+            case SolverType::Woodbury:
+                solveWoodbury(rhs, dest);
+                break;
+            case SolverType::Banded:
+                bandLU.solve(rhs, dest);
+                break;
+            case SolverType::BTF:
+                btfLU.solve(rhs, dest);
+                break;
+            case SolverType::GMRES:
+            case SolverType::BiCGStab:
+                krylov.solve(rhs, dest);
+                break;
+            case SolverType::Schur:
+                solveSchur(rhs, dest);
+                break;
+        }
+    }
+
+    /// @brief Describes how much fill the ordering saved in the last
+    ///        factorisation
+    std::string fillReport() const {
+        std::stringstream report;
+        switch (type) {
+            case SolverType::Dense:
+                report << "Dense LU: " << M * M << " entries";
+                report << mixedReport(denseMixedLU);
+                break;
+            case SolverType::Banded:
+                report << "Banded LU: bandwidth (lower/upper) " << bandLU.naturalKL
+                       << "/" << bandLU.naturalKU << " natural, " << bandLU.kl << "/"
+                       << bandLU.ku << " after rcm, " << bandLU.nnz()
+                       << " entries stored";
+                break;
+            case SolverType::BTF:
+                report << "Block triangular LU: " << btfLU.numBlocks()
+                       << " diagonal blocks, the largest of " << btfLU.largestBlock()
+                       << ", " << btfLU.nnz() << " entries stored";
+                break;
+            case SolverType::GMRES:
+            case SolverType::BiCGStab: {
+                size_t solves = std::max<size_t>(krylov.solves, 1);
+                report << (type == SolverType::GMRES ? "GMRES" : "BiCGStab")
+                       << " with "
+                       << preconditionerName(krylov.preconditioner.type) << " ("
+                       << orderingName(krylov.preconditioner.ordering)
+                       << "): " << krylov.solves << " solves, "
+                       << double(krylov.iterations) / solves
+                       << " iterations on average, " << krylov.preconditionerBuilds
+                       << " preconditioner builds, " << krylov.preconditioner.nnz()
+                       << " entries stored, " << krylov.unconverged
+                       << " solves did not converge";
+                break;
+            }
+            case SolverType::Sparse:
+            case SolverType::Schur:
+            case SolverType::Woodbury:
+                report << "Sparse LU fill (nnz of L + U): "
+                       << sparseLU.predictedNNZ(Ordering::Natural)
+                       << " predicted natural, "
+                       << sparseLU.predictedNNZ(sparseLU.ordering)
+                       << " predicted " << orderingName(sparseLU.ordering) << ", "
+                       << sparseLU.nnz() << " actual";
+                if (sparseLU.denseTailSize()) {
+                    report << ", refactorised with a dense tail of "
+                           << sparseLU.denseTailSize();
+                }
+                if (type == SolverType::Schur) {
+                    report << " (linear block of " << linearUnknowns.size()
+                           << "), Schur complement of " << nonLinearUnknowns.size();
+                    report << mixedReport(schurMixedLU);
+                }
+                if (type == SolverType::Woodbury) {
+                    report << ", Woodbury updates of rank "
+                           << nonLinearUnknowns.size() << " in " << updatedSolves
+                           << " of " << woodburySolves << " solves";
+                }
+                break;
+        }
+        return report.str();
+    }
+
+private:
+    /// @brief Describes how the refined solves went, if precision is Mixed
+    std::string mixedReport(const MixedLUPair<T> & lu) const {
+        std::stringstream report;
+        if (precision == Precision::Mixed && lu.solves) {
+            report << ", mixed precision: " << lu.solves << " refined solves, "
+                   << double(lu.refinements) / lu.solves
+                   << " corrections on average, " << lu.fallbacks
+                   << " fallbacks to full precision";
+        }
+        return report.str();
+    }
+
+    /// @brief Schur solver state. blockIndex gives the position of each unknown
+    ///        within its block.
+    std::vector<bool> requestedNonLinear;
+    std::vector<bool> isNonLinear;
+    std::vector<size_t> blockIndex;
+    std::shared_ptr<SparsityPattern> partitionPattern;
+    size_t partitionVersion = 0;
+
+    SparseMatrix<T> A = SparseMatrix<T>(0, 0);
+    SparseMatrix<T> C = SparseMatrix<T>(0, 0);
+    /// @brief B transposed, then W = A^-1 * B transposed. Row j holds column j.
+    Matrix<T> Bt = Matrix<T>(0, 0);
+    Matrix<T> Wt = Matrix<T>(0, 0);
+    /// @brief -C * W, to which D is added to form the Schur complement
+    Matrix<T> minusCW = Matrix<T>(0, 0);
+    Matrix<T> schur = Matrix<T>(0, 0);
+    LUPair<T> schurLU = LUPair<T>(0);
+    MixedLUPair<T> schurMixedLU = MixedLUPair<T>(0);
+
+    Matrix<T> rhsL = Matrix<T>(0, 0);
+    Matrix<T> yL = Matrix<T>(0, 0);
+    Matrix<T> rhsN = Matrix<T>(0, 0);
+    Matrix<T> xN = Matrix<T>(0, 0);
+    Matrix<T> scratchN = Matrix<T>(0, 0);
+
+    /// @brief Woodbury solver state. The slots of G between non-linear unknowns,
+    ///        their block row and column, and their values in G0.
+    std::vector<size_t> updateSlot;
+    std::vector<size_t> updateRow;
+    std::vector<size_t> updateColumn;
+    std::vector<T> referenceValue;
+    std::vector<T> delta;
+    /// @brief Z = G0^-1 * E transposed, row j holds column j
+    Matrix<T> Zt = Matrix<T>(0, 0);
+    Matrix<T> capacitance = Matrix<T>(0, 0);
+    LUPair<T> capacitanceLU = LUPair<T>(0);
+    Matrix<T> unitColumn = Matrix<T>(0, 0);
+    /// @brief Set when G differs from G0, i.e. the update isn't zero
+    bool hasUpdate = false;
+    size_t woodburySolves = 0;
+    size_t updatedSolves = 0;
+
+    /// @brief Splits the unknowns into the two blocks and allocates the space
+    ///        for them.
+    void partition(const SparseMatrix<T> & G) {
+        const SparsityPattern & pat = *G.pattern;
+        isNonLinear = requestedNonLinear;
+        isNonLinear.resize(M, false);
+
+        // An unknown with an empty row or column in A would make A singular (e.g.
+        // the current of a voltage source between two non-linear nodes), so it
+        // joins the non-linear block. Repeat until nothing moves.
+        std::vector<size_t> rowCount(M);
+        std::vector<size_t> colCount(M);
+        bool moved = true;
+        while (moved) {
+            std::fill(rowCount.begin(), rowCount.end(), 0);
+            std::fill(colCount.begin(), colCount.end(), 0);
+            for (size_t m = 0; m < M; m++) {
+                if (isNonLinear[m]) {
+                    continue;
+                }
+                for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                    if (!isNonLinear[pat.column[k]]) {
+                        rowCount[m]++;
+                        colCount[pat.column[k]]++;
+                    }
+                }
+            }
+            moved = false;
+            for (size_t m = 0; m < M; m++) {
+                if (!isNonLinear[m] && (rowCount[m] == 0 || colCount[m] == 0)) {
+                    isNonLinear[m] = true;
+                    moved = true;
+                }
+            }
+        }
+
+        linearUnknowns.clear();
+        nonLinearUnknowns.clear();
+        blockIndex.resize(M);
+        for (size_t m = 0; m < M; m++) {
+            if (isNonLinear[m]) {
+                blockIndex[m] = nonLinearUnknowns.size();
+                nonLinearUnknowns.emplace_back(m);
+            } else {
+                blockIndex[m] = linearUnknowns.size();
+                linearUnknowns.emplace_back(m);
+            }
+        }
+
+        size_t nL = linearUnknowns.size();
+        size_t nN = nonLinearUnknowns.size();
+        A = SparseMatrix<T>(nL, nL);
+        C = SparseMatrix<T>(nN, nL);
+        Bt = Matrix<T>(nN, nL);
+        Wt = Matrix<T>(nN, nL);
+        minusCW = Matrix<T>(nN, nN);
+        schur = Matrix<T>(nN, nN);
+        if (precision == Precision::Mixed) {
+            schurMixedLU = MixedLUPair<T>(nN);
+        } else {
+            schurLU = LUPair<T>(nN);
+        }
+        rhsL = Matrix<T>(nL, 1);
+        yL = Matrix<T>(nL, 1);
+        rhsN = Matrix<T>(nN, 1);
+        xN = Matrix<T>(nN, 1);
+        scratchN = Matrix<T>(nN, 1);
+
+        partitionPattern = G.pattern;
+        partitionVersion = pat.version;
+    }
+
+    /// @brief Factorises A, and computes W = A^-1 * B and -C * W
+    void factoriseLinearBlock(const SparseMatrix<T> & G) {
+        const SparsityPattern & pat = *G.pattern;
+        A.fill(0);
+        C.fill(0);
+        Bt.fill(0);
+        for (size_t m = 0; m < M; m++) {
+            size_t bm = blockIndex[m];
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                size_t n = pat.column[k];
+                size_t bn = blockIndex[n];
+                if (!isNonLinear[m] && !isNonLinear[n]) {
+                    A(bm, bn) += G.data[k];
+                } else if (!isNonLinear[m]) {
+                    Bt(bn, bm) += G.data[k];
+                } else if (!isNonLinear[n]) {
+                    C(bm, bn) += G.data[k];
+                }
+            }
+        }
+
+        sparseLU.factorise(A);
+        if (sparseLU.singular) {
+            std::cout << "Schur solver: the linear block is singular, falling back "
+                         "to the sparse solver"
+                      << std::endl;
+            type = SolverType::Sparse;
+            Ordering ordering = sparseLU.ordering;
+            sparseLU = SparseLU<T>();
+            sparseLU.ordering = ordering;
+            sparseLU.factorise(G);
+            return;
+        }
+
+        size_t nL = linearUnknowns.size();
+        size_t nN = nonLinearUnknowns.size();
+        for (size_t j = 0; j < nN; j++) {
+            std::copy(Bt.data.begin() + j * nL, Bt.data.begin() + (j + 1) * nL,
+                      rhsL.data.begin());
+            sparseLU.solve(rhsL, Wt.data.begin() + j * nL);
+        }
+
+        minusCW.fill(0);
+        const SparsityPattern & cPat = *C.pattern;
+        for (size_t r = 0; r < nN; r++) {
+            for (size_t k = cPat.rowStart[r]; k < cPat.rowStart[r + 1]; k++) {
+                size_t i = cPat.column[k];
+                for (size_t j = 0; j < nN; j++) {
+                    minusCW(r, j) -= C.data[k] * Wt(j, i);
+                }
+            }
+        }
+    }
+
+    /// @brief Forms S = D - C * W and factorises it
+    void factoriseSchurComplement(const SparseMatrix<T> & G) {
+        // every unknown is linear, so there is nothing to factorise
+        if (nonLinearUnknowns.empty()) {
+            return;
+        }
+        const SparsityPattern & pat = *G.pattern;
+        schur = minusCW;
+        for (size_t m : nonLinearUnknowns) {
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                size_t n = pat.column[k];
+                if (isNonLinear[n]) {
+                    schur(blockIndex[m], blockIndex[n]) += G.data[k];
+                }
+            }
+        }
+        if (precision == Precision::Mixed) {
+            schur.luPair(schurMixedLU);
+        } else {
+            schur.luPair(schurLU);
+        }
+    }
+
+    /// @brief Finds the entries of G the Woodbury update applies to, and
+    ///        allocates the space for it
+    void selectUpdatedEntries(const SparseMatrix<T> & G) {
+        const SparsityPattern & pat = *G.pattern;
+        isNonLinear = requestedNonLinear;
+        isNonLinear.resize(M, false);
+
+        nonLinearUnknowns.clear();
+        blockIndex.resize(M);
+        for (size_t m = 0; m < M; m++) {
+            if (isNonLinear[m]) {
+                blockIndex[m] = nonLinearUnknowns.size();
+                nonLinearUnknowns.emplace_back(m);
+            }
+        }
+
+        updateSlot.clear();
+        updateRow.clear();
+        updateColumn.clear();
+        for (size_t m : nonLinearUnknowns) {
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                if (isNonLinear[pat.column[k]]) {
+                    updateSlot.emplace_back(k);
+                    updateRow.emplace_back(blockIndex[m]);
+                    updateColumn.emplace_back(blockIndex[pat.column[k]]);
+                }
+            }
+        }
+        referenceValue.assign(updateSlot.size(), 0);
+        delta.assign(updateSlot.size(), 0);
+
+        size_t nN = nonLinearUnknowns.size();
+        Zt = Matrix<T>(nN, M);
+        capacitance = Matrix<T>(nN, nN);
+        capacitanceLU = LUPair<T>(nN);
+        unitColumn = Matrix<T>(M, 1);
+        rhsN = Matrix<T>(nN, 1);
+        xN = Matrix<T>(nN, 1);
+        scratchN = Matrix<T>(nN, 1);
+
+        partitionPattern = G.pattern;
+        partitionVersion = pat.version;
+    }
+
+    /// @brief Factorises G as G0, and computes Z = G0^-1 * E
+    void factoriseReference(const SparseMatrix<T> & G) {
+        sparseLU.factorise(G);
+        if (sparseLU.singular) {
+            std::cout << "Woodbury solver: the Jacobian is singular, falling back "
+                         "to the sparse solver"
+                      << std::endl;
+            type = SolverType::Sparse;
+            return;
+        }
+
+        for (size_t k = 0; k < updateSlot.size(); k++) {
+            referenceValue[k] = G.data[updateSlot[k]];
+        }
+        for (size_t j = 0; j < nonLinearUnknowns.size(); j++) {
+            unitColumn.fill(0);
+            unitColumn.data[nonLinearUnknowns[j]] = 1;
+            sparseLU.solve(unitColumn, Zt.data.begin() + j * M);
+        }
+    }
+
+    /// @brief Forms Delta = G - G0 on the non-linear block, and factorises
+    ///        I + Delta * E^T * Z
+    void factoriseCapacitance(const SparseMatrix<T> & G) {
+        hasUpdate = false;
+        for (size_t k = 0; k < updateSlot.size(); k++) {
+            delta[k] = G.data[updateSlot[k]] - referenceValue[k];
+            hasUpdate |= delta[k] != T(0);
+        }
+        if (!hasUpdate) {
+            return;
+        }
+
+        size_t nN = nonLinearUnknowns.size();
+        capacitance.fill(0);
+        for (size_t i = 0; i < nN; i++) {
+            capacitance(i, i) = 1;
+        }
+        for (size_t k = 0; k < updateSlot.size(); k++) {
+            size_t i = updateRow[k];
+            size_t row = nonLinearUnknowns[updateColumn[k]];
+            for (size_t b = 0; b < nN; b++) {
+                capacitance(i, b) += delta[k] * Zt.data[b * M + row];
+            }
+        }
+        capacitance.luPair(capacitanceLU);
+    }
+
+    void solveWoodbury(const Matrix<T> & rhs, Matrix<T> & dest) {
+        woodburySolves++;
+        sparseLU.solve(rhs, dest);
+        if (!hasUpdate) {
+            return;
+        }
+        updatedSolves++;
+
+        // Delta * E^T * y
+        rhsN.fill(0);
+        for (size_t k = 0; k < updateSlot.size(); k++) {
+            rhsN.data[updateRow[k]] +=
+                delta[k] * dest.data[nonLinearUnknowns[updateColumn[k]]];
+        }
+        capacitance.leftDivide(rhsN, capacitanceLU, scratchN, xN);
+
+        size_t nN = nonLinearUnknowns.size();
+        for (size_t j = 0; j < nN; j++) {
+            T xj = xN.data[j];
+            for (size_t m = 0; m < M; m++) {
+                dest.data[m] -= Zt.data[j * M + m] * xj;
+            }
+        }
+    }
+
+    void solveSchur(const Matrix<T> & rhs, Matrix<T> & dest) {
+        size_t nL = linearUnknowns.size();
+        size_t nN = nonLinearUnknowns.size();
+
+        // y = A^-1 * s_L
+        for (size_t i = 0; i < nL; i++) {
+            rhsL.data[i] = rhs.data[linearUnknowns[i]];
+        }
+        sparseLU.solve(rhsL, yL);
+
+        // S * x_N = s_N - C * y
+        if (nN) {
+            C.multiply(yL, rhsN);
+            for (size_t r = 0; r < nN; r++) {
+                rhsN.data[r] = rhs.data[nonLinearUnknowns[r]] - rhsN.data[r];
+            }
+            if (precision == Precision::Mixed) {
+                schur.leftDivide(rhsN, schurMixedLU, scratchN, xN);
+            } else {
+                schur.leftDivide(rhsN, schurLU, scratchN, xN);
+            }
+        }
+
+        // x_L = y - W * x_N
+        for (size_t j = 0; j < nN; j++) {
+            T xj = xN.data[j];
+            for (size_t i = 0; i < nL; i++) {
+                yL.data[i] -= Wt.data[j * nL + i] * xj;
+            }
+        }
+
+        for (size_t i = 0; i < nL; i++) {
+            dest.data[linearUnknowns[i]] = yL.data[i];
+        }
+        for (size_t r = 0; r < nN; r++) {
+            dest.data[nonLinearUnknowns[r]] = xN.data[r];
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef _ORDERING_HPP_INC_
+#define _ORDERING_HPP_INC_
+#include <vector>
+#include <set>
+#include <string>
+#include <numeric>
+#include <algorithm>
+#include <limits>
+
+/// @brief Fill reducing orderings for the sparse factorisations. The functions
+///        here work on the pattern of a square compressed sparse row matrix, and
+///        treat it as symmetric (i.e. work on the pattern of A + A^T), which suits
+///        the nearly symmetric MNA matrices.
+
+/// @brief The orderings that can be applied to the unknowns before factorising
+enum class Ordering {
+    /// @brief The node numbers from the netlist
+    Natural,
+    /// @brief Approximate minimum degree, for general sparse matrices
+    AMD,
+    /// @brief Reverse Cuthill-McKee, which reduces the bandwidth. Used for
+    ///        ladder / transmission line like circuits.
+    RCM,
+};
+
+/// @brief Parses the argument of the .ordering netlist directive
+///
+/// @param name The name of the ordering, e.g. "amd"
+/// @param ordering Set to the matching ordering if one is found
+///
+/// @return true if the name was recognised
+inline bool
+parseOrdering(const std::string & name, Ordering & ordering) {
+    if (name == "natural") {
+        ordering = Ordering::Natural;
+    } else if (name == "amd") {
+        ordering = Ordering::AMD;
+    } else if (name == "rcm") {
+        ordering = Ordering::RCM;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline std::string
+orderingName(Ordering ordering) {
+    switch (ordering) {
+        case Ordering::Natural:
+            return "natural";
+        case Ordering::AMD:
+            return "amd";
+        case Ordering::RCM:
+            return "rcm";
+    }
+    return "";
+}
+
+/// @brief Builds the adjacency lists of the graph of A + A^T, without self loops
+///
+/// @param M The number of rows
+/// @param rowStart The row pointers of A
+/// @param column The column indices of A
+///
+/// @return The sorted neighbours of each node
+inline std::vector<std::vector<size_t> >
+symmetricAdjacency(size_t M, const std::vector<size_t> & rowStart,
+                   const std::vector<size_t> & column) {
+    std::vector<std::vector<size_t> > adjacency(M);
+    for (size_t m = 0; m < M; m++) {
+        for (size_t k = rowStart[m]; k < rowStart[m + 1]; k++) {
+            size_t n = column[k];
+            if (n != m) {
+                adjacency[m].emplace_back(n);
+                adjacency[n].emplace_back(m);
+            }
+        }
+    }
+    for (auto & neighbours : adjacency) {
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()),
+                         neighbours.end());
+    }
+    return adjacency;
+}
+
+/// @brief Computes an approximate minimum degree ordering
+///
+/// @details Eliminates nodes on a quotient graph, where each eliminated node
+///          becomes an element representing the clique it would have formed.
+///          Degrees are the approximate external degrees of Amestoy, Davis and
+///          Duff, so the cost stays close to the size of the graph. Supervariable
+///          detection and aggressive absorption are not done.
+///
+/// @return order, where order[k] is the original index of the k-th unknown
+inline std::vector<size_t>
+approximateMinimumDegree(size_t M, const std::vector<size_t> & rowStart,
+                         const std::vector<size_t> & column) {
+    constexpr size_t npos = std::numeric_limits<size_t>::max();
+    auto adjacency = symmetricAdjacency(M, rowStart, column);
+    // the elements each variable is adjacent to, and the variables of each
+    // element. An element is named after the variable it was eliminated as.
+    std::vector<std::vector<size_t> > elements(M);
+    std::vector<std::vector<size_t> > members(M);
+    std::vector<bool> eliminated(M, false);
+    std::vector<bool> absorbed(M, false);
+    std::vector<size_t> degree(M);
+    std::vector<size_t> mark(M, npos);
+    std::vector<size_t> externalMark(M, npos);
+    std::vector<size_t> external(M, 0);
+
+    std::set<std::pair<size_t, size_t> > queue;
+    for (size_t i = 0; i < M; i++) {
+        degree[i] = adjacency[i].size();
+        queue.emplace(degree[i], i);
+    }
+
+    std::vector<size_t> order;
+    order.reserve(M);
+    std::vector<size_t> lp;
+    for (size_t k = 0; k < M; k++) {
+        size_t p = queue.begin()->second;
+        queue.erase(queue.begin());
+        order.emplace_back(p);
+        eliminated[p] = true;
+
+        // Lp, the variables adjacent to p directly or through its elements, which
+        // get absorbed into the new element p
+        lp.clear();
+        mark[p] = p;
+        for (size_t v : adjacency[p]) {
+            if (!eliminated[v] && mark[v] != p) {
+                mark[v] = p;
+                lp.emplace_back(v);
+            }
+        }
+        for (size_t e : elements[p]) {
+            for (size_t v : members[e]) {
+                if (!eliminated[v] && mark[v] != p) {
+                    mark[v] = p;
+                    lp.emplace_back(v);
+                }
+            }
+            absorbed[e] = true;
+            std::vector<size_t>().swap(members[e]);
+        }
+        members[p] = lp;
+        std::vector<size_t>().swap(adjacency[p]);
+        std::vector<size_t>().swap(elements[p]);
+
+        // |Le \ Lp| for every other element next to Lp
+        for (size_t i : lp) {
+            for (size_t e : elements[i]) {
+                if (absorbed[e]) {
+                    continue;
+                }
+                if (externalMark[e] != p) {
+                    externalMark[e] = p;
+                    external[e] = members[e].size();
+                }
+                external[e]--;
+            }
+        }
+
+        size_t remaining = M - k - 1;
+        for (size_t i : lp) {
+            queue.erase({degree[i], i});
+
+            // edges to Lp are now represented by element p
+            auto & adj = adjacency[i];
+            adj.erase(std::remove_if(adj.begin(), adj.end(),
+                                     [&](size_t v) {
+                                         return eliminated[v] || mark[v] == p;
+                                     }),
+                      adj.end());
+            auto & elems = elements[i];
+            elems.erase(std::remove_if(elems.begin(), elems.end(),
+                                       [&](size_t e) { return absorbed[e]; }),
+                        elems.end());
+
+            size_t d = adj.size() + lp.size() - 1;
+            for (size_t e : elems) {
+                d += external[e];
+            }
+            elems.emplace_back(p);
+
+            d = std::min({d, degree[i] + lp.size(), remaining - 1});
+            degree[i] = d;
+            queue.emplace(d, i);
+        }
+    }
+    return order;
+}
+
+/// @brief Computes a reverse Cuthill-McKee ordering, which clusters the entries
+///        around the diagonal.
+///
+/// @details Each connected component is started from a pseudo-peripheral node,
+///          found by repeated breadth first searches from a minimum degree node.
+///
+/// @return order, where order[k] is the original index of the k-th unknown
+inline std::vector<size_t>
+reverseCuthillMcKee(size_t M, const std::vector<size_t> & rowStart,
+                    const std::vector<size_t> & column) {
+    auto adjacency = symmetricAdjacency(M, rowStart, column);
+    for (auto & neighbours : adjacency) {
+        std::sort(neighbours.begin(), neighbours.end(), [&](size_t a, size_t b) {
+            return adjacency[a].size() < adjacency[b].size();
+        });
+    }
+
+    std::vector<size_t> order;
+    order.reserve(M);
+    std::vector<bool> visited(M, false);
+    std::vector<size_t> level(M, 0);
+    std::vector<size_t> searchMark(M, 0);
+    size_t searchCount = 0;
+
+    // Breadth first search within the unvisited nodes. Returns the depth, and
+    // sets last to the minimum degree node of the deepest level.
+    std::vector<size_t> bfsQueue;
+    auto levelSearch = [&](size_t start, size_t & last) {
+        searchCount++;
+        bfsQueue.clear();
+        bfsQueue.emplace_back(start);
+        searchMark[start] = searchCount;
+        level[start] = 0;
+        size_t depth = 0;
+        last = start;
+        for (size_t h = 0; h < bfsQueue.size(); h++) {
+            size_t v = bfsQueue[h];
+            if (level[v] > depth ||
+                (level[v] == depth &&
+                 adjacency[v].size() < adjacency[last].size())) {
+                depth = level[v];
+                last = v;
+            }
+            for (size_t n : adjacency[v]) {
+                if (!visited[n] && searchMark[n] != searchCount) {
+                    searchMark[n] = searchCount;
+                    level[n] = level[v] + 1;
+                    bfsQueue.emplace_back(n);
+                }
+            }
+        }
+        return depth;
+    };
+
+    while (order.size() < M) {
+        size_t start = M;
+        for (size_t i = 0; i < M; i++) {
+            if (!visited[i] &&
+                (start == M || adjacency[i].size() < adjacency[start].size())) {
+                start = i;
+            }
+        }
+
+        size_t last;
+        size_t depth = levelSearch(start, last);
+        for (size_t sweep = 0; sweep < 4 && last != start; sweep++) {
+            size_t next;
+            size_t newDepth = levelSearch(last, next);
+            if (newDepth <= depth) {
+                break;
+            }
+            start = last;
+            last = next;
+            depth = newDepth;
+        }
+
+        size_t head = order.size();
+        order.emplace_back(start);
+        visited[start] = true;
+        for (; head < order.size(); head++) {
+            for (size_t n : adjacency[order[head]]) {
+                if (!visited[n]) {
+                    visited[n] = true;
+                    order.emplace_back(n);
+                }
+            }
+        }
+    }
+
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+/// @brief Computes an ordering of the given type
+inline std::vector<size_t>
+computeOrdering(Ordering ordering, size_t M, const std::vector<size_t> & rowStart,
+                const std::vector<size_t> & column) {
+    switch (ordering) {
+        case Ordering::AMD:
+            return approximateMinimumDegree(M, rowStart, column);
+        case Ordering::RCM:
+            return reverseCuthillMcKee(M, rowStart, column);
+        case Ordering::Natural:
+            break;
+    }
+    std::vector<size_t> order(M);
+    std::iota(order.begin(), order.end(), 0);
+    return order;
+}
+
+/// @brief Predicts the number of entries in the Cholesky factor L (including the
+///        diagonal) of the pattern of A + A^T permuted by order. With diagonal
+///        pivoting, the LU factors hold 2 * fill - M entries.
+inline size_t
+choleskyFill(size_t M, const std::vector<size_t> & rowStart,
+             const std::vector<size_t> & column, const std::vector<size_t> & order) {
+    constexpr size_t npos = std::numeric_limits<size_t>::max();
+    auto adjacency = symmetricAdjacency(M, rowStart, column);
+    std::vector<size_t> inverse(M);
+    for (size_t k = 0; k < M; k++) {
+        inverse[order[k]] = k;
+    }
+
+    // count the entries of each row of L by walking the row subtrees of the
+    // elimination tree
+    std::vector<size_t> parent(M, npos);
+    std::vector<size_t> flag(M, npos);
+    size_t count = M;
+    for (size_t k = 0; k < M; k++) {
+        flag[k] = k;
+        for (size_t v : adjacency[order[k]]) {
+            size_t j = inverse[v];
+            if (j > k) {
+                continue;
+            }
+            while (flag[j] != k) {
+                flag[j] = k;
+                count++;
+                if (parent[j] == npos) {
+                    parent[j] = k;
+                }
+                j = parent[j];
+            }
+        }
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef _SPSCQUEUE_HPP_INC_
+#define _SPSCQUEUE_HPP_INC_
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <vector>
+
+/// @brief A bounded lock-free queue between one producer thread and one
+///        consumer thread.
+///
+/// @details The entries live in a ring whose length is a power of two. head is
+///          only written by the consumer and tail by the producer, each with
+///          release ordering after the entry is read or written, so neither
+///          side takes a lock. push and pop block when the queue is full or
+///          empty by waiting on the other side's index, which is how the
+///          producer is held back when the consumer falls behind.
+///
+/// @tparam T The entry type. It should be cheap to copy.
+template<typename T>
+class SPSCQueue {
+public:
+    /// @param capacity The fewest entries the queue holds
+    explicit SPSCQueue(size_t capacity)
+        : entries(std::bit_ceil(std::max<size_t>(capacity, 1))),
+          mask(entries.size() - 1) {
+    }
+
+    SPSCQueue(const SPSCQueue &) = delete;
+    SPSCQueue & operator=(const SPSCQueue &) = delete;
+
+    /// @brief Adds an entry unless the queue is full. Producer only.
+    ///
+    /// @return Whether the entry was added
+    bool tryPush(const T & entry) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == entries.size()) {
+            return false;
+        }
+        entries[t & mask] = entry;
+        tail.store(t + 1, std::memory_order_release);
+        tail.notify_one();
+        return true;
+    }
+
+    /// @brief Removes the oldest entry unless the queue is empty. Consumer
+    ///        only.
+    ///
+    /// @return Whether an entry was removed
+    bool tryPop(T & entry) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        entry = entries[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        head.notify_one();
+        return true;
+    }
+
+    /// @brief Adds an entry, waiting for the consumer to make room if the
+    ///        queue is full. Producer only.
+    void push(const T & entry) {
+        while (!tryPush(entry)) {
+            head.wait(tail.load(std::memory_order_relaxed) - entries.size(),
+                      std::memory_order_acquire);
+        }
+    }
+
+    /// @brief Removes the oldest entry, waiting for the producer if the queue
+    ///        is empty. Consumer only.
+    T pop() {
+        T entry;
+        while (!tryPop(entry)) {
+            tail.wait(head.load(std::memory_order_relaxed),
+                      std::memory_order_acquire);
+        }
+        return entry;
+    }
+
+private:
+    std::vector<T> entries;
+    size_t mask;
+    /// @brief The number of entries popped and pushed. Kept on separate cache
+    ///        lines so the two threads don't contend for one.
+    alignas(64) std::atomic<size_t> head = 0;
+    alignas(64) std::atomic<size_t> tail = 0;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef _SOLUTIONHISTORY_HPP_INC_
+#define _SOLUTIONHISTORY_HPP_INC_
+#include "Maths/DynamicMatrix.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <bit>
+#include <vector>
+
+/// @brief The solution of the MNA system at each timestep of a simulation.
+///
+/// @details Stored time-major, so each step's solution vector is contiguous:
+///          solving a step, and the components reading the few steps before
+///          it, touch a handful of cache lines instead of one per unknown.
+///          Indexing is (unknown, step), the same as the solution matrix it
+///          replaces, and a history with a single step can stand in for the
+///          DC solution vector.
+///          \n\n
+///          A history made by window keeps only the last few steps, in a ring
+///          whose length is a power of two, so a step's slot is its index
+///          masked. The steps before the window are overwritten, and must have
+///          been read out by then. A full history's mask keeps every bit.
+///
+/// @tparam T The value type
+template<typename T>
+struct SolutionHistory {
+    std::vector<T> data;
+    /// @brief The number of unknowns
+    size_t M;
+    /// @brief The number of steps stored
+    size_t N;
+    /// @brief Maps a step to its slot
+    size_t mask = ~size_t(0);
+
+    /// @brief A history of every step
+    SolutionHistory(size_t M, size_t N, T initialValue = 0)
+        : data(M * N, initialValue), M(M), N(N) {
+    }
+
+    /// @brief A history of a step and at least depth steps before it
+    static SolutionHistory window(size_t M, size_t depth) {
+        SolutionHistory history(M, std::bit_ceil(depth + 1));
+        history.mask = history.N - 1;
+        return history;
+    }
+
+    /// @brief Whether every step is kept, rather than a window of them
+    bool keepsAllSteps() const {
+        return mask == ~size_t(0);
+    }
+
+    T & operator()(size_t unknown, size_t step) {
+        return data[(step & mask) * M + unknown];
+    }
+
+    const T & operator()(size_t unknown, size_t step) const {
+        return data[(step & mask) * M + unknown];
+    }
+
+    void fill(T fillVal) {
+        std::fill(data.begin(), data.end(), fillVal);
+    }
+
+    /// @brief The solution vector of a step
+    T * step(size_t n) {
+        return data.data() + (n & mask) * M;
+    }
+
+    const T * step(size_t n) const {
+        return data.data() + (n & mask) * M;
+    }
+
+    /// @brief The voltage of a netlist node at a step, node 0 being ground
+    T voltage(size_t node, size_t n) const {
+        return node > 0 ? (*this)(node - 1, n) : T(0);
+    }
+
+    /// @brief The value of the unknown after the node voltages with the given
+    ///        index, i.e. of a current, at a step
+    ///
+    /// @param sizeG_A The number of node voltages
+    /// @param index The netlist's 1 based index of the current
+    /// @param n The step
+    T current(size_t sizeG_A, size_t index, size_t n) const {
+        return (*this)(sizeG_A + index - 1, n);
+    }
+
+    /// @brief Copies a solution vector into a step
+    void setStep(size_t n, const Matrix<T> & solution) {
+        assert(solution.M == M && solution.N == 1);
+        std::copy(solution.data.begin(), solution.data.end(), step(n));
+    }
+
+    /// @brief Copies a step into a solution vector
+    void getStep(size_t n, Matrix<T> & solution) const {
+        assert(solution.M == M && solution.N == 1);
+        std::copy(step(n), step(n) + M, solution.data.begin());
+    }
+
+    /// @brief Changes the number of steps a full history stores, keeping the
+    ///        steps in both. New steps are zero.
+    void resizeSteps(size_t newN) {
+        assert(keepsAllSteps());
+        data.resize(M * newN, T(0));
+        N = newN;
+    }
+};
+
+/// @brief The voltage from netlist node n2 to netlist node n1 at a step of the
+///        solution history, node 0 being ground
+template<typename T>
+T nodeVoltage(const SolutionHistory<T> & solutionMatrix, size_t n1, size_t n2,
+              size_t step) {
+    return solutionMatrix.voltage(n1, step) - solutionMatrix.voltage(n2, step);
+}
+
+#endif
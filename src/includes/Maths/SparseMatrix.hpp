@@ -0,0 +1,900 @@
+#ifndef _SPARSEMATRIX_HPP_INC_
+#define _SPARSEMATRIX_HPP_INC_
+#include "Maths/DynamicMatrix.hpp"
+#include "Maths/Ordering.hpp"
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <atomic>
+#include "Maths/ThreadPool.hpp"
+
+/// @brief The sparsity pattern of a compressed sparse row (CSR) matrix. Kept
+///        separate from the values so that several matrices (e.g. the static,
+///        dynamic and non-linear stamps) can share a single pattern.
+struct SparsityPattern {
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+    size_t M = 0;
+    size_t N = 0;
+    /// @brief Incremented every time an entry is inserted
+    size_t version = 0;
+    /// @brief The index into column at which each row starts. Has M + 1 entries
+    std::vector<size_t> rowStart;
+    /// @brief The column index of each stored entry, sorted within each row
+    std::vector<size_t> column;
+
+    SparsityPattern(size_t M = 0, size_t N = 0) : M(M), N(N), rowStart(M + 1, 0) {
+    }
+
+    size_t nnz() const {
+        return column.size();
+    }
+
+    /// @brief Finds the slot of entry (m, n)
+    ///
+    /// @return The slot index, or npos if the entry is not stored
+    size_t find(size_t m, size_t n) const {
+        auto begin = column.begin() + rowStart[m];
+        auto end = column.begin() + rowStart[m + 1];
+        auto it = std::lower_bound(begin, end, n);
+        if (it != end && *it == n) {
+            return it - column.begin();
+        }
+        return npos;
+    }
+
+    /// @brief Inserts entry (m, n) into the pattern
+    ///
+    /// @return The slot index the new entry occupies. Every slot at or after this
+    ///         one has been shifted up by one.
+    size_t insert(size_t m, size_t n) {
+        auto begin = column.begin() + rowStart[m];
+        auto end = column.begin() + rowStart[m + 1];
+        size_t slot = std::lower_bound(begin, end, n) - column.begin();
+        column.insert(column.begin() + slot, n);
+        for (size_t r = m + 1; r <= M; r++) {
+            rowStart[r]++;
+        }
+        version++;
+        return slot;
+    }
+
+    /// @brief Checks if every entry of this pattern is also in other
+    bool isSubsetOf(const SparsityPattern & other) const {
+        if (M != other.M || N != other.N) {
+            return false;
+        }
+        for (size_t m = 0; m < M; m++) {
+            size_t k2 = other.rowStart[m];
+            for (size_t k = rowStart[m]; k < rowStart[m + 1]; k++) {
+                while (k2 < other.rowStart[m + 1] && other.column[k2] < column[k]) {
+                    k2++;
+                }
+                if (k2 == other.rowStart[m + 1] || other.column[k2] != column[k]) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+template<typename T>
+struct SparseLU;
+
+/// @brief A compressed sparse row matrix. Entries are created the first time they
+///        are written to, so components can stamp into it exactly as they would a
+///        dense Matrix.
+///
+/// @details Copies share the sparsity pattern. Should a copy need to insert a new
+///          entry, it first takes its own copy of the pattern (copy-on-write), so
+///          matrices sharing a pattern never see each others insertions.
+///
+/// @tparam T the value type
+template<typename T>
+requires arithmetic<T> struct SparseMatrix {
+    std::shared_ptr<SparsityPattern> pattern;
+    std::vector<T> data;
+    size_t M;
+    size_t N;
+
+    SparseMatrix(size_t M, size_t N)
+        : pattern(std::make_shared<SparsityPattern>(M, N)), M(M), N(N) {
+    }
+
+    /// @brief Element access. Inserts the entry if it isn't yet stored.
+    T & operator()(size_t m, size_t n) {
+        size_t slot = pattern->find(m, n);
+        if (slot == SparsityPattern::npos) {
+            slot = insert(m, n);
+        }
+        return data[slot];
+    }
+
+    /// @brief Element access. Entries that are not stored read as zero.
+    const T & operator()(size_t m, size_t n) const {
+        static const T zero = 0;
+        size_t slot = pattern->find(m, n);
+        if (slot == SparsityPattern::npos) {
+            return zero;
+        }
+        return data[slot];
+    }
+
+    size_t nnz() const {
+        return data.size();
+    }
+
+    /// @brief Sets the value of every stored entry, keeping the pattern
+    void fill(T fillVal) {
+        std::fill(data.begin(), data.end(), fillVal);
+    }
+
+    /// @brief Moves this matrix onto a pattern that contains its own, e.g. to
+    ///        let several stamps share the union of their patterns.
+    ///
+    /// @param superset The pattern to adopt
+    ///
+    /// @return false, leaving the matrix untouched, if superset does not contain
+    ///         every stored entry
+    bool adoptPattern(const std::shared_ptr<SparsityPattern> & superset) {
+        if (superset == pattern) {
+            return true;
+        }
+        if (!pattern->isSubsetOf(*superset)) {
+            return false;
+        }
+        const SparsityPattern & pat = *pattern;
+        std::vector<T> newData(superset->nnz(), 0);
+        for (size_t m = 0; m < M; m++) {
+            size_t k2 = superset->rowStart[m];
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                while (superset->column[k2] != pat.column[k]) {
+                    k2++;
+                }
+                newData[k2] = data[k];
+            }
+        }
+        data.swap(newData);
+        pattern = superset;
+        return true;
+    }
+
+    void add(const SparseMatrix<T> & rhs, SparseMatrix<T> & dest) const {
+        assert(N == rhs.N && M == rhs.M);
+        if (&dest != this) {
+            dest = *this;
+        }
+        const SparsityPattern & rhsPat = *rhs.pattern;
+        for (size_t m = 0; m < M; m++) {
+            for (size_t k = rhsPat.rowStart[m]; k < rhsPat.rowStart[m + 1]; k++) {
+                dest(m, rhsPat.column[k]) += rhs.data[k];
+            }
+        }
+    }
+
+    /// @brief Computes dest = this * rhs for a column vector rhs
+    void multiply(const Matrix<T> & rhs, Matrix<T> & dest) const {
+        assert(N == rhs.M && dest.M == M);
+        const SparsityPattern & pat = *pattern;
+        for (size_t m = 0; m < M; m++) {
+            T val = 0;
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                val += data[k] * rhs.data[pat.column[k]];
+            }
+            dest.data[m] = val;
+        }
+    }
+
+    /// @brief Scatters the matrix into a preallocated dense matrix
+    void toDense(Matrix<T> & dest) const {
+        assert(dest.M == M && dest.N == N);
+        dest.fill(0);
+        const SparsityPattern & pat = *pattern;
+        for (size_t m = 0; m < M; m++) {
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                dest.data[m * N + pat.column[k]] = data[k];
+            }
+        }
+    }
+
+    Matrix<T> toDense() const {
+        Matrix<T> toRet(M, N);
+        toDense(toRet);
+        return toRet;
+    }
+
+    std::string toString() const {
+        return toDense().toString();
+    }
+
+    Matrix<T> leftDivide(const Matrix<T> & rhs) const {
+        SparseLU<T> lu;
+        lu.factorise(*this);
+        Matrix<T> toRet(M, 1);
+        lu.solve(rhs, toRet);
+        return toRet;
+    }
+
+private:
+    size_t insert(size_t m, size_t n) {
+        if (pattern.use_count() > 1) {
+            pattern = std::make_shared<SparsityPattern>(*pattern);
+        }
+        size_t slot = pattern->insert(m, n);
+        data.insert(data.begin() + slot, T(0));
+        return slot;
+    }
+};
+
+/// @brief A sparse LU factorisation with partial pivoting, P * A = L * U.
+///
+/// @details A left-looking (Gilbert-Peierls) factorisation. Each column of L and
+///          U is found by a sparse triangular solve whose nonzero pattern is
+///          determined by a depth first search through the columns of L already
+///          computed, so the work is proportional to the number of floating point
+///          operations rather than the dimension of the matrix. Pivoting prefers
+///          the diagonal entry when it is within pivotTolerance of the largest
+///          candidate, which keeps fill low for the mostly diagonally dominant
+///          MNA matrices.
+///          \n\n
+///          The pivot order and the patterns of L and U only depend on the
+///          sparsity pattern of A, which doesn't change over a run. So after the
+///          first factorisation, later calls to factorise reuse them and only
+///          recompute the values (a numeric refactorisation), skipping the depth
+///          first searches and the pivot search. Should a pivot become too small
+///          relative to the rest of its column, the matrix is factorised again
+///          from scratch with fresh pivoting.
+///          \n\n
+///          The columns are factorised in a fill reducing order (see
+///          Ordering.hpp) chosen when the pattern is analysed. The diagonal
+///          preference makes the row order follow it, so this is effectively a
+///          symmetric permutation of A. solve() undoes it, so callers always see
+///          the unknowns in their original order.
+///          \n\n
+///          Column k of a refactorisation only needs the columns of L named in
+///          U(:, k), so after each pivoting factorisation the dependencies
+///          between columns are recorded, and a large matrix is refactorised
+///          on several threads, starting each column as soon as the ones it
+///          needs are done. The trailing block where L and U have filled in is
+///          refactorised as a dense matrix (see DenseKernels::luFactorise)
+///          instead; with nested dissection like orderings, this is where most
+///          of the work is. The values computed don't depend on the number of
+///          threads.
+///
+/// @tparam T the value type
+template<typename T>
+struct SparseLU {
+    static constexpr size_t npos = SparsityPattern::npos;
+    using RealT = decltype(std::abs(std::declval<T>()));
+
+    size_t M = 0;
+    /// @brief Accept the diagonal as the pivot if it is at least this fraction of
+    ///        the largest candidate in its column
+    RealT pivotTolerance = 1e-3;
+    /// @brief Set if a zero pivot was encountered during the last factorisation
+    bool singular = false;
+    /// @brief The column ordering used from the next time the pattern changes
+    Ordering ordering = Ordering::AMD;
+    /// @brief columnOrder[k] is the column of A factorised k-th
+    std::vector<size_t> columnOrder;
+
+    /// @brief Refactorisations of matrices with at least this many unknowns are
+    ///        spread over ThreadPool::shared(), and may use a dense tail
+    size_t parallelThreshold = 2000;
+    /// @brief For matrices over parallelThreshold, the trailing columns are
+    ///        refactorised as a dense block once L + U are this full there
+    double denseTailDensity = 0.6;
+    size_t denseTailMinimum = 64;
+
+    /// @brief The number of factorisations that had to search for pivots
+    size_t pivotingFactorisations = 0;
+    /// @brief The number of factorisations that reused the previous pivot order
+    size_t refactorisations = 0;
+
+    /// @brief Column pointers of L (CSC). L has a unit diagonal which is not
+    ///        stored. Row indices refer to pivot order.
+    std::vector<size_t> lColStart;
+    std::vector<size_t> lRow;
+    std::vector<T> lVal;
+
+    /// @brief Column pointers of U (CSC). The diagonal is the last entry of each
+    ///        column. Row indices refer to pivot order.
+    std::vector<size_t> uColStart;
+    std::vector<size_t> uRow;
+    std::vector<T> uVal;
+
+    /// @brief pinv[i] is the pivot position of original row i
+    std::vector<size_t> pinv;
+
+    /// @brief Factorises A, which must be square. Reuses the previous pivot order
+    ///        if A has the same sparsity pattern as the last matrix factorised.
+    void factorise(const SparseMatrix<T> & A) {
+        assert(A.M == A.N);
+        if (A.pattern != analysedPattern || A.pattern->version != analysedVersion ||
+            A.M != M) {
+            analyse(A);
+        }
+        gatherValues(A);
+
+        if (pivotOrderIsValid && refactorise()) {
+            refactorisations++;
+            return;
+        }
+        pivotingFactorise();
+        pivotingFactorisations++;
+    }
+
+    /// @brief Forces the next factorisation to search for pivots again
+    void invalidatePivotOrder() {
+        pivotOrderIsValid = false;
+    }
+
+    /// @brief Solves A * dest = rhs using the stored factorisation
+    void solve(const Matrix<T> & rhs, Matrix<T> & dest) const {
+        solve(rhs, dest.data.begin());
+    }
+
+    template<typename Iterator>
+    void solve(const Matrix<T> & rhs, Iterator destBegin) const {
+        for (size_t i = 0; i < M; i++) {
+            y[pinv[i]] = rhs.data[i];
+        }
+
+        // L * z = P * b
+        size_t sparseEnd = tailIsDense ? tailStart : M;
+        for (size_t j = 0; j < sparseEnd; j++) {
+            T yj = y[j];
+            for (size_t p = lColStart[j]; p < lColStart[j + 1]; p++) {
+                y[lRow[p]] -= lVal[p] * yj;
+            }
+        }
+
+        // U * x = z
+        if (tailIsDense) {
+            size_t nt = M - tailStart;
+            for (size_t m = 0; m < nt; m++) {
+                tailWork[m] = y[tailStart + tailLU.p[m]];
+            }
+            DenseKernels::luSolve(tailLU.lu.data.data(), nt, tailWork.data());
+            std::copy(tailWork.begin(), tailWork.end(), y.begin() + tailStart);
+            for (size_t k = tailStart; k < M; k++) {
+                T yk = y[k];
+                for (size_t p = uColStart[k]; p < uColStart[k + 1]; p++) {
+                    if (uRow[p] < tailStart) {
+                        y[uRow[p]] -= uVal[p] * yk;
+                    }
+                }
+            }
+        }
+        for (size_t j = sparseEnd; j-- > 0;) {
+            size_t diag = uColStart[j + 1] - 1;
+            y[j] /= uVal[diag];
+            T yj = y[j];
+            for (size_t p = uColStart[j]; p < diag; p++) {
+                y[uRow[p]] -= uVal[p] * yj;
+            }
+        }
+
+        for (size_t k = 0; k < M; k++) {
+            destBegin[columnOrder[k]] = y[k];
+        }
+    }
+
+    /// @brief The number of stored entries in L and U
+    size_t nnz() const {
+        return lRow.size() + uRow.size();
+    }
+
+    /// @brief The size of the trailing block refactorised as a dense matrix
+    size_t denseTailSize() const {
+        return M - tailStart;
+    }
+
+    /// @brief Predicts nnz() for the last analysed pattern if it were factorised
+    ///        with the given ordering, assuming diagonal pivots
+    size_t predictedNNZ(Ordering predictedOrdering) const {
+        if (!analysedPattern) {
+            return 0;
+        }
+        const SparsityPattern & pat = *analysedPattern;
+        auto order = computeOrdering(predictedOrdering, M, pat.rowStart, pat.column);
+        return 2 * choleskyFill(M, pat.rowStart, pat.column, order) - M;
+    }
+
+private:
+    /// @brief A copy of the matrix being factorised in compressed sparse column
+    ///        format
+    std::vector<size_t> aColStart;
+    std::vector<size_t> aRow;
+    std::vector<T> aVal;
+    /// @brief The position in aVal of each entry of the CSR matrix
+    std::vector<size_t> cscSlot;
+
+    /// @brief The pattern (and its version) that aColStart/aRow were built from.
+    ///        Holding on to it keeps the pointer comparison meaningful.
+    std::shared_ptr<SparsityPattern> analysedPattern;
+    size_t analysedVersion = 0;
+    /// @brief Whether pinv and the patterns of L and U match the analysed pattern
+    bool pivotOrderIsValid = false;
+
+    /// @brief dense work vector for the factorisation
+    std::vector<T> x;
+    /// @brief dense work vectors for each thread of the parallel refactorisation
+    std::vector<std::vector<T> > workerX;
+    /// @brief The number of columns each column waits for, and the columns
+    ///        waiting on each column (dependent[dependentStart[j]:
+    ///        dependentStart[j + 1]])
+    std::vector<size_t> dependencyCount;
+    std::vector<size_t> dependentStart;
+    std::vector<size_t> dependent;
+    /// @brief Scheduling state of the parallel refactorisation, only accessed
+    ///        through std::atomic_ref while the threads are running
+    std::vector<size_t> remainingDependencies;
+    std::vector<size_t> readyColumn;
+    /// @brief The trailing block from tailStart, and whether the last
+    ///        factorisation stored it in tailLU rather than in L and U
+    size_t tailStart = 0;
+    bool tailIsDense = false;
+    LUPair<T> tailLU = LUPair<T>(0);
+    mutable std::vector<T> tailWork;
+    /// @brief dense work vector for the solve
+    mutable std::vector<T> y;
+    /// @brief holds the topologically ordered reach in stack[top:M]
+    std::vector<size_t> stack;
+    /// @brief the depth first search stack and the position within each column
+    std::vector<size_t> dfsStack;
+    std::vector<size_t> dfsPos;
+    std::vector<size_t> mark;
+    size_t markCount = 0;
+
+    /// @brief The symbolic part. Chooses the column order and builds the
+    ///        compressed column structure of A with its columns in that order, and
+    ///        throws away the previous pivot order.
+    void analyse(const SparseMatrix<T> & A) {
+        resize(A.M);
+        const SparsityPattern & pat = *A.pattern;
+        columnOrder = computeOrdering(ordering, M, pat.rowStart, pat.column);
+        std::vector<size_t> position(M);
+        for (size_t k = 0; k < M; k++) {
+            position[columnOrder[k]] = k;
+        }
+
+        aColStart.assign(M + 1, 0);
+        aRow.resize(pat.nnz());
+        aVal.resize(pat.nnz());
+        cscSlot.resize(pat.nnz());
+        for (size_t c : pat.column) {
+            aColStart[position[c] + 1]++;
+        }
+        for (size_t n = 0; n < M; n++) {
+            aColStart[n + 1] += aColStart[n];
+        }
+        std::vector<size_t> next(aColStart.begin(), aColStart.end() - 1);
+        for (size_t m = 0; m < M; m++) {
+            for (size_t k = pat.rowStart[m]; k < pat.rowStart[m + 1]; k++) {
+                size_t dest = next[position[pat.column[k]]]++;
+                aRow[dest] = m;
+                cscSlot[k] = dest;
+            }
+        }
+
+        analysedPattern = A.pattern;
+        analysedVersion = pat.version;
+        pivotOrderIsValid = false;
+    }
+
+    void gatherValues(const SparseMatrix<T> & A) {
+        for (size_t k = 0; k < cscSlot.size(); k++) {
+            aVal[cscSlot[k]] = A.data[k];
+        }
+    }
+
+    /// @brief The numeric part. Recomputes L and U reusing the pivot order and
+    ///        the patterns of the last pivoting factorisation.
+    ///
+    /// @details Large matrices are shared between the threads of
+    ///          ThreadPool::shared().
+    ///
+    /// @return false if a pivot is too small to be used safely, in which case L
+    ///         and U are left in an unusable state.
+    bool refactorise() {
+        ThreadPool & pool = ThreadPool::shared();
+        bool parallel = M >= parallelThreshold && pool.size() > 1;
+        if (parallel) {
+            if (workerX.size() != pool.size() || workerX[0].size() != M) {
+                workerX.assign(pool.size(), std::vector<T>(M, 0));
+            }
+            if (!refactoriseSparseColumnsInParallel(pool)) {
+                return false;
+            }
+        } else {
+            for (size_t k = 0; k < tailStart; k++) {
+                if (!refactoriseColumn(k, x)) {
+                    return false;
+                }
+            }
+        }
+
+        if (tailStart < M && !factoriseDenseTail(pool, parallel)) {
+            return false;
+        }
+        tailIsDense = tailStart < M;
+        singular = false;
+        return true;
+    }
+
+    /// @brief Refactorises the columns before the dense tail on all the threads.
+    ///        Each column is queued as soon as the columns it depends on are
+    ///        done, and the threads take columns from the queue in turn.
+    bool refactoriseSparseColumnsInParallel(ThreadPool & pool) {
+        // set up before the threads start, so plain writes will do
+        std::copy(dependencyCount.begin(), dependencyCount.end(),
+                  remainingDependencies.begin());
+        std::fill(readyColumn.begin(), readyColumn.end(), npos);
+        std::atomic<size_t> queued = 0;
+        std::atomic<size_t> taken = 0;
+        std::atomic<bool> pivotsAreUsable = true;
+        auto enqueue = [&](size_t k) {
+            std::atomic_ref<size_t>(readyColumn[queued.fetch_add(1)])
+                .store(k, std::memory_order_release);
+        };
+        for (size_t k = 0; k < tailStart; k++) {
+            if (dependencyCount[k] == 0) {
+                enqueue(k);
+            }
+        }
+
+        // Every column is queued exactly once, so each ticket below tailStart
+        // is eventually filled in. Tickets are taken in order, and the earliest
+        // unfinished column is always queued or running, so this can't stall.
+        pool.parallelFor(pool.size(), [&](size_t, size_t, size_t worker) {
+            std::vector<T> & work = workerX[worker];
+            while (true) {
+                size_t ticket = taken.fetch_add(1, std::memory_order_relaxed);
+                if (ticket >= tailStart) {
+                    return;
+                }
+                size_t k;
+                std::atomic_ref<size_t> slot(readyColumn[ticket]);
+                while ((k = slot.load(std::memory_order_acquire)) == npos) {
+                    std::this_thread::yield();
+                }
+                // carry on after a failure so the queue still drains
+                if (!refactoriseColumn(k, work)) {
+                    pivotsAreUsable = false;
+                }
+                for (size_t d = dependentStart[k]; d < dependentStart[k + 1]; d++) {
+                    size_t c = dependent[d];
+                    std::atomic_ref<size_t> remaining(remainingDependencies[c]);
+                    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        enqueue(c);
+                    }
+                }
+            }
+        });
+        return pivotsAreUsable;
+    }
+
+    /// @brief Recomputes column k of L and U. Only reads the columns of L that
+    ///        U(:, k) refers to, so independent columns can be done at once.
+    ///
+    /// @param work A zeroed dense work vector, which is left zeroed
+    ///
+    /// @return false if the pivot is too small
+    bool refactoriseColumn(size_t k, std::vector<T> & work) {
+        for (size_t p = aColStart[k]; p < aColStart[k + 1]; p++) {
+            work[pinv[aRow[p]]] = aVal[p];
+        }
+
+        // U(:, k) is stored in topological order, so each work[j] is final by the
+        // time it is used
+        size_t diag = uColStart[k + 1] - 1;
+        for (size_t p = uColStart[k]; p < diag; p++) {
+            size_t j = uRow[p];
+            T xj = work[j];
+            uVal[p] = xj;
+            work[j] = 0;
+            for (size_t q = lColStart[j]; q < lColStart[j + 1]; q++) {
+                work[lRow[q]] -= lVal[q] * xj;
+            }
+        }
+
+        T pivot = work[k];
+        work[k] = 0;
+        RealT maxL = 0;
+        for (size_t q = lColStart[k]; q < lColStart[k + 1]; q++) {
+            maxL = std::max(maxL, RealT(std::abs(work[lRow[q]])));
+        }
+        if (pivot == T(0) || !(std::abs(pivot) >= pivotTolerance * maxL)) {
+            for (size_t q = lColStart[k]; q < lColStart[k + 1]; q++) {
+                work[lRow[q]] = 0;
+            }
+            return false;
+        }
+
+        uVal[diag] = pivot;
+        for (size_t q = lColStart[k]; q < lColStart[k + 1]; q++) {
+            lVal[q] = work[lRow[q]] / pivot;
+            work[lRow[q]] = 0;
+        }
+        return true;
+    }
+
+    /// @brief Refactorises the columns from tailStart on as a dense block. The
+    ///        sparse columns' contributions to each tail column are applied
+    ///        first (independently, so the tail columns are shared between
+    ///        threads), then the block gets a blocked dense LU with its own
+    ///        partial pivoting.
+    ///
+    /// @return false if the block is singular
+    bool factoriseDenseTail(ThreadPool & pool, bool parallel) {
+        size_t nt = M - tailStart;
+        T * dense = tailLU.lu.data.data();
+        std::fill(tailLU.lu.data.begin(), tailLU.lu.data.end(), T(0));
+
+        auto gatherColumns = [&](size_t first, size_t last, std::vector<T> & work) {
+            for (size_t k = tailStart + first; k < tailStart + last; k++) {
+                for (size_t p = aColStart[k]; p < aColStart[k + 1]; p++) {
+                    work[pinv[aRow[p]]] = aVal[p];
+                }
+                // the entries of U(:, k) above the tail, in topological order
+                for (size_t p = uColStart[k]; p < uColStart[k + 1]; p++) {
+                    size_t j = uRow[p];
+                    if (j >= tailStart) {
+                        continue;
+                    }
+                    T xj = work[j];
+                    uVal[p] = xj;
+                    work[j] = 0;
+                    for (size_t q = lColStart[j]; q < lColStart[j + 1]; q++) {
+                        work[lRow[q]] -= lVal[q] * xj;
+                    }
+                }
+                // what is left lies within the pattern of the tail
+                size_t column = k - tailStart;
+                for (size_t p = uColStart[k]; p < uColStart[k + 1]; p++) {
+                    size_t i = uRow[p];
+                    if (i >= tailStart) {
+                        dense[(i - tailStart) * nt + column] = work[i];
+                        work[i] = 0;
+                    }
+                }
+                for (size_t q = lColStart[k]; q < lColStart[k + 1]; q++) {
+                    size_t i = lRow[q];
+                    dense[(i - tailStart) * nt + column] = work[i];
+                    work[i] = 0;
+                }
+            }
+        };
+
+        if (parallel) {
+            pool.parallelFor(nt, [&](size_t first, size_t last, size_t worker) {
+                gatherColumns(first, last, workerX[worker]);
+            });
+        } else {
+            gatherColumns(0, nt, x);
+        }
+
+        DenseKernels::luFactorise(dense, nt, tailLU.p.data());
+        for (size_t m = 0; m < nt; m++) {
+            if (!(std::abs(dense[m * nt + m]) > 0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// @brief Chooses the dense tail, then finds which of the columns before it
+    ///        depend on each other. Column k needs the columns j with U(j, k)
+    ///        nonzero to be refactorised first.
+    void scheduleColumns() {
+        // the largest trailing block that is at least denseTailDensity full
+        tailStart = M;
+        if (M >= parallelThreshold) {
+            std::vector<size_t> rowCount(M, 0);
+            for (size_t row : uRow) {
+                rowCount[row]++;
+            }
+            double entries = 0;
+            for (size_t t = M; t-- > 0;) {
+                entries += lColStart[t + 1] - lColStart[t] + rowCount[t];
+                double nt = M - t;
+                if (nt >= denseTailMinimum &&
+                    entries >= denseTailDensity * nt * nt) {
+                    tailStart = t;
+                }
+            }
+        }
+        if (tailStart < M) {
+            tailLU = LUPair<T>(M - tailStart);
+            tailWork.assign(M - tailStart, 0);
+        }
+        if (M < parallelThreshold) {
+            return;
+        }
+
+        dependencyCount.assign(tailStart, 0);
+        dependentStart.assign(tailStart + 1, 0);
+        for (size_t k = 0; k < tailStart; k++) {
+            for (size_t p = uColStart[k]; p + 1 < uColStart[k + 1]; p++) {
+                dependencyCount[k]++;
+                dependentStart[uRow[p] + 1]++;
+            }
+        }
+        for (size_t j = 0; j < tailStart; j++) {
+            dependentStart[j + 1] += dependentStart[j];
+        }
+        dependent.resize(dependentStart[tailStart]);
+        std::vector<size_t> next(dependentStart.begin(), dependentStart.end() - 1);
+        for (size_t k = 0; k < tailStart; k++) {
+            for (size_t p = uColStart[k]; p + 1 < uColStart[k + 1]; p++) {
+                dependent[next[uRow[p]]++] = k;
+            }
+        }
+        remainingDependencies.resize(tailStart);
+        readyColumn.resize(tailStart);
+    }
+
+    /// @brief Factorises the gathered matrix, choosing a new pivot order
+    void pivotingFactorise() {
+        lColStart.assign(M + 1, 0);
+        uColStart.assign(M + 1, 0);
+        lRow.clear();
+        lVal.clear();
+        uRow.clear();
+        uVal.clear();
+        std::fill(pinv.begin(), pinv.end(), npos);
+        singular = false;
+        tailIsDense = false;
+
+        for (size_t k = 0; k < M; k++) {
+            lColStart[k] = lRow.size();
+            uColStart[k] = uRow.size();
+
+            size_t top = reach(k);
+            // scatter A(:, k) into the dense work vector
+            for (size_t p = aColStart[k]; p < aColStart[k + 1]; p++) {
+                x[aRow[p]] = aVal[p];
+            }
+
+            // sparse triangular solve, L(:, 0:k-1) \ A(:, k)
+            for (size_t px = top; px < M; px++) {
+                size_t i = stack[px];
+                size_t j = pinv[i];
+                if (j == npos) {
+                    continue;
+                }
+                T xi = x[i];
+                for (size_t p = lColStart[j]; p < lColStart[j + 1]; p++) {
+                    x[lRow[p]] -= lVal[p] * xi;
+                }
+            }
+
+            // choose the pivot from the rows that haven't been pivoted on yet
+            size_t pivotRow = npos;
+            RealT maxV = -1;
+            for (size_t px = top; px < M; px++) {
+                size_t i = stack[px];
+                if (pinv[i] == npos) {
+                    RealT v = std::abs(x[i]);
+                    if (v > maxV) {
+                        maxV = v;
+                        pivotRow = i;
+                    }
+                } else {
+                    uRow.emplace_back(pinv[i]);
+                    uVal.emplace_back(x[i]);
+                }
+            }
+            size_t diagRow = columnOrder[k];
+            if (pinv[diagRow] == npos && x[diagRow] != T(0) &&
+                std::abs(x[diagRow]) >= pivotTolerance * maxV) {
+                pivotRow = diagRow;
+            }
+            if (pivotRow == npos) {
+                // structurally singular, pick any free row to keep going
+                pivotRow = std::find(pinv.begin(), pinv.end(), npos) - pinv.begin();
+            }
+
+            T pivot = x[pivotRow];
+            if (pivot == T(0)) {
+                singular = true;
+            }
+            uRow.emplace_back(k);
+            uVal.emplace_back(pivot);
+            pinv[pivotRow] = k;
+
+            for (size_t px = top; px < M; px++) {
+                size_t i = stack[px];
+                if (pinv[i] == npos) {
+                    lRow.emplace_back(i);
+                    lVal.emplace_back(x[i] / pivot);
+                }
+                x[i] = 0;
+            }
+            x[pivotRow] = 0;
+        }
+        lColStart[M] = lRow.size();
+        uColStart[M] = uRow.size();
+
+        // convert the row indices of L from original rows to pivot order
+        for (auto & row : lRow) {
+            row = pinv[row];
+        }
+        scheduleColumns();
+        pivotOrderIsValid = true;
+    }
+
+    void resize(size_t newM) {
+        if (M == newM && x.size() == newM) {
+            return;
+        }
+        M = newM;
+        tailStart = M;
+        tailIsDense = false;
+        x.assign(M, 0);
+        y.assign(M, 0);
+        pinv.assign(M, npos);
+        stack.assign(M, 0);
+        dfsStack.assign(M, 0);
+        dfsPos.assign(M, 0);
+        mark.assign(M, 0);
+        markCount = 0;
+    }
+
+    /// @brief Finds the rows reachable from the pattern of A(:, k) through the
+    ///        graph of L, leaving them in topological order in stack[top:M].
+    size_t reach(size_t k) {
+        if (++markCount == 0) {
+            std::fill(mark.begin(), mark.end(), 0);
+            markCount = 1;
+        }
+        size_t top = M;
+        for (size_t p = aColStart[k]; p < aColStart[k + 1]; p++) {
+            if (mark[aRow[p]] != markCount) {
+                top = depthFirstSearch(aRow[p], top);
+            }
+        }
+        return top;
+    }
+
+    size_t depthFirstSearch(size_t start, size_t top) {
+        size_t head = 0;
+        dfsStack[0] = start;
+        while (head != npos) {
+            size_t i = dfsStack[head];
+            size_t j = pinv[i];
+            if (mark[i] != markCount) {
+                mark[i] = markCount;
+                dfsPos[head] = (j == npos) ? 0 : lColStart[j];
+            }
+            bool done = true;
+            size_t end = (j == npos) ? 0 : lColEnd(j);
+            for (size_t p = dfsPos[head]; p < end; p++) {
+                size_t r = lRow[p];
+                if (mark[r] == markCount) {
+                    continue;
+                }
+                dfsPos[head] = p + 1;
+                dfsStack[++head] = r;
+                done = false;
+                break;
+            }
+            if (done) {
+                head = (head == 0) ? npos : head - 1;
+                stack[--top] = i;
+            }
+        }
+        return top;
+    }
+
+    /// @brief L(:, j) is only complete for already pivoted columns, whose end is
+    ///        the start of the next column.
+    size_t lColEnd(size_t j) const {
+        return lColStart[j + 1];
+    }
+};
+
+#endif
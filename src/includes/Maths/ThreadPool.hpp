@@ -0,0 +1,128 @@
+#ifndef _THREADPOOL_HPP_INC_
+#define _THREADPOOL_HPP_INC_
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+/// @brief A fixed set of worker threads for fork-join parallel loops.
+///
+/// @details The workers are started once and then sleep until a loop is
+///          submitted, so a parallel loop costs a wake up rather than a thread
+///          creation. The calling thread takes part as worker 0. Work is split
+///          into one contiguous range per worker, so the same range always goes
+///          to the same worker and results don't depend on the scheduling.
+///          \n\n
+///          Loops may only be submitted from one thread at a time, and not from
+///          inside another loop.
+class ThreadPool {
+public:
+    /// @param threads The number of threads to run loops on, including the
+    ///                calling thread
+    explicit ThreadPool(size_t threads) {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 1; i < threads; i++) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto & worker : workers) {
+            worker.join();
+        }
+    }
+
+    /// @brief The number of threads loops run on, including the caller
+    size_t size() const {
+        return workers.size() + 1;
+    }
+
+    /// @brief Runs body(begin, end, worker) over [0, count), split into size()
+    ///        contiguous ranges, and waits for all of them to finish.
+    ///
+    /// @param grain The fewest iterations worth a range of their own. Loops
+    ///              shorter than two grains run on the calling thread alone.
+    template<typename F>
+    void parallelFor(size_t count, F && body, size_t grain = 1) {
+        size_t parts = std::min(size(), count / std::max<size_t>(grain, 1));
+        if (parts <= 1) {
+            if (count) {
+                body(size_t(0), count, size_t(0));
+            }
+            return;
+        }
+        std::function<void(size_t)> task = [&](size_t worker) {
+            if (worker < parts) {
+                body(count * worker / parts, count * (worker + 1) / parts, worker);
+            }
+        };
+        run(task);
+    }
+
+    /// @brief The pool shared by the solvers, with one thread per hardware
+    ///        thread. Created on first use.
+    static ThreadPool & shared() {
+        static ThreadPool pool(std::thread::hardware_concurrency());
+        return pool;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void(size_t)> * task = nullptr;
+    size_t generation = 0;
+    size_t running = 0;
+    bool stopping = false;
+
+    void run(const std::function<void(size_t)> & newTask) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = &newTask;
+            running = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        newTask(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return running == 0; });
+        task = nullptr;
+    }
+
+    void workerLoop(size_t index) {
+        size_t seen = 0;
+        while (true) {
+            const std::function<void(size_t)> * current;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+                current = task;
+            }
+            (*current)(index);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--running == 0) {
+                    finished.notify_one();
+                }
+            }
+        }
+    }
+};
+
+#endif
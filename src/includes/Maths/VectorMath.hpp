@@ -0,0 +1,142 @@
+#ifndef _VECTORMATH_HPP_INC_
+#define _VECTORMATH_HPP_INC_
+#include <cstddef>
+#include <cmath>
+#include <iterator>
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+/// @brief Elementary functions over arrays, for evaluating many device models
+///        at once.
+///
+/// @details double gets AVX-512 or AVX2 + FMA kernels when the compiler targets
+///          them (e.g. -march=native). Every other type, and the elements left
+///          over at the end of an array, use the standard library.
+namespace VectorMath {
+
+/// @brief Wraps the vector intrinsics exp needs for T. enabled is false when
+///        there is no kernel for T on this target.
+template<typename T>
+struct ExpSimd {
+    static constexpr bool enabled = false;
+    static constexpr size_t width = 1;
+};
+
+#if defined(__AVX512F__)
+template<>
+struct ExpSimd<double> {
+    using Vec = __m512d;
+    static constexpr bool enabled = true;
+    static constexpr size_t width = 8;
+    static Vec load(const double * p) { return _mm512_loadu_pd(p); }
+    static void store(double * p, Vec v) { _mm512_storeu_pd(p, v); }
+    static Vec broadcast(double x) { return _mm512_set1_pd(x); }
+    static Vec mul(Vec a, Vec b) { return _mm512_mul_pd(a, b); }
+    /// @brief c + a * b
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm512_fmadd_pd(a, b, c); }
+    /// @brief c - a * b
+    static Vec fnmadd(Vec a, Vec b, Vec c) { return _mm512_fnmadd_pd(a, b, c); }
+    // the zero masked forms with every lane selected are used below because
+    // GCC warns about the undefined pass through of the unmasked ones
+
+    /// @brief max / min return their second argument if either is NaN
+    static Vec max(Vec a, Vec b) { return _mm512_maskz_max_pd(all, a, b); }
+    static Vec min(Vec a, Vec b) { return _mm512_maskz_min_pd(all, a, b); }
+    static Vec round(Vec a) {
+        return _mm512_maskz_roundscale_pd(all, a, _MM_FROUND_TO_NEAREST_INT |
+                                                      _MM_FROUND_NO_EXC);
+    }
+    /// @brief a * 2^n, for integral n
+    static Vec scale(Vec a, Vec n) { return _mm512_maskz_scalef_pd(all, a, n); }
+
+private:
+    static constexpr __mmask8 all = 0xFF;
+};
+#elif defined(__AVX2__) && defined(__FMA__)
+template<>
+struct ExpSimd<double> {
+    using Vec = __m256d;
+    static constexpr bool enabled = true;
+    static constexpr size_t width = 4;
+    static Vec load(const double * p) { return _mm256_loadu_pd(p); }
+    static void store(double * p, Vec v) { _mm256_storeu_pd(p, v); }
+    static Vec broadcast(double x) { return _mm256_set1_pd(x); }
+    static Vec mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm256_fmadd_pd(a, b, c); }
+    static Vec fnmadd(Vec a, Vec b, Vec c) { return _mm256_fnmadd_pd(a, b, c); }
+    static Vec max(Vec a, Vec b) { return _mm256_max_pd(a, b); }
+    static Vec min(Vec a, Vec b) { return _mm256_min_pd(a, b); }
+    static Vec round(Vec a) {
+        return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    }
+    static Vec scale(Vec a, Vec n) {
+        // adding 1.5 * 2^52 leaves n in the low bits of the mantissa, from where
+        // it can be moved into the exponent field of 2^n
+        const __m256d shifter = _mm256_set1_pd(6755399441055744.0);
+        __m256i bits = _mm256_sub_epi64(
+            _mm256_castpd_si256(_mm256_add_pd(n, shifter)),
+            _mm256_castpd_si256(shifter));
+        bits = _mm256_slli_epi64(_mm256_add_epi64(bits, _mm256_set1_epi64x(1023)),
+                                 52);
+        return _mm256_mul_pd(a, _mm256_castsi256_pd(bits));
+    }
+};
+#endif
+
+/// @brief y[i] = exp(x[i]) for i in [0, n). x and y may be the same array.
+///
+/// @details The vector kernel reduces x = k * ln(2) + r with |r| <= ln(2) / 2,
+///          evaluates exp(r) with its Taylor series to degree 13 (truncation
+///          error below 1e-17) and scales by 2^k. It agrees with std::exp to
+///          within 1 ulp. x is clamped to [-708, 709], so results that would be
+///          subnormal or overflow come out as the nearest bound instead; NaN is
+///          passed through.
+template<typename T>
+inline void exp(const T * x, T * y, size_t n) {
+    size_t i = 0;
+    if constexpr (ExpSimd<T>::enabled) {
+        using S = ExpSimd<T>;
+        const auto lower = S::broadcast(-708.0);
+        const auto upper = S::broadcast(709.0);
+        const auto log2e = S::broadcast(1.4426950408889634074);
+        // ln(2) split so that k * ln2High is exact for |k| < 2^11
+        const auto ln2High = S::broadcast(6.93147180369123816490e-01);
+        const auto ln2Low = S::broadcast(1.90821492927058770002e-10);
+        constexpr double inverseFactorial[] = {
+            1.0,
+            1.0,
+            1.0 / 2,
+            1.0 / 6,
+            1.0 / 24,
+            1.0 / 120,
+            1.0 / 720,
+            1.0 / 5040,
+            1.0 / 40320,
+            1.0 / 362880,
+            1.0 / 3628800,
+            1.0 / 39916800,
+            1.0 / 479001600,
+            1.0 / 6227020800,
+        };
+        constexpr size_t degree = std::size(inverseFactorial) - 1;
+
+        for (; i + S::width <= n; i += S::width) {
+            auto v = S::min(upper, S::max(lower, S::load(x + i)));
+            auto k = S::round(S::mul(v, log2e));
+            auto r = S::fnmadd(k, ln2Low, S::fnmadd(k, ln2High, v));
+            auto p = S::broadcast(inverseFactorial[degree]);
+            for (size_t d = degree; d-- > 0;) {
+                p = S::fmadd(p, r, S::broadcast(inverseFactorial[d]));
+            }
+            S::store(y + i, S::scale(p, k));
+        }
+    }
+    for (; i < n; i++) {
+        y[i] = std::exp(x[i]);
+    }
+}
+
+} // namespace VectorMath
+
+#endif